@@ -122,7 +122,7 @@ public:
         {
             LOG_ERROR(LOG_ROOT()) << "ConfigItem::fromString exception "
                 << e.what() << "convert: string to " << util::typeToName<T>() << " name="
-                << m_name << " - " << m_val;
+                << m_name << " - " << val;
         }
         return false;
     }
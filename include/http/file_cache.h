@@ -0,0 +1,191 @@
+/**
+ * @author  2mu
+ * @date    2024/5/4
+ * @brief   静态文件缓存
+ * 1. 以路径为key, 缓存打开的fd, 文件大小, mtime, MIME类型, 以及事先拼好的Content-Type/Content-Length头部字段;
+ *    命中时不需要access()/stat()/open()
+ * 2. 不超过内存阈值的小文件直接读到内存中, 发送时和头部一起writev; 大文件用缓存的fd发送(sendfile带偏移, 不改变文件偏移, 可以多个连接共用)
+ * 3. 条目数量有上限, 超过时用CLOCK(second chance)淘汰最近没有被访问的; 命中时只设置访问标记, 不移动链表节点
+ * 4. 失效: 条目超过ttl没有检查过时, 下一次命中重新stat()一次, 文件被修改/替换/删除则重新加载;
+ *    所以文件修改之后最多ttl毫秒内还可能返回旧的内容
+ * 5. 多个事件循环线程共用, 按路径的哈希分成多个分片, 每个分片一把锁, 只保护分片的查找表;
+ *    命中时只有一次查找, stat()/open()/read()都不在锁内执行
+ * 6. gzip: 有"<path>.gz"文件时直接使用它, 否则对内存中(不超过内存阈值)的文本类型文件用zlib压缩;
+ *    压缩后的版本保存在原文件的条目旁边, 原文件失效时一起失效
+ * 7. 设置了responseHeaders时, 内存中的文件还会预先拼好完整的200响应(状态行, 头部字段, body),
+ *    命中时一次write就能发送; 启动时可以用preload()把静态资源目录下的小文件全部加载进来
+ */
+
+#ifndef WEBSERVER_FILE_CACHE_H
+#define WEBSERVER_FILE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <boost/noncopyable.hpp>
+
+#include "thread/mutex.h"
+
+namespace WebServer
+{
+    class StaticFileCache : boost::noncopyable
+    {
+    public:
+        /**
+         * @brief 缓存的文件; 只读, 最后一个引用释放时关闭fd
+         */
+        struct Entry : boost::noncopyable
+        {
+            typedef std::shared_ptr<const Entry> ptr;
+
+            int         fd;
+            off_t       size;
+            time_t      mtime;
+            long        mtimeNsec;
+            dev_t       dev;
+            ino_t       ino;
+            std::string mime;
+            std::string etag;           // 由mtime和大小生成的强标签, gzip版本带"-gz"后缀
+            std::string lastModified;   // HTTP-date格式的mtime
+            bool        gzip;           // Content-Encoding: gzip
+            bool        vary;           // 有gzip版本, 响应要带上Vary: Accept-Encoding
+            std::string headers;        // 200响应的Content-Type, ETag, Last-Modified, Content-Length等, 每一行都带CRLF
+            std::string data;       // 小文件的内容(没有生成完整响应时); 大文件为空, 用fd发送
+            bool        inMemory;
+            std::string response;   // 完整的200响应(长连接), 没有设置responseHeaders或者大文件时为空;
+                                    // 生成了完整响应时文件内容只保存在这里, data为空, 不保存两份
+            size_t      responseHeaderLen;  // response中头部(含空行)的长度, HEAD请求只发送这部分
+
+            Entry() : fd(-1), size(0), mtime(0), mtimeNsec(0), dev(0), ino(0), gzip(false), vary(false),
+                      inMemory(false), responseHeaderLen(0) {}
+            ~Entry();
+
+            /**
+             * @brief 内存中的文件内容, 长度为size; 只能在inMemory时调用
+             */
+            const char* body() const
+            {
+                return response.empty() ? data.data() : response.data() + responseHeaderLen;
+            }
+        };
+
+        /**
+         * @param maxEntries 最多缓存的文件数(也就是最多占用的fd数)
+         * @param ttl 条目多久(毫秒)之后需要重新stat()检查
+         * @param memThreshold 不超过该大小的文件内容读到内存中
+         */
+        explicit StaticFileCache(size_t maxEntries = 256, uint64_t ttl = 1000, size_t memThreshold = 64 * 1024);
+        ~StaticFileCache();
+
+        /**
+         * @brief 修改参数, 超出新上限的条目马上淘汰
+         */
+        void configure(size_t maxEntries, uint64_t ttl, size_t memThreshold);
+
+        /**
+         * @brief 完整响应中除了Content-Type/Content-Length之外的头部字段(例如"Connection: keep-alive\r\n"),
+         * 之后加载的小文件才会生成完整响应; 为空表示不生成
+         */
+        void setResponseHeaders(const std::string& headers);
+
+        /**
+         * @brief 把dir(递归)下不超过内存阈值的文件加载到缓存中, 直到缓存满
+         * @return 加载的文件数
+         */
+        size_t preload(const std::string& dir);
+
+        /**
+         * @brief 获取path对应的文件
+         * @return 不存在, 不是普通文件或者打开失败时返回nullptr(errno指示原因), 由调用者自己处理
+         */
+        Entry::ptr get(const std::string& path);
+
+        /**
+         * @brief 获取path的gzip版本(头部字段带Content-Encoding: gzip)
+         * @param raw 刚刚由get(path)返回的原文件
+         * @return 没有.gz文件, 不值得压缩或者压缩失败时返回nullptr, 这时发送原文件
+         */
+        Entry::ptr getGzip(const std::string& path, const Entry::ptr& raw);
+
+        /**
+         * @brief 删除path对应的条目
+         */
+        void invalidate(const std::string& path);
+
+        void clear();
+
+        size_t size();
+
+        /**
+         * @brief 根据路径的后缀得到MIME类型
+         */
+        static const char* mimeOf(const std::string& path);
+
+    private:
+        struct Node
+        {
+            Entry::ptr                          entry;
+            Entry::ptr                          gzip;       // entry的gzip版本
+            bool                                gzipTried;  // 已经尝试过生成gzip版本(gzip为空表示没有)
+            bool                                gzipFile;   // gzip版本来自.gz文件, 检查entry时也要检查它
+            bool                                referenced; // 上一次CLOCK扫描之后被访问过
+            uint64_t                            checkedAt;  // 上一次确认文件没有变化的时间(毫秒)
+            std::list<std::string>::iterator    ring;
+        };
+
+        /**
+         * @brief 按路径的哈希分片, 每个分片一把锁; 不同线程访问不同的文件时互不影响
+         */
+        struct Shard
+        {
+            WebServer::Mutex                        mtx;
+            std::unordered_map<std::string, Node>   nodes;
+            std::list<std::string>                  ring;   // CLOCK的环, 新条目放在头部, 从尾部开始扫描
+            char                                    pad[64];    // 和下一个分片的锁隔开
+        };
+
+        static const size_t SHARD_COUNT = 16;
+
+        Shard& _shard(const std::string& path);
+        /**
+         * @param gzip path是.gz文件, 作为mime类型文件的gzip版本
+         */
+        Entry::ptr _load(const std::string& path, const std::string& mime, bool gzip);
+        /**
+         * @brief 根据已经填好的文件信息生成etag, 头部字段和完整响应
+         */
+        void _finish(Entry& entry, const std::string& responseHeaders);
+        void _preload(const std::string& dir, size_t& count, int depth);
+        /**
+         * @brief 插入或者替换path的条目, 满了时先淘汰; 调用时不能持有任何分片的锁
+         */
+        void _insert(Shard& shard, const std::string& path, const Entry::ptr& entry, uint64_t now);
+        /**
+         * @brief 从m_hand指向的分片开始淘汰一个条目, 调用时不能持有任何分片的锁
+         * @return 缓存为空时返回false
+         */
+        bool _evict();
+        /**
+         * @brief 扫描一遍shard的环: 被访问过的清除标记放回头部(second chance), 淘汰第一个没有被访问过的; 需要持有shard.mtx
+         * @return 所有条目都被访问过(或者没有条目)时返回false
+         */
+        bool _evictFrom(Shard& shard);
+
+    private:
+        WebServer::Mutex                        m_mtx;      // 保护m_memThreshold和m_responseHeaders, 只在加载文件时使用
+        std::atomic<size_t>                     m_maxEntries;
+        std::atomic<uint64_t>                   m_ttl;
+        size_t                                  m_memThreshold;
+        std::string                             m_responseHeaders;
+        std::atomic<size_t>                     m_count;    // 所有分片的条目总数
+        std::atomic<size_t>                     m_hand;     // CLOCK的指针: 下一次从哪个分片开始淘汰
+        Shard                                   m_shards[SHARD_COUNT];
+    };
+}
+
+#endif //WEBSERVER_FILE_CACHE_H
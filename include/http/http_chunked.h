@@ -0,0 +1,56 @@
+/**
+ * @author  2mu
+ * @date    2024/4/29
+ * @brief   chunked传输编码(RFC 7230 4.1)
+ * HttpChunkedDecoder: 增量, 原地解码请求body; 每次只处理已经收到的数据, 解码出来的数据可以马上交给上层然后丢弃,
+ * 大的上传不需要整个保存在接收缓冲区中(参考picohttpparser的phr_decode_chunked)
+ * 响应都只发送长度已知的普通文件(Content-Length), 不需要chunked编码
+ */
+
+#ifndef WEBSERVER_HTTP_CHUNKED_H
+#define WEBSERVER_HTTP_CHUNKED_H
+
+#include <cstddef>
+
+namespace WebServer
+{
+    class HttpChunkedDecoder
+    {
+    public:
+        enum Status
+        {
+            AGAIN,      // 输入的数据已经全部处理, 还需要更多数据
+            ERROR,      // 格式错误
+            SUCCESS     // 最后一个chunk和trailer都已经收到
+        };
+
+        HttpChunkedDecoder() { reset(); }
+
+        void reset();
+
+        /**
+         * @brief 原地解码buf中的数据, 解码得到的body数据移动到buf的开头
+         * @param buf 还没有解码的数据(上一次调用已经处理过的数据不要再传入)
+         * @param [in,out] size 输入为buf中的数据长度, 输出为解码得到的body数据长度
+         * @param [out] left 返回SUCCESS时, chunked编码之后还剩下的字节数(属于下一个请求), 紧跟在body数据之后
+         */
+        Status decode(char* buf, size_t* size, size_t* left);
+
+    private:
+        enum State
+        {
+            CHUNK_SIZE,             // chunk-size(十六进制)
+            CHUNK_EXT,              // chunk-ext, 忽略, 直到行尾
+            CHUNK_DATA,             // chunk-data
+            CHUNK_CRLF,             // chunk-data之后的CRLF
+            TRAILER_LINE_HEAD,      // trailer行的开头, 空行表示结束
+            TRAILER_LINE_MIDDLE     // trailer行, 忽略, 直到行尾
+        };
+
+        State   m_state;
+        size_t  m_bytesLeft;    // 当前chunk还没有收到的字节数; CHUNK_SIZE状态下为已经解析的chunk-size
+        int     m_hexCount;     // chunk-size已经解析的十六进制位数
+    };
+}
+
+#endif //WEBSERVER_HTTP_CHUNKED_H
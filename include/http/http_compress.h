@@ -0,0 +1,45 @@
+/**
+ * @author  2mu
+ * @date    2024/5/6
+ * @brief   响应body的gzip压缩(Content-Encoding: gzip)
+ * 1. 依赖zlib; 编译时没有找到zlib(没有定义WEBSERVER_HAVE_ZLIB)时gzipCompress()总是失败,
+ *    这时只能发送事先压缩好的.gz文件
+ * 2. 只压缩文本类的MIME类型, 图片, 音视频等本身已经压缩过, 再压缩只是浪费CPU
+ * 3. 不提供deflate: 客户端对"deflate"是zlib格式还是裸deflate流的理解不一致, 而接受deflate的客户端都接受gzip
+ */
+
+#ifndef WEBSERVER_HTTP_COMPRESS_H
+#define WEBSERVER_HTTP_COMPRESS_H
+
+#include <cstddef>
+#include <string>
+
+namespace WebServer
+{
+    namespace http_compress
+    {
+        /**
+         * @brief 编译时是否有zlib
+         */
+        bool available();
+
+        /**
+         * @brief 该MIME类型是否值得压缩
+         */
+        bool isCompressible(const std::string& mime);
+
+        /**
+         * @brief 把[data, data + len)压缩成gzip格式, 结果写到out(覆盖)
+         * @param level zlib压缩级别(1~9)
+         * @return 成功返回true
+         */
+        bool gzipCompress(const char* data, size_t len, std::string& out, int level = 6);
+
+        /**
+         * @brief Accept-Encoding的值中是否接受gzip(包括"*"), q=0表示不接受
+         */
+        bool acceptsGzip(const char* value, size_t len);
+    }
+}
+
+#endif //WEBSERVER_HTTP_COMPRESS_H
@@ -0,0 +1,66 @@
+/**
+ * @author  2mu
+ * @date    2024/5/8
+ * @brief   条件请求和范围请求用到的解析函数(RFC 7232, RFC 7233)
+ * 1. HTTP-date(IMF-fixdate)的生成和解析, 用于Last-Modified/If-Modified-Since/If-Range
+ * 2. If-None-Match中的实体标签列表匹配(弱比较)
+ * 3. Range: bytes=...解析, 支持多个范围, 以及"a-", "-n"两种省略形式
+ */
+
+#ifndef WEBSERVER_HTTP_CONDITIONAL_H
+#define WEBSERVER_HTTP_CONDITIONAL_H
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace WebServer
+{
+    namespace http_conditional
+    {
+        // 一个请求最多支持的范围数, 超过则忽略Range, 防止用大量很小的范围放大响应
+        static const size_t MAX_RANGES = 16;
+
+        struct ByteRange
+        {
+            off_t   offset;
+            off_t   length;
+        };
+
+        enum RangeResult
+        {
+            RANGE_NONE,             // 格式不正确或者范围太多, 忽略Range, 发送整个文件
+            RANGE_OK,
+            RANGE_UNSATISFIABLE     // 所有范围都超出了文件大小, 回复416
+        };
+
+        /**
+         * @brief 生成"Sun, 06 Nov 1994 08:49:37 GMT"格式的时间
+         */
+        std::string formatDate(time_t t);
+
+        /**
+         * @brief 解析HTTP-date(只支持IMF-fixdate), 失败返回-1
+         */
+        time_t parseDate(const char* value, size_t len);
+
+        /**
+         * @brief If-None-Match的值中是否有和etag匹配的(弱比较, 忽略"W/"), "*"匹配任意etag
+         */
+        bool etagMatches(const char* value, size_t len, const std::string& etag);
+
+        /**
+         * @brief 解析Range的值
+         * @param size 文件大小
+         * @param [out] ranges 返回RANGE_OK时, 已经限制在文件大小之内的范围; 调用者提供, 至少能放下MAX_RANGES个
+         * @param [out] count ranges中的范围数
+         */
+        RangeResult parseRange(const char* value, size_t len, off_t size, ByteRange* ranges, size_t& count);
+        RangeResult parseRange(const char* value, size_t len, off_t size, std::vector<ByteRange>& ranges);
+    }
+}
+
+#endif //WEBSERVER_HTTP_CONDITIONAL_H
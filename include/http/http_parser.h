@@ -0,0 +1,119 @@
+/**
+ * @author  2mu
+ * @date    2024/4/25
+ * @brief   零拷贝, 可重入(增量)的HTTP/1.1请求解析器
+ * 1. 解析结果只记录在接收缓冲区中的偏移和长度(HttpSpan), 不拷贝数据, 也不分配内存
+ * 2. 数据不完整时返回AGAIN, 收到更多数据之后再次调用parse(), 从上次停下的位置继续, 已经解析过的行不会再扫描
+ * 3. 只解析请求行和头部字段, body由调用者根据Content-Length等头部字段处理
+ */
+
+#ifndef WEBSERVER_HTTP_PARSER_H
+#define WEBSERVER_HTTP_PARSER_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace WebServer
+{
+    /**
+     * @brief 接收缓冲区中的一段数据; 使用偏移而不是指针, 缓冲区扩容(地址变化)之后依然有效
+     */
+    struct HttpSpan
+    {
+        uint32_t off;
+        uint32_t len;
+
+        const char* data(const char* buf) const { return buf + off; }
+        bool empty() const { return len == 0; }
+    };
+
+    struct HttpHeader
+    {
+        HttpSpan name;
+        HttpSpan value;     // 去掉了首尾的空白
+    };
+
+    class HttpRequestParser
+    {
+    public:
+        // 最多支持的头部字段数量, 超过则解析失败
+        static const int MAX_HEADERS = 64;
+        // 请求行+头部字段的最大长度, 超过则解析失败
+        static const size_t MAX_HEADER_SIZE = 64 * 1024;
+
+        enum Status
+        {
+            AGAIN,      // 数据不完整
+            ERROR,      // 格式错误
+            SUCCESS     // 请求行和头部字段全部解析完成
+        };
+
+        HttpRequestParser() { reset(); }
+
+        /**
+         * @brief 准备解析下一个请求
+         * @param start 下一个请求在缓冲区中的起始偏移(流水线请求时不为0)
+         */
+        void reset(size_t start = 0);
+
+        /**
+         * @brief 调用者把缓冲区前面delta个字节删除了(delta不超过当前请求的起始偏移), 所有偏移相应前移
+         */
+        void rebase(size_t delta);
+
+        /**
+         * @brief 解析[buf, buf + len)中的请求; 每次调用buf都可以不同(缓冲区扩容), 但是已有的数据不能改变
+         * @param buf 接收缓冲区起始地址
+         * @param len 缓冲区中有效数据的长度(包括已经解析过的部分)
+         */
+        Status parse(const char* buf, size_t len);
+
+        /**
+         * @brief 请求行+头部字段(含空行)结束的位置, 也就是body的起始偏移; 只在返回SUCCESS之后有效
+         */
+        size_t headerEnd() const { return m_pos; }
+
+        const HttpSpan& method() const { return m_method; }
+        const HttpSpan& target() const { return m_target; }
+        int versionMajor() const { return m_major; }
+        int versionMinor() const { return m_minor; }
+
+        int headerCount() const { return m_headerCount; }
+        const HttpHeader& header(int i) const { return m_headers[i]; }
+
+        /**
+         * @brief 查找头部字段(名字不区分大小写), 没有则返回nullptr
+         */
+        const HttpHeader* findHeader(const char* buf, const char* name) const;
+
+        /**
+         * @brief span是否等于str(不区分大小写)
+         */
+        static bool equalsIgnoreCase(const char* buf, const HttpSpan& span, const char* str);
+
+    private:
+        Status _parseRequestLine(const char* buf, size_t begin, size_t end);
+        Status _parseHeaderLine(const char* buf, size_t begin, size_t end);
+
+    private:
+        enum State
+        {
+            REQUEST_LINE,
+            HEADER_LINE,
+            DONE
+        };
+
+        State       m_state;
+        size_t      m_start;        // 当前请求的起始偏移
+        size_t      m_pos;          // 当前行的起始偏移(下一次从这里开始解析)
+        size_t      m_scan;         // 当前行中已经确认没有'\n'的位置, 下一次从这里继续查找行尾
+        HttpSpan    m_method;
+        HttpSpan    m_target;
+        int         m_major;
+        int         m_minor;
+        int         m_headerCount;
+        HttpHeader  m_headers[MAX_HEADERS];
+    };
+}
+
+#endif //WEBSERVER_HTTP_PARSER_H
@@ -0,0 +1,125 @@
+/**
+ * @author  2mu
+ * @date    2024/5/2
+ * @brief   响应构建和发送
+ * 1. 头部字段直接追加到预先分配的缓冲区中(均摊O(1)), 不使用sprintf
+ * 2. 缓冲区中的数据, 不拷贝的外部数据(appendRef), 文件(appendFile)按顺序组成若干段;
+ *    flush()用一次sendmsg(相当于writev)发送所有内存中的段, 文件之前的数据带上MSG_MORE, 和之后sendfile的文件内容合并成尽量少的TCP报文
+ * 3. 流水线请求的多个响应可以先全部追加, 最后一次flush()
+ * 4. 缓冲区可以来自BufferPool: 全部发送完成之后马上还给池, 等待下一个请求的长连接不占用发送缓冲区
+ */
+
+#ifndef WEBSERVER_HTTP_RESPONSE_H
+#define WEBSERVER_HTTP_RESPONSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "util/buffer_pool.h"
+
+namespace WebServer
+{
+    class HttpResponseBuilder
+    {
+    public:
+        enum Status
+        {
+            SUCCESS,    // 全部发送完成
+            AGAIN,      // socket发送缓冲区满了, 剩下的数据还保留着, 可写之后再次flush()
+            ERROR
+        };
+
+        /**
+         * @param pool 拷贝进来的数据所用的缓冲区从这里取, 为nullptr时使用堆内存
+         */
+        explicit HttpResponseBuilder(BufferPool* pool = nullptr);
+        ~HttpResponseBuilder();
+
+        /**
+         * @brief 修改使用的内存池, 只能在没有数据时调用
+         */
+        void setPool(BufferPool* pool) { m_buf.setPool(pool); }
+
+        /**
+         * @brief 状态行, 例如"HTTP/1.1 200 OK\r\n"
+         */
+        void appendStatus(int code, const char* reason = nullptr);
+        void appendHeader(const char* name, const char* value);
+        void appendHeader(const char* name, const char* value, size_t len);
+        void appendHeader(const char* name, uint64_t value);
+        /**
+         * @brief 空行, 头部结束
+         */
+        void appendEnd();
+
+        /**
+         * @brief 拷贝数据到缓冲区
+         */
+        void append(const char* data, size_t len);
+        void append(const std::string& data) { append(data.data(), data.size()); }
+
+        /**
+         * @brief 不拷贝数据, flush()完成之前data必须一直有效
+         */
+        void appendRef(const char* data, size_t len);
+
+        /**
+         * @brief 文件的[offset, offset + len)部分, 用sendfile发送
+         * 不管理fd的生命周期, 发送完成之前fd必须一直有效(通常用hold()持有它的所有者)
+         */
+        void appendFile(int fd, off_t offset, size_t len);
+
+        /**
+         * @brief 持有一个引用直到数据发送完成(或者clear()), 用于保证appendRef/appendFile用到的缓存内容和fd一直有效
+         */
+        void hold(const std::shared_ptr<const void>& owner) { m_holds.push_back(owner); }
+
+        /**
+         * @brief 发送所有数据; socket是非阻塞的, 返回AGAIN时已经发送的部分已经移除
+         */
+        Status flush(int sockfd);
+
+        /**
+         * @brief 丢弃还没有发送的数据, 缓冲区还给内存池
+         */
+        void clear();
+
+        bool empty() const { return m_head == m_segments.size(); }
+
+        /**
+         * @brief 还没有发送的字节数
+         */
+        size_t size() const { return m_size; }
+
+        /**
+         * @brief 状态码对应的原因短语
+         */
+        static const char* reasonPhrase(int code);
+
+    private:
+        struct Segment
+        {
+            const char* ref;    // 外部数据; 为nullptr时数据在m_buf[off, off + len)中
+            int         fd;     // 文件段的fd, 不是文件段为-1
+            off_t       off;
+            size_t      len;
+        };
+
+        void _appendMem(const char* data, size_t len);
+        void _consume(size_t n);
+
+    private:
+        PooledBuffer            m_buf;          // 拷贝进来的数据(状态行, 头部字段, 小的body)
+        std::vector<Segment>    m_segments;
+        size_t                  m_head;         // 第一个还没有发送完的段
+        size_t                  m_size;
+        std::vector<std::shared_ptr<const void> >   m_holds;
+    };
+}
+
+#endif //WEBSERVER_HTTP_RESPONSE_H
@@ -0,0 +1,53 @@
+/**
+ * @author  2mu
+ * @date    2024/4/27
+ * @brief   HTTP解析用到的字符扫描函数, x86下使用SSE4.2/AVX2加速(参考picohttpparser的findchar_fast)
+ * 运行时检测CPU支持的指令集, 选择最快的实现; 不支持时(或者非x86平台)使用逐字节扫描
+ */
+
+#ifndef WEBSERVER_HTTP_SCAN_H
+#define WEBSERVER_HTTP_SCAN_H
+
+namespace WebServer
+{
+    namespace http_scan
+    {
+        enum Level
+        {
+            SCALAR,     // 逐字节
+            SSE42,      // SSE2找'\n', SSE4.2(pcmpestri)找字符范围
+            AVX2        // AVX2找'\n', 字符范围同SSE42
+        };
+
+        /**
+         * @brief 当前使用的实现
+         */
+        Level level();
+
+        /**
+         * @brief 指定使用的实现(测试用), CPU不支持时退回到支持的最高级别
+         * @return 实际使用的实现
+         */
+        Level setLevel(Level level);
+
+        /**
+         * @brief 在[p, end)中查找'\n'
+         * @return '\n'的位置, 没有找到返回end
+         */
+        const char* findNewline(const char* p, const char* end);
+
+        /**
+         * @brief 跳过RFC 7230的token字符(方法名, 头部字段名)
+         * @return 第一个不是token字符的位置, 全部都是返回end
+         */
+        const char* skipToken(const char* p, const char* end);
+
+        /**
+         * @brief 跳过request-target允许的字符(除空白, 控制字符和DEL以外的字符)
+         * @return 第一个不允许的字符的位置, 全部都是返回end
+         */
+        const char* skipTarget(const char* p, const char* end);
+    }
+}
+
+#endif //WEBSERVER_HTTP_SCAN_H
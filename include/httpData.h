@@ -8,17 +8,22 @@
 #ifndef WEBSERVER_HTTPDATA_H
 #define WEBSERVER_HTTPDATA_H
 #include <string>
-#include <unordered_map>
+
+#include "http/http_parser.h"
+#include "http/http_chunked.h"
+#include "http/http_response.h"
+#include "http/file_cache.h"
+#include "http/http_conditional.h"
+#include "util/buffer_pool.h"
+#include "util/arena.h"
+#include "timer/thr_timer.h"
 using std::string;
-using std::unordered_map;
 
 // 解析http request报文的状态
 enum class ParseRequest{
-    PARSESTARTLINE,// 首行(请求行)
-    PARSEHEADERS,  // 头部字段
+    PARSEHEADERS,  // 请求行和头部字段(由HttpRequestParser一起解析)
     PARSEBODY,     // 主体数据
     SENDRESPONE,   // 发送响应
-    KEEPALIVE,     // 长连接
     FINISH,        // 完成
     ERROR
 };
@@ -33,6 +38,7 @@ enum class ParseResult{
 enum class SendResult{
     SUCCESS,
     NOTFOUND,
+    FORBIDDEN,
     NOTIMPL,
     ERROR
 };
@@ -52,14 +58,22 @@ enum class httpMethod{
     ERROR,
 };
 
-class Timer;// 前向声明(不要再带上#include "Timer.h", 反而会错)
+namespace WebServer
+{
+    class EventLoop;
+}
 
 class httpData
 {
 private:
-    int againTime;          // 重复尝试readn的次数
     int clientFd;           // 客户端fd
-    string content;         // readn()读到的内容(也就是请求报文的所有内容)
+    // 接收缓冲区, readn()直接读到这里(也就是请求报文的所有内容), 可能包含多个流水线请求;
+    // 从事件循环的内存池中取, 请求全部处理完之后马上还回去
+    WebServer::PooledBuffer content;
+    WebServer::HttpResponseBuilder output;  // 还没有发送的响应, 同一轮处理的所有请求的响应一次写出
+    // 处理当前请求时的临时数据(Content-Range的值, multipart的分隔头部, 错误页面等), 请求处理完之后一次释放;
+    // 这里的数据要用output.append()拷贝, 不能appendRef()
+    WebServer::Arena arena;
     httpMethod method;      // 此次请求的方法
     // http版本
     int h_major;              // 主版本号
@@ -68,28 +82,82 @@ private:
     bool isKeepAlive;         // 长连接
     string url;             // 请求url
     string resPath;         // 资源文件夹(长连接用得到)
-    unordered_map<std::string, std::string> headerMap;// 所有头部字段
+    size_t reqStart;        // 当前请求在content中的起始偏移
+    WebServer::HttpRequestParser parser;    // 请求行和头部字段, 只保存在content中的偏移
+    bool isChunked;         // 请求body使用chunked编码
+    size_t bodyLength;      // Content-Length
+    size_t bodyReceived;    // 已经收到的body长度(chunked编码时为解码之后的长度)
+    WebServer::HttpChunkedDecoder chunkedDecoder;
+    uint64_t bytesSent;     // 这个连接已经发送的字节数
 
-    // 解析请求行（第一行）
-    ParseResult parse_StartLine();
-    // 解析头部字段，并保存到headers
+    // 解析请求行和头部字段, 并确定body的长度; 数据不完整时下一次从上次停下的位置继续
     ParseResult parse_Headers();
-    // 解析主体内容
+    // 解析主体内容, 收到一部分就处理一部分, 不会把整个body保存在content中
     ParseResult parse_Body();
+    // 收到一段body数据
+    void onBody(const char* data, size_t len);
+    // 追加Connection相关的头部字段
+    void appendConnection();
+    // 发送缓存中的普通文件: 选择gzip版本, 处理条件请求(304)和范围请求(206/416)
+    SendResult sendFile(WebServer::StaticFileCache::Entry::ptr file);
+    // If-Range是否和文件匹配(不匹配时忽略Range, 发送整个文件)
+    bool ifRangeMatches(const WebServer::StaticFileCache::Entry& file);
+    // 206响应, 多个范围时是multipart/byteranges
+    void sendRanges(const WebServer::StaticFileCache::Entry& file,
+                    const WebServer::http_conditional::ByteRange* ranges, size_t count);
+    // 追加文件的[offset, offset + len)部分, 内存中的文件直接引用, 否则sendfile
+    void appendFileBody(const WebServer::StaticFileCache::Entry& file, off_t offset, off_t len);
     // 处理请求, 简单实现了GET和POST
     SendResult sendResponse();
     // 发送响应失败的处理方式
-    void handleError(int statusCode, std::string short_msg);
+    void handleError(int statusCode, const char* short_msg);
+    // 处理content中所有完整的请求
+    void processRequests();
+    // 当前请求处理完成(长连接), 准备解析content中的下一个请求
+    void nextRequest();
+    // 把output中的响应(包括文件内容)写出去, 失败返回false
+    // socket发送缓冲区满时直接返回true, 剩下的数据留在output中, 等EPOLLOUT之后由handleWrite()继续发送
+    bool flush();
 
 public:
-    Timer* timer;
+    // 空闲超时定时器, 由所属的事件循环设置; 回调在事件循环线程中执行
+    struct IdleTimer
+    {
+        thr_timer_t             timer;
+        WebServer::EventLoop*   loop;
+        httpData*               conn;
+    } idleTimer;
 
     httpData();
-    httpData(int cfd, string resPath);
+    // pool: 接收和发送缓冲区从这里取, 为nullptr时使用堆内存
+    httpData(int cfd, string resPath, WebServer::BufferPool* pool = nullptr);
     ~httpData();
     int getFd()const {return clientFd;}
-    ParseRequest handleRequest();// 解析http请求的 起点
+    // 对象池中的对象reset()之后用于新的连接
+    void setFd(int cfd) {clientFd = cfd;}
+    /**
+     * 解析http请求的 起点, 由事件循环在fd可读时调用
+     * 一次处理缓冲区中所有完整的请求(HTTP/1.1流水线), 响应按顺序合并成一次写
+     * 返回FINISH/ERROR: 连接需要关闭
+     * 返回其它状态: 长连接, 或者请求还不完整, 等待下一次可读事件
+     */
+    ParseRequest handleRequest();
+    /**
+     * 有还没发送完的响应时, 由事件循环在fd可写时调用; 从上次停下的位置(包括文件的偏移)继续发送,
+     * 发送完之后继续处理缓冲区中的请求. 返回值的含义和handleRequest()相同
+     */
+    ParseRequest handleWrite();
+    // 是否有还没发送完的响应(需要等待EPOLLOUT, 暂时不处理新的请求)
+    bool wantWrite() const {return !output.empty();}
+    // 已经发送的字节数, 事件循环用来判断一次可写事件是否真的发送出了数据
+    uint64_t getBytesSent() const {return bytesSent;}
+    // 清空所有状态(包括没有处理的数据), 缓冲区还给内存池, 可以用于新的连接
     void reset();
+    // 长连接响应的Connection/Keep-Alive头部字段(含CRLF), 静态文件缓存预先拼接完整响应时也用这个
+    static const string& keepAliveHeaders();
+    // 长连接的空闲超时(毫秒), 0表示不关闭空闲连接; 必须在第一次调用keepAliveHeaders()之前设置
+    static void setKeepAliveTimeout(uint64_t ms);
+    static uint64_t keepAliveTimeout();
 };
 
 #endif
@@ -0,0 +1,161 @@
+/**
+ * @author  2mu
+ * @date    2024/4/20
+ * @brief   one loop per thread的事件循环(reactor), 基于epoll实现
+ * 主线程只负责accept新连接, 然后把连接fd交给某个EventLoop; 每个EventLoop运行在自己的线程中,
+ * 只处理属于自己的连接, 连接上的http请求解析和响应都在该线程中完成, 连接之间不需要加锁.
+ * 每个EventLoop有自己的连接对象池和收发缓冲区的内存池, 关闭的连接reset()之后留着给新连接用,
+ * 稳定运行时建立/关闭连接和处理请求都不需要malloc/free.
+ * 长连接的空闲超时: 每个EventLoop有自己的定时器分片(TimerManager的分片模式, 没有工作线程也不加锁),
+ * 连接每次处理完事件都重新设置定时器; 最早的定时器到期时分片的timerfd(CLOCK_MONOTONIC)可读, 和其它事件一起由epoll_wait返回,
+ * 在本线程执行到期的回调, 直接关闭连接; 修改系统时间不影响空闲超时.
+ */
+
+#ifndef WEBSERVER_EVENTLOOP_H
+#define WEBSERVER_EVENTLOOP_H
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "thread/thread.h"
+#include "thread/mutex.h"
+#include "util/buffer_pool.h"
+#include "timer/thr_timer.h"
+
+class httpData;
+
+namespace WebServer
+{
+    class EventLoop : boost::noncopyable
+    {
+    public:
+        /**
+         * @param resPath 静态资源目录, 即配置项server.htdocs
+         * @param idleTimeout 长连接的空闲超时(毫秒), 为0时连接不会超时
+         * @param timerSlack 空闲超时最多推迟多少毫秒, 让相近时间到期的连接一起关闭, 减少醒来的次数
+         */
+        explicit EventLoop(const std::string& resPath, uint64_t idleTimeout = 0, uint64_t timerSlack = 0);
+        ~EventLoop();
+
+        /**
+         * @brief 事件循环, 只能在所属线程中调用, 直到quit()被调用才返回
+         */
+        void loop();
+
+        /**
+         * @brief 通知事件循环退出, 任意线程都可以调用
+         */
+        void quit();
+
+        /**
+         * @brief 让该事件循环自己监听一个listening socket(SO_REUSEPORT模式), 只能调用一次, 并且必须在loop()之前调用
+         * @param listen_fd 非阻塞的listening socket, 成功之后其生命周期由该事件循环管理
+         * @return 成功返回0, 失败返回-1(listen_fd由调用者关闭)
+         */
+        int listen(int listen_fd);
+
+        /**
+         * @brief 关闭listen()设置的listening socket, 只能在loop()之前调用
+         */
+        void unlisten();
+
+        /**
+         * @brief 把一个已经accept的连接交给该事件循环, 任意线程都可以调用
+         * @param fd 客户端连接fd, 必须是非阻塞的; 之后fd的生命周期由该事件循环管理
+         */
+        void queueConnection(int fd);
+
+    private:
+        void _wakeup();
+        void _handleWakeup();
+        void _handleAccept();
+        void _addConnection(int fd);
+        /**
+         * @param events epoll返回的事件
+         */
+        void _handleConnection(httpData* conn, uint32_t events);
+        /**
+         * @brief 修改连接关注的事件(EPOLLIN和EPOLLOUT之间切换)
+         * @return 失败时连接已经关闭, 返回false
+         */
+        bool _updateConnection(httpData* conn, uint32_t events);
+        void _closeConnection(httpData* conn);
+        /**
+         * @brief 连接对象放回对象池(超过上限时直接释放)
+         */
+        void _releaseConnection(httpData* conn);
+        /**
+         * @brief 重新设置连接的空闲超时定时器(m_idleTimeout之后到期)
+         */
+        void _armIdleTimer(httpData* conn);
+        /**
+         * @brief 定时器回调, 在事件循环线程中执行: 关闭超时的连接
+         */
+        static void _onIdleTimeout(void* arg);
+    private:
+        int                                 m_epollFd;
+        int                                 m_wakeupFd;     // eventfd, 用于其它线程唤醒epoll_wait
+        int                                 m_listenFd;     // SO_REUSEPORT模式下该事件循环独占的listening socket, 否则为-1
+        bool volatile                       m_quit;
+        std::string                         m_resPath;
+
+        WebServer::Mutex                    m_mtx;          // 保护m_pendingFds
+        std::vector<int>                    m_pendingFds;   // 其它线程投递过来, 还没有注册到epoll的连接
+        TimerManager*                       m_timers;       // 该事件循环的定时器分片, 不超时时为nullptr
+        uint64_t                            m_idleTimeout;
+        BufferPool                          m_bufferPool;   // 连接的收发缓冲区, 必须在所有连接之后析构
+        std::vector<httpData*>              m_connections;  // 该事件循环拥有的所有连接(以fd为下标), 只在所属线程中访问
+        std::vector<httpData*>              m_freeConns;    // 已经关闭, 可以重新使用的连接对象
+    };
+
+
+    /**
+     * @brief 固定数量的EventLoop, 每个EventLoop一个线程
+     */
+    class EventLoopThreadPool : boost::noncopyable
+    {
+    public:
+        /**
+         * @param idle_timeout 长连接的空闲超时(毫秒), 为0时连接不会超时
+         * @param timer_slack 空闲超时最多推迟多少毫秒(定时器合并)
+         */
+        EventLoopThreadPool(int loop_count, const std::string& resPath, uint64_t idle_timeout = 0, uint64_t timer_slack = 0);
+        ~EventLoopThreadPool();
+
+        /**
+         * @brief 启动所有事件循环的线程, 只能调用一次; listenReusePort()要在这之前调用
+         */
+        void start();
+
+        /**
+         * @brief 轮询(round-robin)选择下一个EventLoop, 只在accept线程中调用
+         */
+        EventLoop* getNextLoop();
+
+        /**
+         * @brief SO_REUSEPORT模式: 给每个事件循环创建一个监听同一端口的listening socket,
+         * 由内核把新连接均衡到各个事件循环, 不再需要单独的accept线程; 必须在start()之前调用
+         * @return 成功返回0, 失败返回-1(errno指示错误原因), 这时已经创建的listening socket全部关闭
+         */
+        int listenReusePort(unsigned short port, int backlog);
+
+        /**
+         * @brief 退出所有事件循环, 并等待线程结束
+         */
+        void stop();
+
+        int getLoopCount() const
+        {
+            return (int)m_loops.size();
+        }
+
+    private:
+        size_t                          m_next;
+        std::vector<EventLoop*>         m_loops;
+        std::vector<Thread::ptr>        m_threads;
+    };
+}
+
+#endif //WEBSERVER_EVENTLOOP_H
@@ -27,6 +27,12 @@ struct list_head{
 #define list_entry(ptr, type, member) \
 	((type *)((char *)(ptr)-(unsigned long)(&((type *)0)->member)))
 
+// list.cpp是按C++编译的, 而poller.c是C代码, 需要统一成C链接
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
 /**
  * @brief 初始化双向链表
  * @param list 需要初始化的双向链表
@@ -77,4 +83,8 @@ void ListSplice(struct list_head* list, struct list_head* head);
  */
 void ListSpliceInit(struct list_head* list, struct list_head* head);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //POLLER_LIST_H
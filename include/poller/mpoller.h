@@ -0,0 +1,81 @@
+/**
+ * @author 2mu
+ * @date 2024/4/22
+ * @brief 多个poller组成的mpoller, 每个poller一个epoll fd、一个timerfd和一个线程
+ * 1. fd按照fd % nthreads分配给固定的poller, 同一个fd的add/del/mod/set_timeout总是落在同一个poller上
+ * 2. 每个poller只保存属于自己的那部分fd, 各自的nodes数组和锁互不共享, IO可以分散到多个核上
+ * 3. 定时器没有fd, 轮流分配给各个poller
+ */
+
+#ifndef WEBSERVER_MPOLLER_H
+#define WEBSERVER_MPOLLER_H
+
+#include <sys/types.h>
+#include "poller/poller.h"
+
+typedef struct __mpoller mpoller_t;
+
+struct __mpoller
+{
+    unsigned int nthreads;
+    unsigned int timer_index;   // 下一个定时器分配给哪个poller
+    poller_t *poller[1];        // 实际长度为nthreads
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * @brief 创建nthreads个poller, 失败返回NULL
+     */
+    mpoller_t *mpoller_create(const struct poller_params *params, size_t nthreads);
+
+    /**
+     * @brief 开启所有poller线程, 成功返回0; 失败返回-1, 已经开启的poller会被停止
+     */
+    int mpoller_start(mpoller_t *mpoller);
+
+    /**
+     * @brief 停止所有poller线程, 剩余的操作全部以PR_ST_STOPPED回调
+     */
+    void mpoller_stop(mpoller_t *mpoller);
+    void mpoller_destroy(mpoller_t *mpoller);
+
+    /**
+     * @brief 增加一个定时器, 以轮询的方式选择poller
+     */
+    int mpoller_add_timer(const struct timespec *value, void *context, mpoller_t *mpoller);
+#ifdef __cplusplus
+}
+#endif
+
+/**
+ * @brief fd所属的poller
+ */
+static inline poller_t *__mpoller_get(int fd, const mpoller_t *mpoller)
+{
+    return mpoller->poller[(unsigned int)fd % mpoller->nthreads];
+}
+
+static inline int mpoller_add(const struct poller_data *data, int timeout, mpoller_t *mpoller)
+{
+    return poller_add(data, timeout, __mpoller_get(data->fd, mpoller));
+}
+
+static inline int mpoller_del(int fd, mpoller_t *mpoller)
+{
+    return poller_del(fd, __mpoller_get(fd, mpoller));
+}
+
+static inline int mpoller_mod(const struct poller_data *data, int timeout, mpoller_t *mpoller)
+{
+    return poller_mod(data, timeout, __mpoller_get(data->fd, mpoller));
+}
+
+static inline int mpoller_set_timeout(int fd, int timeout, mpoller_t *mpoller)
+{
+    return poller_set_timeout(fd, timeout, __mpoller_get(fd, mpoller));
+}
+
+#endif //WEBSERVER_MPOLLER_H
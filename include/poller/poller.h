@@ -9,8 +9,22 @@
 #define WEBSERVER_POLLER_H
 
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 
+/**
+ * 使用方式:
+ * 1. poller_create创建poller, poller_start开启poller线程; 所有的IO事件都在poller线程中处理, 处理结果通过params.callback通知。
+ * 2. callback收到的poller_result*是poller内部malloc的, 由callback负责free; 读操作产生的message同理。
+ * 3. 除了PR_ST_SUCCESS之外, 其余状态的result都表示该fd已经从poller中移除(或者被poller_mod替换)。
+ */
 
+/**
+ * @brief 读操作时, 每收到一段数据就调用append追加到message中
+ * append的第二个参数: 传入可用数据长度, 若返回时消息已完整, 需要改为实际消费的长度(剩余数据会交给下一个message)
+ * append返回值: >0 消息已完整; 0 消息还不完整, 继续读; <0 出错
+ */
 struct poller_message_t
 {
     int (*append)(const void *, size_t *, struct poller_message_t *);
@@ -29,6 +43,15 @@ struct poller_data
     short operation;
     unsigned short iovcnt;
     int fd;
+    union
+    {
+        // PD_OP_LISTEN: 每accept一个连接调用一次, 返回值会放到result中交给callback; 返回NULL表示出错
+        void *(*accept)(const struct sockaddr *, socklen_t, int, void *);
+        // PD_OP_EVENT: fd是eventfd, 计数每+1调用一次
+        void *(*event)(void *);
+        // PD_OP_NOTIFY: fd是管道读端, 每读到一个指针调用一次
+        void *(*notify)(void *, void *);
+    };
     void* context;
     union
     {
@@ -66,13 +89,53 @@ typedef struct __poller poller_t;
 extern "C"
 {
 #endif
+    /**
+     * @brief 创建poller, 失败返回NULL
+     */
     poller_t *poller_create(const struct poller_params* params);
+
+    /**
+     * @brief 内部接口, 供mpoller使用: 创建只负责fd % nslices == 某个固定值的那部分fd的poller,
+     * 其nodes数组只有max_open_files / nslices大小
+     */
+    poller_t *__poller_create_slice(const struct poller_params* params, size_t nslices);
+
+    /**
+     * @brief 开启poller线程, 成功返回0, 失败返回-1
+     */
     int poller_start(poller_t* poller);
+
+    /**
+     * @brief 增加一个fd的IO操作
+     * @param timeout 超时时间(毫秒), 超时后以PR_ST_ERROR/ETIMEDOUT回调; -1表示不超时
+     * @return 成功返回0, 失败返回-1(fd已经存在时errno为EEXIST)
+     */
     int poller_add(const struct poller_data* data, int timeout, poller_t* poller);
+
+    /**
+     * @brief 移除fd, 原有的操作以PR_ST_DELETED回调; 调用者在收到回调之前不要close(fd)
+     */
     int poller_del(int fd, poller_t* poller);
+
+    /**
+     * @brief 替换fd上的操作, 原有的操作以PR_ST_MODIFIED回调
+     */
     int poller_mod(const struct poller_data* data, int timeout, poller_t* poller);
+
+    /**
+     * @brief 重新设置fd的超时时间(从当前时间开始计算), -1表示不超时
+     */
     int poller_set_timeout(int fd, int timeout, poller_t *poller);
+
+    /**
+     * @brief 增加一个定时器, 到期后以PR_ST_FINISHED回调, data.operation为PD_OP_TIMER
+     * @param value 相对时间
+     */
     int poller_add_timer(const struct timespec *value, void *context, poller_t *poller);
+
+    /**
+     * @brief 停止poller线程, 剩余的操作全部以PR_ST_STOPPED回调
+     */
     void poller_stop(poller_t *poller);
     void poller_destroy(poller_t *poller);
 #ifdef __cplusplus
@@ -2,21 +2,27 @@
  *@author 2mu
  *@date 2022/5/10
  *@brief 线程池重构,固定线程数的线程池
+ * 2024/5/15 改成work-stealing: 原来所有addTask和取任务都要经过同一把锁和同一个信号量, 线程多时竞争很严重
+ * 1. 每个工作线程一个Chase-Lev双端队列(ws_deque.h); 工作线程中调用addTask时直接放进自己的队列, 不需要加锁
+ * 2. 其它线程调用addTask时轮流放进各个工作线程的收件箱(无锁栈), 工作线程再把收件箱整个取出
+ * 3. 自己的队列和收件箱都空了时, 从随机挑选的其它工作线程的队列(或者收件箱)中偷任务
+ * 4. 没有任务时在自己的futex上睡眠, 有新任务时只唤醒一个睡眠的线程; 不再有共享的信号量
  */
 
 #ifndef WEB_SERVER_THREAD_POOL_H
 #define WEB_SERVER_THREAD_POOL_H
 
-#include <queue>
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <stdexcept>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
 #include "thread/thread.h"
-#include "thread/semaphore.h"
-#include "thread/mutex.h"
+#include "thread/ws_deque.h"
 
 class ThreadPool : boost::noncopyable
 {
@@ -32,17 +38,10 @@ public:
             std::bind(std::forward<Func>(func), std::forward<Args>(args)...)
         );
 
-        {
-            WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
-            if(m_isStop)
-                throw std::logic_error("thread pool stopping! push task failed!");
-            /**
-             * @todo 这里为啥再封装一个std::function对象, 不如直接把 taskPtr 保存到 队列中
-             * 存不了, std::packaged_task<decltype(func(args...) 是可变类型, 没办法保存到queue中...
-             */
-            m_taskQueue.emplace([taskPtr](){(*taskPtr)();});
-        }
-        m_semaphore.notify();
+        /**
+         * std::packaged_task<decltype(func(args...))是可变类型, 没办法保存到队列中, 再封装一层std::function
+         */
+        _submit(new Task([taskPtr](){(*taskPtr)();}));
         return taskPtr->get_future();
     }
 
@@ -52,13 +51,49 @@ public:
     }
 
 private:
-    bool                                    m_isStop;
+    struct Task
+    {
+        explicit Task(std::function<void()>&& f) : func(std::move(f)), next(nullptr) {}
+
+        std::function<void()>   func;
+        Task*                   next;   // 在收件箱中时使用
+    };
+
+    struct Worker
+    {
+        Worker() : inbox(nullptr), futex(1) {}
+
+        WebServer::WorkStealingDeque<Task*> deque;
+        std::atomic<Task*>      inbox;  // 其它线程提交的任务, 无锁栈
+        std::atomic<uint32_t>   futex;  // 0表示准备睡眠或者正在睡眠, 唤醒时改成1
+        char                    pad[64];    // 和下一个Worker的队列隔开
+    };
+
+    /**
+     * @brief 放进当前工作线程自己的队列, 或者某个工作线程的收件箱, 然后唤醒一个睡眠的线程
+     * 线程池析构时其它线程不能再提交(抛出std::logic_error), 工作线程中的任务还可以提交子任务, 析构会等它们执行完
+     */
+    void _submit(Task* task);
+    void _run(int index);
+    /**
+     * @brief 依次从自己的队列, 自己的收件箱, 其它工作线程取任务; 没有时返回nullptr
+     */
+    Task* _findTask(int index);
+    /**
+     * @brief 取出worker收件箱中的所有任务, 返回最早提交的那个, 其余放进self的队列
+     */
+    Task* _takeInbox(Worker& worker, Worker& self);
+    bool _hasWork() const;
+    void _park(Worker& self);
+    void _wakeOne();
+
+private:
+    std::atomic<bool>                       m_isStop;
     int                                     m_threadCount;  // 线程数目
-    std::queue<std::function<void()>>       m_taskQueue;    // 任务队列
+    Worker*                                 m_workers;
+    std::atomic<uint32_t>                   m_next;         // 其它线程提交任务时轮流选择收件箱
+    std::atomic<int>                        m_sleepers;     // 正在(或者准备)睡眠的工作线程数
     std::vector<WebServer::Thread::ptr>     m_vctThreads;
-
-    WebServer::Semaphore                    m_semaphore;
-    WebServer::Mutex                        m_mtx;          // 保证任务队列的线程安全
 };
 
 #endif //WEB_SERVER_THREAD_POOL_H
@@ -0,0 +1,163 @@
+/**
+ * @author  2mu
+ * @date    2024/5/15
+ * @brief   Chase-Lev work-stealing双端队列, 线程池每个工作线程一个
+ * 1. 所属线程在bottom一端push/pop(后进先出, 刚放进去的任务数据还在cache中), 其它线程在top一端steal(先进先出)
+ * 2. 只有队列里只剩一个元素时pop和steal才需要CAS竞争, 其余情况所属线程不需要原子读改写操作
+ * 3. 环形数组满了时翻倍; 旧数组可能还有steal正在读, 所以不马上释放, 等队列析构时再一起释放
+ * 参考: Lê, Pop, Cohen, Zappa Nardelli. Correct and Efficient Work-Stealing for Weak Memory Models. PPoPP 2013
+ */
+
+#ifndef WEBSERVER_WS_DEQUE_H
+#define WEBSERVER_WS_DEQUE_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace WebServer
+{
+    template<typename T>
+    class WorkStealingDeque : boost::noncopyable
+    {
+    public:
+        /**
+         * @param capacity 初始容量, 必须是2的幂
+         */
+        explicit WorkStealingDeque(int64_t capacity = 256)
+            : m_top(0), m_bottom(0), m_array(new Array(capacity))
+        {
+        }
+
+        ~WorkStealingDeque()
+        {
+            delete m_array.load(std::memory_order_relaxed);
+            for(Array* array : m_retired)
+                delete array;
+        }
+
+        /**
+         * @brief 放到bottom一端, 只能在所属线程中调用
+         */
+        void push(T item)
+        {
+            int64_t b = m_bottom.load(std::memory_order_relaxed);
+            int64_t t = m_top.load(std::memory_order_acquire);
+            Array* array = m_array.load(std::memory_order_relaxed);
+            if(b - t > array->capacity - 1)
+                array = _grow(array, t, b);
+            array->put(b, item);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief 从bottom一端取出, 只能在所属线程中调用
+         * @return 队列为空(或者最后一个元素被偷走了)时返回false
+         */
+        bool pop(T& item)
+        {
+            int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+            Array* array = m_array.load(std::memory_order_relaxed);
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = m_top.load(std::memory_order_relaxed);
+            if(t > b)
+            {
+                // 空的
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
+            item = array->get(b);
+            if(t == b)
+            {
+                // 最后一个元素, 和steal竞争
+                bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+
+        /**
+         * @brief 从top一端偷一个, 任意线程都可以调用
+         * @return 队列为空或者和其它线程竞争失败时返回false
+         */
+        bool steal(T& item)
+        {
+            int64_t t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = m_bottom.load(std::memory_order_acquire);
+            if(t >= b)
+                return false;
+            Array* array = m_array.load(std::memory_order_acquire);
+            item = array->get(t);
+            return m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief 大概的元素个数, 其它线程调用时只能作为参考
+         */
+        int64_t size() const
+        {
+            int64_t b = m_bottom.load(std::memory_order_relaxed);
+            int64_t t = m_top.load(std::memory_order_relaxed);
+            return b > t ? b - t : 0;
+        }
+
+        bool empty() const
+        {
+            return size() == 0;
+        }
+
+    private:
+        struct Array
+        {
+            int64_t             capacity;
+            int64_t             mask;
+            std::atomic<T>*     items;
+
+            explicit Array(int64_t cap)
+                : capacity(cap), mask(cap - 1), items(new std::atomic<T>[cap])
+            {
+            }
+
+            ~Array()
+            {
+                delete[] items;
+            }
+
+            T get(int64_t i) const
+            {
+                return items[i & mask].load(std::memory_order_relaxed);
+            }
+
+            void put(int64_t i, T item)
+            {
+                items[i & mask].store(item, std::memory_order_relaxed);
+            }
+        };
+
+        Array* _grow(Array* array, int64_t t, int64_t b)
+        {
+            Array* bigger = new Array(array->capacity * 2);
+            for(int64_t i = t; i < b; ++i)
+                bigger->put(i, array->get(i));
+            m_retired.push_back(array);
+            m_array.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+    private:
+        // top和bottom分别被其它线程和所属线程频繁修改, 中间隔开一个cache line(C++11的new不保证alignas(64)的对齐)
+        std::atomic<int64_t>                m_top;
+        char                                m_pad[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t>                m_bottom;
+        std::atomic<Array*>                 m_array;
+        std::vector<Array*>                 m_retired;  // 扩容之前的数组, 只有所属线程修改
+    };
+}
+
+#endif //WEBSERVER_WS_DEQUE_H
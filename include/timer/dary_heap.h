@@ -0,0 +1,171 @@
+/**
+ * @author  2mu
+ * @date    2024/5/14
+ * @brief   d叉堆(默认4叉), queues.h中QUEUE的另一种实现, 时间堆使用
+ * 1. 键值和元素指针一起存放在堆数组中, 比较时不需要解引用元素; 比较函数Compare是模板参数, 编译器可以内联,
+ *    不像QUEUE每次比较都要通过函数指针调用
+ * 2. 4叉堆: 树的高度是二叉堆的一半; 数组按64字节对齐, 一个节点的4个孩子(键值8字节 + 指针8字节)正好在同一个cache line中,
+ *    下滤时每层只有一次cache miss
+ * 3. 和QUEUE一样, 把元素在堆中的下标保存在元素自己的Pos成员中, 可以O(1)找到任意元素并删除
+ * 4. 小根堆(Compare为std::less时); 下标从0开始
+ */
+
+#ifndef DARY_HEAP_H
+#define DARY_HEAP_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+#include <boost/noncopyable.hpp>
+
+template<typename T, typename Key, int T::*Pos, typename Compare = std::less<Key>, unsigned int D = 4>
+class DaryHeap : boost::noncopyable
+{
+public:
+    /**
+     * @param init_size 初始能存放的元素数量
+     * @param auto_extent 不够时每次扩大多少, 0表示不允许扩大
+     */
+    explicit DaryHeap(size_t init_size = 128, size_t auto_extent = 128)
+        : m_base(nullptr), m_nodes(nullptr), m_size(0), m_capacity(0), m_autoExtent(auto_extent)
+    {
+        _reserve(init_size ? init_size : 1);
+    }
+
+    ~DaryHeap()
+    {
+        free(m_base);
+    }
+
+    /**
+     * @brief 插入元素, 键值为key
+     * @return 空间不够并且无法扩大时返回false
+     */
+    bool insert(T* element, Key key)
+    {
+        if(m_size == m_capacity && (!m_autoExtent || !_reserve(m_capacity + m_autoExtent)))
+            return false;
+        Node node = {key, element};
+        _siftUp(m_size++, node);
+        return true;
+    }
+
+    /**
+     * @brief 删除下标为idx(即element->*Pos)的元素
+     * @return 被删除的元素
+     */
+    T* remove(size_t idx)
+    {
+        T* element = m_nodes[idx].element;
+        Node last = m_nodes[--m_size];
+        if(idx == m_size)
+            return element;
+        // 最后一个元素放到idx的位置, 可能需要上浮也可能需要下滤
+        if(idx > 0 && m_less(last.key, m_nodes[(idx - 1) / D].key))
+            _siftUp(idx, last);
+        else
+            _siftDown(idx, last);
+        return element;
+    }
+
+    T* removeTop()
+    {
+        return remove(0);
+    }
+
+    // 以下函数在堆为空时不能调用
+    T* top() const { return m_nodes[0].element; }
+    const Key& topKey() const { return m_nodes[0].key; }
+
+    T* element(size_t idx) const { return m_nodes[idx].element; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+private:
+    struct Node
+    {
+        Key key;
+        T*  element;
+    };
+
+    static const size_t CACHE_LINE = 64;
+
+    /**
+     * @brief 扩大到能存放capacity个元素
+     * 下标i的孩子是D*i+1 ~ D*i+D, 数组整体后移D-1个位置之后是D*(i+1) ~ D*(i+1)+D-1, 从D的整数倍开始,
+     * 所以数组按cache line对齐时一组孩子不会跨cache line(sizeof(Node) * D == 64时)
+     */
+    bool _reserve(size_t capacity)
+    {
+        void* base = nullptr;
+        if(posix_memalign(&base, CACHE_LINE, (capacity + D - 1) * sizeof(Node)))
+            return false;
+        Node* nodes = (Node*)base + D - 1;
+        if(m_size)
+            memcpy(nodes, m_nodes, m_size * sizeof(Node));
+        free(m_base);
+        m_base = (Node*)base;
+        m_nodes = nodes;
+        m_capacity = capacity;
+        return true;
+    }
+
+    void _place(size_t idx, const Node& node)
+    {
+        m_nodes[idx] = node;
+        node.element->*Pos = (int)idx;
+    }
+
+    /**
+     * @brief 把node放到idx的位置上浮(idx原来的内容不要了)
+     */
+    void _siftUp(size_t idx, const Node& node)
+    {
+        while(idx > 0)
+        {
+            size_t parent = (idx - 1) / D;
+            if(!m_less(node.key, m_nodes[parent].key))
+                break;
+            _place(idx, m_nodes[parent]);
+            idx = parent;
+        }
+        _place(idx, node);
+    }
+
+    /**
+     * @brief 把node放到idx的位置下滤(idx原来的内容不要了)
+     */
+    void _siftDown(size_t idx, const Node& node)
+    {
+        while(true)
+        {
+            size_t first = D * idx + 1;
+            if(first >= m_size)
+                break;
+            size_t last = first + D < m_size ? first + D : m_size;
+            size_t best = first;
+            for(size_t child = first + 1; child < last; ++child)
+            {
+                if(m_less(m_nodes[child].key, m_nodes[best].key))
+                    best = child;
+            }
+            if(!m_less(m_nodes[best].key, node.key))
+                break;
+            _place(idx, m_nodes[best]);
+            idx = best;
+        }
+        _place(idx, node);
+    }
+
+private:
+    Node*       m_base;         // posix_memalign分配的内存
+    Node*       m_nodes;        // m_base + D - 1, 堆的下标0
+    size_t      m_size;
+    size_t      m_capacity;
+    size_t      m_autoExtent;
+    Compare     m_less;
+};
+
+#endif // DARY_HEAP_H
@@ -3,6 +3,7 @@
   Implementation of queues from "Algorithms in C" by Robert Sedgewick.
 
   注释: 这个heap的实现非常有意思, 它给每个元素都加上了index, 也就是说这个heap的元素支持随机访问;
+  每次比较都要解引用元素并通过函数指针调用compare, 定时器多时cache miss很多; dary_heap.h是键值内联, 比较函数可以内联的4叉堆版本, 时间堆用的是它
 */
 
 #ifndef _QUEUES_H
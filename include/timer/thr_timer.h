@@ -3,6 +3,16 @@
  * @date    2023/6/23
  * @brief   时间堆实现定时器, 参照MySQL的thr_timer设计;
  * 微秒级别的定时器, 因为是pthread_cond_timedwait实现定时等待, 该函数第二个参数struct_timespec支持到纳秒
+ * 到期时间(expire_time)用的是CLOCK_MONOTONIC, 修改系统时间(NTP跳变等)不会让定时器提前或者推迟到期
+ * 时间堆是dary_heap.h的4叉堆(mysql用的是queues.h的二叉堆), 到期时间作为键值存放在堆数组中
+ * 构造时可以选择用分层时间轮(timer_wheel.h)代替时间堆: 添加/删除是O(1), 精度是1毫秒, 适合大量的连接超时定时器
+ * 两种运行方式:
+ * 1. 独立线程(默认): 工作线程等待最早的定时器到期并执行回调, 添加/删除/回调都在一把锁下, removeTimer返回后回调一定不会再执行
+ * 2. 分片(own_thread = false): 每个事件循环线程一个, 没有工作线程也不加锁; 所属线程用nextTimeoutMs()作为epoll_wait的超时,
+ *    再调用processTimers()执行到期的回调; 其它线程只能用cancelTimer()通过无锁队列取消, 由所属线程下一次processTimers()时真正删除;
+ *    也可以把timerFd()注册到epoll中, 它在最早的定时器到期时可读, 这时再调用processTimers(), epoll_wait就不需要超时了
+ * 定时器合并(setSlack): 到期时间向上取整到slack的整数倍, 时间堆中到期时间相同的定时器共用一个节点(桶), 大量连接同时设置
+ * 同样的超时时只是往桶的链表里加一个; 到期时先把所有到期的定时器取到到期链表中, 再逐个执行回调(批量到期)
  */
 
 #ifndef THR_TIMER_H
@@ -10,11 +20,13 @@
 
 #include <ctime>
 #include <cstdint>
+#include <atomic>
 #include <boost/noncopyable.hpp>
 
 #include <pthread.h>
 
-#include "queues.h"
+#include "dary_heap.h"
+#include "timer_wheel.h"
 
 #ifndef cmp_timespec
 /**
@@ -31,18 +43,38 @@
 struct thr_timer
 {
     bool expired;
-    int index_in_queue;     // 该定时器在时间堆中的idx
+    int index_in_queue;     // 该定时器(或者桶)在时间堆中的idx
     void (*func)(void*);
     void* func_args;
     struct timespec expire_time;
+    // 时间轮使用: 所在槽的链表, 以及所在的层
+    struct thr_timer* wheel_next;
+    struct thr_timer** wheel_pprev;
+    int wheel_level;
+    // 时间堆使用: 所在的桶(或者到期链表), 直接在堆中时为NULL; 桶本身的这个字段指向自己, 成员链表用wheel_next/wheel_pprev
+    struct thr_timer* bucket;
+    // 分片模式跨线程取消使用: 取消队列的链表, 以及是否已经在取消队列中(用__atomic访问)
+    struct thr_timer* cancel_next;
+    int cancel_pending;
 };
 
 typedef struct thr_timer thr_timer_t;
 
-class TimerManager
+class TimerManager : boost::noncopyable
 {
 public:
-    TimerManager(unsigned int init_size_for_timer_queue = 128);
+    enum Backend
+    {
+        HEAP,   // 时间堆, O(log n), 纳秒精度
+        WHEEL   // 分层时间轮, O(1), 1毫秒精度
+    };
+
+    /**
+     * @param init_size_for_timer_queue 时间堆的初始大小, 不够时每次再扩大这么多; 时间轮不使用
+     * @param backend 保存定时器的数据结构
+     * @param own_thread 是否创建工作线程; 为false时是分片模式, 由创建它的线程调用processTimers()
+     */
+    TimerManager(unsigned int init_size_for_timer_queue = 128, Backend backend = HEAP, bool own_thread = true);
     ~TimerManager();
 
     /**
@@ -57,20 +89,98 @@ public:
      */
     void removeTimer(thr_timer_t *timer_data);
 
+    /**
+     * @brief 设置定时器合并的时间窗口: 到期时间向上取整到micro_seconds的整数倍, 定时器最多晚这么久到期; 0表示不合并
+     */
+    void setSlack(unsigned long long micro_seconds);
+
+    /**
+     * @brief 在任意线程中取消定时器, 不加锁; 独立线程模式下就是removeTimer
+     * 分片模式下只是放进取消队列, 所属线程下一次processTimers()时删除, 在那之前定时器仍可能到期;
+     * 所以回调不能依赖它, 只能用来提前释放不再需要的定时器, 定时器的内存要保证到那时仍然有效
+     */
+    void cancelTimer(thr_timer_t *timer_data);
+
+    /**
+     * @brief 分片模式: 处理取消队列, 然后执行所有到期的定时器; 回调在不持有任何锁时执行, 可以添加/删除定时器
+     * @return 执行的回调个数
+     */
+    int processTimers();
+
+    /**
+     * @brief 分片模式: 距离最早的定时器到期还有多少毫秒(向上取整), 作为epoll_wait的超时; 没有定时器时返回-1
+     */
+    int nextTimeoutMs();
+
+    /**
+     * @brief 分片模式: 创建(第一次调用时)并返回一个CLOCK_MONOTONIC的timerfd, 最早的定时器到期时可读;
+     * 之后addTimer()和processTimers()会自动设置它的到期时间, processTimers()会读掉它的计数
+     * @return 失败时返回-1
+     */
+    int timerFd();
+
 private:
     bool _init();
-    
+    void _lock()   { if(m_ownThread) pthread_mutex_lock(&m_timerMtx); }
+    void _unlock() { if(m_ownThread) pthread_mutex_unlock(&m_timerMtx); }
+    /**
+     * @brief 分片模式: 删除取消队列中的定时器
+     */
+    void _drainCancels();
+    /**
+     * @brief 最早的定时器到期的时间(纳秒), 没有定时器时返回UINT64_MAX
+     */
+    uint64_t _nextExpireNsec();
+    /**
+     * @brief 让timerfd在expire_nsec时可读; 只在比已经设置的时间更早时调用, 定时器被删除时不用修改(提前醒来只是什么都不做)
+     */
+    void _armTimerFd(uint64_t expire_nsec);
+
+    /**
+     * @brief 时间堆: 放进堆中, 设置了slack时放进到期时间相同的桶里; 失败返回false
+     */
+    bool _heapInsert(thr_timer_t* timer_data);
+    /**
+     * @brief 时间堆: 从堆, 桶或者到期链表中移除
+     */
+    void _heapRemove(thr_timer_t* timer_data);
+    /**
+     * @brief 时间堆: 把到期时间<=now的定时器(包括桶中的)全部取到到期链表的尾部
+     */
+    void _heapHarvest(const struct timespec& now);
+    thr_timer_t* _newBucket();
+    void _freeBucket(thr_timer_t* bucket);
+
     void _processTimers(struct timespec* now);
+    /**
+     * @brief 时间轮: 执行所有到期的定时器, 返回下一次需要醒来的时间
+     */
+    struct timespec _processWheel(struct timespec* now);
     static void* _timerHandler(void*);
 
 
 private:
-    bool            m_inited;       // 是否已经初始化
+    bool            m_ownThread;    // 是否有工作线程, false时是分片模式
+    bool            m_inited;       // 工作线程是否在运行
     pthread_t       m_thread;
     pthread_mutex_t m_timerMtx;
     pthread_cond_t  m_timerCond;
     struct timespec m_nextTimerExpireTime;
-    QUEUE           m_timerQueue;
+    // 4叉堆, 键值是到期时间(纳秒), 和元素指针一起存放在堆数组中
+    typedef DaryHeap<thr_timer_t, uint64_t, &thr_timer::index_in_queue> TimerHeap;
+    TimerHeap       m_timerQueue;
+    TimerWheel*     m_wheel;        // 使用时间轮时不为nullptr, 此时不使用m_timerQueue
+    thr_timer_t     m_maxTimer;     // 时间堆中到期时间最大的哨兵
+    std::atomic<thr_timer_t*> m_cancelHead;  // 分片模式的取消队列(多生产者, 所属线程消费)
+    uint64_t        m_slack;        // 定时器合并的时间窗口(纳秒), 0表示不合并
+    // 最近使用的桶, 按到期时间/m_slack取模; 不同超时时间的定时器交替添加时也能找到各自的桶
+    static const unsigned BUCKET_CACHE_SIZE = 64;
+    thr_timer_t*    m_bucketCache[BUCKET_CACHE_SIZE];
+    thr_timer_t*    m_freeBuckets;  // 空闲的桶, 用wheel_next连接
+    thr_timer_t     m_dueList;      // 时间堆的到期链表(wheel_next是头), 其中的定时器还可以移除
+    thr_timer_t**   m_dueTail;
+    int             m_timerFd;      // 分片模式的timerfd, 没有创建时为-1
+    uint64_t        m_timerFdExpire;    // timerfd设置的到期时间, 没有设置或者已经到了时为UINT64_MAX
 };
 
 
@@ -0,0 +1,98 @@
+/**
+ * @author  2mu
+ * @date    2024/5/12
+ * @brief   分层时间轮, TimerManager的另一种实现
+ * 1. 第0层256个槽, 每个槽一个tick(默认1毫秒); 往上三层各64个槽, 每个槽是下一层转一圈的时间;
+ *    四层一共能表示2^26个tick(1毫秒的tick大约18.6小时), 更远的定时器先放在最高层, 转到时再重新放置
+ * 2. 每个槽是一个双向链表(定时器内嵌链表指针), 添加和删除都是O(1); 第0层转完一圈时, 把上一层对应槽中的定时器
+ *    重新放到下面的层中(cascade), 均摊下来每个定时器最多被移动层数次
+ * 3. 精度是一个tick: 定时器不会早于expire_time到期, 最多晚一个tick; 时间堆是精确到纳秒的
+ * 4. advance()把到期的定时器移到到期链表中, 再由popDue()逐个取出; 到期链表中的定时器仍然可以remove(),
+ *    所以一个定时器的回调中删除/重新添加同一批到期的其它定时器也是安全的
+ * 5. 不加锁, 由TimerManager加锁保护(或者只在所属线程中使用)
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/noncopyable.hpp>
+
+struct thr_timer;
+
+class TimerWheel : boost::noncopyable
+{
+public:
+    /**
+     * @param now_nsec 当前时间(纳秒), 时间轮从这里开始转动
+     * @param tick_nsec 一个tick的长度(纳秒)
+     */
+    TimerWheel(uint64_t now_nsec, uint64_t tick_nsec = 1000000);
+
+    /**
+     * @brief 按照timer->expire_time放到对应的槽中, 已经过期的放到下一个tick
+     */
+    void add(thr_timer* timer);
+
+    /**
+     * @brief 从时间轮(或者到期链表)中移除, timer必须在其中
+     */
+    void remove(thr_timer* timer);
+
+    /**
+     * @brief 转动到now_nsec, 把到期的定时器按到期先后移到到期链表的尾部
+     */
+    void advance(uint64_t now_nsec);
+
+    /**
+     * @brief 取出到期链表中的第一个定时器, 没有时返回nullptr
+     */
+    thr_timer* popDue();
+
+    /**
+     * @brief 下一次需要调用advance()的时间(纳秒): 第0层最早的定时器到期, 或者需要从上层取定时器;
+     * 到期链表不为空时返回0
+     * @return 时间轮为空时返回UINT64_MAX
+     */
+    uint64_t nextExpire() const;
+
+    size_t size() const { return m_count; }
+    uint64_t tickNsec() const { return m_tick; }
+
+    static const int LEVELS = 4;
+    static const int LEVEL0_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const uint64_t LEVEL0_SIZE = 1 << LEVEL0_BITS;
+    static const uint64_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const uint64_t LEVEL0_MASK = LEVEL0_SIZE - 1;
+    static const uint64_t LEVEL_MASK = LEVEL_SIZE - 1;
+    // 能直接表示的最大tick差
+    static const uint64_t MAX_TICKS = (uint64_t)1 << (LEVEL0_BITS + (LEVELS - 1) * LEVEL_BITS);
+    // 在到期链表中的定时器的wheel_level
+    static const int DUE_LEVEL = LEVELS;
+
+private:
+    uint64_t _tickOf(const thr_timer* timer) const;
+    /**
+     * @brief 放到level层的slot槽的链表头部
+     */
+    void _link(thr_timer* timer, int level, uint64_t slot);
+    /**
+     * @brief 第0层转完一圈, 把上面各层当前的槽中的定时器重新放置
+     */
+    void _cascade();
+
+private:
+    uint64_t    m_tick;         // tick的长度(纳秒)
+    uint64_t    m_current;      // 下一个要处理的tick
+    size_t      m_count;                    // 包括到期链表中的
+    size_t      m_levelCount[LEVELS + 1];   // 每一层的定时器数, 最后一个是到期链表
+    thr_timer*  m_level0[LEVEL0_SIZE];
+    thr_timer*  m_levels[LEVELS - 1][LEVEL_SIZE];
+    thr_timer*  m_due;                      // 到期链表
+    thr_timer** m_dueTail;
+};
+
+#endif //TIMER_WHEEL_H
@@ -0,0 +1,92 @@
+/**
+ * @author  2mu
+ * @date    2024/5/9
+ * @brief   按请求分配临时内存的arena(bump pointer)
+ * 1. 分配只是移动当前块中的指针, 不能单独释放; reset()一次归还所有内存, 一个请求处理完之后调用
+ * 2. 块从BufferPool中取(和连接的收发缓冲区共用事件循环的内存池), 超过块大小的分配单独用堆内存
+ * 3. 不加锁, 只在连接所属的线程中使用
+ */
+
+#ifndef WEBSERVER_ARENA_H
+#define WEBSERVER_ARENA_H
+
+#include <cstddef>
+
+#include <boost/noncopyable.hpp>
+
+#include "util/buffer_pool.h"
+
+namespace WebServer
+{
+    class Arena : boost::noncopyable
+    {
+    public:
+        /**
+         * @param pool 块从这里取(块大小是pool->blockSize()), 为nullptr时用堆内存, 每块blockSize字节
+         */
+        explicit Arena(BufferPool* pool = nullptr, size_t blockSize = 4096);
+        ~Arena();
+
+        /**
+         * @brief 修改使用的内存池, 只能在reset()之后调用
+         */
+        void setPool(BufferPool* pool);
+
+        /**
+         * @brief 分配n字节, 按align对齐(必须是2的幂); 申请内存失败时抛出std::bad_alloc
+         */
+        void* allocate(size_t n, size_t align = alignof(std::max_align_t));
+
+        /**
+         * @brief 分配n个T, 不调用构造函数
+         */
+        template<typename T>
+        T* allocArray(size_t n)
+        {
+            return (T*)allocate(n * sizeof(T), alignof(T));
+        }
+
+        /**
+         * @brief 拷贝[data, data + len), 结尾补'\0'
+         */
+        char* dup(const char* data, size_t len);
+
+        /**
+         * @brief 格式化到arena中, 结尾补'\0'
+         * @param len 输出格式化结果的长度
+         */
+        char* format(size_t& len, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+        /**
+         * @brief 释放所有分配的内存, 块还给内存池
+         */
+        void reset();
+
+        /**
+         * @brief 已经分配出去的字节数(不含对齐的填充)
+         */
+        size_t used() const { return m_used; }
+
+    private:
+        struct Block
+        {
+            Block*  next;
+            bool    pooled;     // 块来自m_pool
+        };
+
+        /**
+         * @brief 申请一个至少能放下n字节(按align对齐之后)的新块, 作为当前块
+         */
+        void _newBlock(size_t n, size_t align);
+
+    private:
+        BufferPool*     m_pool;
+        size_t          m_blockSize;
+        Block*          m_blocks;   // 所有块组成的链表, 头部是当前块
+        char*           m_ptr;      // 当前块中下一次分配的位置
+        char*           m_end;
+        size_t          m_used;
+    };
+}
+
+#endif //WEBSERVER_ARENA_H
@@ -0,0 +1,122 @@
+/**
+ * @author  2mu
+ * @date    2024/5/8
+ * @brief   固定大小缓冲区的内存池(slab)
+ * 1. BufferPool一次向系统申请一整块slab, 切成blocksPerSlab个blockSize大小的块, 空闲的块放在空闲链表中;
+ *    acquire()/release()只是出栈/入栈, 不会malloc/free. slab在内存池析构时才归还给系统
+ * 2. 不加锁, 每个事件循环一个, 只在所属线程中使用
+ * 3. PooledBuffer: 连续的字节缓冲区, 不超过blockSize时使用池中的块, 超过时(很大的头部, 积压的流水线请求)换成堆内存;
+ *    没有数据时可以release()把块还给池, 空闲的长连接不占用缓冲区; 申请内存失败时和std::string一样抛出std::bad_alloc
+ */
+
+#ifndef WEBSERVER_BUFFER_POOL_H
+#define WEBSERVER_BUFFER_POOL_H
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace WebServer
+{
+    class BufferPool : boost::noncopyable
+    {
+    public:
+        /**
+         * @param blockSize 每个块的大小
+         * @param blocksPerSlab 每次向系统申请的块数
+         */
+        explicit BufferPool(size_t blockSize = 8 * 1024, size_t blocksPerSlab = 32);
+        ~BufferPool();
+
+        /**
+         * @brief 取一个块, 空闲链表为空时再申请一个slab
+         * @return 申请内存失败时返回nullptr
+         */
+        char* acquire();
+
+        /**
+         * @brief 归还acquire()得到的块
+         */
+        void release(char* block);
+
+        size_t blockSize() const { return m_blockSize; }
+
+        /**
+         * @brief 申请过的块数, 以及其中空闲的块数
+         */
+        size_t totalBlocks() const { return m_slabs.size() * m_blocksPerSlab; }
+        size_t freeBlocks() const { return m_free.size(); }
+
+    private:
+        size_t                  m_blockSize;
+        size_t                  m_blocksPerSlab;
+        std::vector<char*>      m_slabs;
+        std::vector<char*>      m_free;
+    };
+
+
+    class PooledBuffer : boost::noncopyable
+    {
+    public:
+        /**
+         * @param pool 为nullptr时总是使用堆内存
+         */
+        explicit PooledBuffer(BufferPool* pool = nullptr);
+        ~PooledBuffer();
+
+        /**
+         * @brief 修改使用的内存池, 只能在没有占用内存时调用
+         */
+        void setPool(BufferPool* pool);
+        BufferPool* pool() const { return m_pool; }
+
+        char* data() { return m_data; }
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        size_t capacity() const { return m_capacity; }
+        bool empty() const { return m_size == 0; }
+        char& operator[](size_t i) { return m_data[i]; }
+
+        /**
+         * @brief 保证尾部至少还有n字节可写的空间
+         * @return 可写空间的起始位置, 写入之后用commit()提交
+         */
+        char* prepare(size_t n);
+        /**
+         * @brief 尾部可写的空间大小
+         */
+        size_t writable() const { return m_capacity - m_size; }
+        void commit(size_t n) { m_size += n; }
+
+        void append(const char* data, size_t len);
+        /**
+         * @brief 删除[pos, pos + n), 后面的数据前移
+         */
+        void erase(size_t pos, size_t n);
+        /**
+         * @brief 只能缩小
+         */
+        void truncate(size_t n) { if(n < m_size) m_size = n; }
+        /**
+         * @brief 清空数据, 保留内存
+         */
+        void clear() { m_size = 0; }
+        /**
+         * @brief 清空数据, 并归还内存(池中的块还给池, 堆内存释放)
+         */
+        void release();
+
+    private:
+        void _grow(size_t need);
+
+    private:
+        BufferPool*     m_pool;
+        char*           m_data;
+        size_t          m_size;
+        size_t          m_capacity;
+        bool            m_pooled;   // m_data是池中的块
+    };
+}
+
+#endif //WEBSERVER_BUFFER_POOL_H
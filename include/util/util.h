@@ -8,6 +8,7 @@
 #define WEB_SERVER_UTIL_H
 
 #include <string>
+#include <map>
 #include <cstdint>
 #include <cxxabi.h>
 #include <unistd.h>
@@ -17,9 +18,11 @@ namespace util
     /**
      * @brief 根据指定端口开启监听
      * @param port 指定端口
+     * @param backlog listen的backlog(全连接队列长度)
+     * @param reuse_port 是否开启SO_REUSEPORT; 开启后多个socket可以监听同一端口, 由内核把新连接均衡到各个socket
      * @return 成功返回listening_fd, 失败返回-1
      */
-    int socket_bind_listen(unsigned short port);
+    int socket_bind_listen(unsigned short port, int backlog = 511, bool reuse_port = false);
 
     /**
      * @brief 设置指定fd为非阻塞模式
@@ -39,11 +42,24 @@ namespace util
     int writen(int fd, const char *buf, size_t size);
 
     /**
-     * @brief 根据文件后最得到文件类型名
-     * @param suffix 文件后缀形式
+     * @brief 根据文件后缀得到文件类型名(MIME), 后缀不区分大小写
+     * 查表不加锁也不分配内存, 可以在多个线程中同时调用; 返回的字符串一直有效
+     * @param suffix 文件后缀形式, 例如".html"; 未知后缀(以及"default")返回text/plain
      * @return 文件类型
      */
-    std::string getMimeType(const std::string &suffix);
+    const char* getMimeType(const char* suffix, size_t len);
+    const char* getMimeType(const std::string &suffix);
+
+    /**
+     * @brief 根据文件路径的后缀(最后一个'/'之后的最后一个'.')得到文件类型名
+     */
+    const char* getMimeTypeByPath(const std::string& path);
+
+    /**
+     * @brief 扩展/覆盖后缀和类型的对应关系(例如来自配置server.mime_types), 之后的查找马上生效
+     * @param types 后缀 -> 类型, 后缀可以不带'.'
+     */
+    void addMimeTypes(const std::map<std::string, std::string>& types);
 
     /**
      * @brief 获得当前时间(系统时间, 毫秒级)
@@ -55,6 +71,11 @@ namespace util
      */
     std::uint64_t get_real_time_nsec();
 
+    /**
+     * @brief 获取单调时间(CLOCK_MONOTONIC, 纳秒级), 不受修改系统时间影响, 用于计算超时
+     */
+    std::uint64_t get_monotonic_time_nsec();
+
     /**
      * @brief 将类型名转化为字符串(typeinfo)
      * @tparam T
@@ -3,7 +3,6 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <fcntl.h> 
-#include <poll.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
@@ -16,10 +15,13 @@
 #include "util/singleton.h"
 #include "httpData.h"
 #include "timer/thr_timer.h"
+#include "net/eventloop.h"
+#include "http/file_cache.h"
 
 
 #define WEB_SERVER_VERSION "0.1"
 #define MAX_EVENTS 4096
+#define ACCEPT_WAIT_TIMEOUT 1000    // accept线程epoll_wait的超时时间(毫秒), 用于检查g_abort_loop
 
 
 bool volatile g_abort_loop;
@@ -44,6 +46,16 @@ int config_init(int argc, char* argv[])
     configManager.lookup<unsigned short>("server.port", 6666, "Port");
     configManager.lookup<int>("server.thread_count", 4, "thread count");
     configManager.lookup<std::string>("server.htdocs", "/home/test", "web file dir");
+    configManager.lookup<int>("server.backlog", 511, "listen backlog");
+    configManager.lookup<int>("server.reuse_port", 0, "one SO_REUSEPORT listening socket per event loop");
+    configManager.lookup<int>("server.keep_alive_timeout", 30000, "milliseconds before an idle connection is closed, 0 to disable");
+    configManager.lookup<int>("server.timer_slack", 100, "milliseconds idle timeouts may be delayed so that they expire together");
+    configManager.lookup<int>("server.file_cache.max_entries", 256, "max cached static files (open fds)");
+    configManager.lookup<int>("server.file_cache.ttl", 1000, "milliseconds before a cached file is stat()ed again");
+    configManager.lookup<int>("server.file_cache.mem_threshold", 64 * 1024, "files not larger than this are kept in memory");
+    configManager.lookup<int>("server.file_cache.preload", 1, "load small files under htdocs into the cache at startup");
+    configManager.lookup<std::map<std::string, std::string> >("server.mime_types", std::map<std::string, std::string>(),
+                                                               "extra suffix -> MIME type mappings");
 
     if (false == configManager.loadFromCmd(argc, argv))
     {
@@ -205,8 +217,9 @@ int listening_socket_init()
 {
     int rc = 0;
     ConfigManager& configManager = Singleton<ConfigManager>::getInstance();
-    ConfigItem<unsigned short>::ptr port = configManager.lookup<unsigned short>("port");
-    rc = util::socket_bind_listen(port->getValue());
+    ConfigItem<unsigned short>::ptr port = configManager.lookup<unsigned short>("server.port");
+    ConfigItem<int>::ptr backlog = configManager.lookup<int>("server.backlog");
+    rc = util::socket_bind_listen(port->getValue(), backlog->getValue());
     if(rc == -1)
     {
         LOG_FATAL(LOG_ROOT()) << "Create listen socket failed: " << my_strerror(errno);
@@ -245,61 +258,119 @@ int main(int argc, char* argv[])
         printf("web server version: %s\n", WEB_SERVER_VERSION);
         return 0;
     }
-    int listening_socket = listening_socket_init();
-    if(listening_socket == -1)
+    ConfigItem<int>::ptr thread_count = configManager.lookup<int>("server.thread_count");
+    ConfigItem<std::string>::ptr htdocs = configManager.lookup<std::string>("server.htdocs");
+    ConfigItem<int>::ptr reuse_port = configManager.lookup<int>("server.reuse_port");
+    ConfigItem<int>::ptr keep_alive_timeout = configManager.lookup<int>("server.keep_alive_timeout");
+    // Keep-Alive头部字段里的超时, 要在生成长连接响应之前设置; 0表示不关闭空闲连接, 也不发送Keep-Alive
+    httpData::setKeepAliveTimeout(keep_alive_timeout->getValue() > 0 ? keep_alive_timeout->getValue() : 0);
+    // 配置中扩展的MIME类型, 要在加载静态文件之前设置
+    util::addMimeTypes(configManager.lookup<std::map<std::string, std::string> >("server.mime_types")->getValue());
+    // 事件循环启动之前设置好静态文件缓存
+    Singleton<WebServer::StaticFileCache>::getInstance().configure(
+        configManager.lookup<int>("server.file_cache.max_entries")->getValue(),
+        configManager.lookup<int>("server.file_cache.ttl")->getValue(),
+        configManager.lookup<int>("server.file_cache.mem_threshold")->getValue());
+    // 内存中的小文件预先拼好完整的长连接响应
+    Singleton<WebServer::StaticFileCache>::getInstance().setResponseHeaders(httpData::keepAliveHeaders());
+    if(configManager.lookup<int>("server.file_cache.preload")->getValue())
     {
-        LOG_FATAL(LOG_ROOT()) << "Create listening socket failed: " << my_strerror(errno);
-        // printf("Create listening socket failed: %s\n", my_strerror(errno));
+        size_t count = Singleton<WebServer::StaticFileCache>::getInstance().preload(htdocs->getValue());
+        LOG_INFO(LOG_ROOT()) << "preload " << count << " files from " << htdocs->getValue();
+    }
+    // 每个工作线程一个事件循环, 主线程只负责accept
+    int timer_slack = configManager.lookup<int>("server.timer_slack")->getValue();
+    WebServer::EventLoopThreadPool loopPool(thread_count->getValue(), htdocs->getValue(),
+                                            keep_alive_timeout->getValue() > 0 ? keep_alive_timeout->getValue() : 0,
+                                            timer_slack > 0 ? timer_slack : 0);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(epfd == -1)
+    {
+        LOG_FATAL(LOG_ROOT()) << "epoll_create1 failed: " << my_strerror(errno);
         return 1;
     }
 
-    struct pollfd fds[1];
-    fds[0].fd = listening_socket;
-    fds[0].events = POLLIN;
+    int listening_socket = -1;
+    struct epoll_event ev;
+    if(reuse_port->getValue())
+    {
+        // 每个事件循环监听自己的socket, 由内核做负载均衡; 主线程只剩下等待退出信号
+        ConfigItem<unsigned short>::ptr port = configManager.lookup<unsigned short>("server.port");
+        ConfigItem<int>::ptr backlog = configManager.lookup<int>("server.backlog");
+        if(loopPool.listenReusePort(port->getValue(), backlog->getValue()) == -1)
+        {
+            LOG_FATAL(LOG_ROOT()) << "Create SO_REUSEPORT listening sockets failed: " << my_strerror(errno);
+            return 1;
+        }
+    }
+    else
+    {
+        listening_socket = listening_socket_init();
+        if(listening_socket == -1)
+        {
+            LOG_FATAL(LOG_ROOT()) << "Create listening socket failed: " << my_strerror(errno);
+            // printf("Create listening socket failed: %s\n", my_strerror(errno));
+            return 1;
+        }
+        if(util::set_nonblock(listening_socket) == -1)
+        {
+            LOG_FATAL(LOG_ROOT()) << "set listening socket nonblock failed: " << my_strerror(errno);
+            return 1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = listening_socket;
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, listening_socket, &ev) == -1)
+        {
+            LOG_FATAL(LOG_ROOT()) << "epoll_ctl add listening socket failed: " << my_strerror(errno);
+            return 1;
+        }
+    }
+    // listening socket都交给事件循环之后再启动它们的线程
+    loopPool.start();
 
     g_abort_loop = false;
     int rc = -1;
     while(!g_abort_loop)
     {
-        rc = poll(fds, 1, -1);
+        // 信号在主线程是屏蔽的, epoll_wait不会被信号打断, 所以带上超时时间定期检查g_abort_loop
+        rc = epoll_wait(epfd, &ev, 1, ACCEPT_WAIT_TIMEOUT);
         if(rc < 0)
         {
-            if(errno == EINTR)
-            {
-                // 可能是被信号中断, 那表示可能通过信号要退出了; 检查下
-                if(!g_abort_loop)
-                    LOG_WARN(LOG_ROOT()) << "poll failed: " << my_strerror(errno);
-            }
+            if(errno != EINTR)
+                LOG_WARN(LOG_ROOT()) << "epoll_wait failed: " << my_strerror(errno);
             continue;
         }
         if(g_abort_loop)
         {
             break;
         }
-        int flags = fcntl(listening_socket, F_GETFL, 0);
-        fcntl(listening_socket, F_SETFL, flags | O_NONBLOCK);
+        if(rc == 0)
+            continue;
         // 一直重复尝试接收新请求, 直到没有新请求为止
-        bool try_accept = true;
-        while(try_accept)
+        while(true)
         {
             struct sockaddr_storage client_addr;
             socklen_t len = sizeof(sockaddr_storage);
-            int client_sock = accept4(listening_socket, (struct sockaddr*)&client_addr, &len, SOCK_CLOEXEC);
+            int client_sock = accept4(listening_socket, (struct sockaddr*)&client_addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
             if(client_sock == -1)
             {
+                if(errno == EINTR)
+                    continue;
                 if(errno != EAGAIN && errno != EWOULDBLOCK)
                     LOG_WARN(LOG_ROOT()) << "accept failed: " << my_strerror(errno);
-                // 当前没有连续需要accept, 进入下次poll阻塞等待
-                try_accept = false;
-                fcntl(listening_socket, F_SETFL, flags);
-                continue;
+                // 当前没有连续需要accept, 进入下次epoll_wait阻塞等待
+                break;
             }
-            // 处理新的客户端连接....
-            
-            // 处理请求等等... 待补充...
+            // 处理新的客户端连接: 轮询交给某个事件循环, 请求的处理都在事件循环线程中完成
+            loopPool.getNextLoop()->queueConnection(client_sock);
         }
     }
 
+    loopPool.stop();
+    close(epfd);
+    if(listening_socket != -1)
+        close(listening_socket);
     strerror_destroy();
     return 0;
 }
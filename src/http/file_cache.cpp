@@ -0,0 +1,447 @@
+#include "http/file_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "util/util.h"
+#include "http/http_compress.h"
+#include "http/http_conditional.h"
+
+// 压缩之后至少要小这么多才使用压缩版本
+#define GZIP_MIN_SAVING 64
+
+namespace WebServer
+{
+    static uint64_t now_ms()
+    {
+        // 只用来判断ttl, 精度要求不高
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    static bool same_file(const StaticFileCache::Entry& entry, const struct stat& st)
+    {
+        return entry.dev == st.st_dev && entry.ino == st.st_ino && entry.size == st.st_size &&
+               entry.mtime == st.st_mtim.tv_sec && entry.mtimeNsec == st.st_mtim.tv_nsec;
+    }
+
+    StaticFileCache::Entry::~Entry()
+    {
+        if(fd != -1)
+            close(fd);
+    }
+
+    StaticFileCache::StaticFileCache(size_t maxEntries, uint64_t ttl, size_t memThreshold)
+        : m_maxEntries(maxEntries), m_ttl(ttl), m_memThreshold(memThreshold), m_count(0), m_hand(0)
+    {}
+
+    StaticFileCache::~StaticFileCache()
+    {
+        clear();
+    }
+
+    void StaticFileCache::configure(size_t maxEntries, uint64_t ttl, size_t memThreshold)
+    {
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+            m_memThreshold = memThreshold;
+        }
+        m_maxEntries = maxEntries;
+        m_ttl = ttl;
+        while(m_count > m_maxEntries && _evict())
+            ;
+    }
+
+    void StaticFileCache::setResponseHeaders(const std::string& headers)
+    {
+        WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+        m_responseHeaders = headers;
+    }
+
+    size_t StaticFileCache::preload(const std::string& dir)
+    {
+        size_t count = 0;
+        std::string root = dir;
+        // 和请求的路径保持一致(resPath + "/...")
+        while(root.size() > 1 && root.back() == '/')
+            root.pop_back();
+        _preload(root, count, 0);
+        return count;
+    }
+
+    void StaticFileCache::_preload(const std::string& dir, size_t& count, int depth)
+    {
+        // 防止目录的符号链接成环
+        if(depth > 16)
+            return;
+        DIR* dp = opendir(dir.c_str());
+        if(!dp)
+            return;
+        struct dirent* ent;
+        while((ent = readdir(dp)) != nullptr)
+        {
+            if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+            std::string path = dir + "/" + ent->d_name;
+            struct stat st;
+            if(stat(path.c_str(), &st) == -1)
+                continue;
+            if(S_ISDIR(st.st_mode))
+            {
+                _preload(path, count, depth + 1);
+                continue;
+            }
+            if(m_count >= m_maxEntries)
+                break;
+            {
+                WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+                if(!S_ISREG(st.st_mode) || (size_t)st.st_size > m_memThreshold)
+                    continue;
+            }
+            if(get(path))
+                ++count;
+        }
+        closedir(dp);
+    }
+
+    const char* StaticFileCache::mimeOf(const std::string& path)
+    {
+        return util::getMimeTypeByPath(path);
+    }
+
+    StaticFileCache::Shard& StaticFileCache::_shard(const std::string& path)
+    {
+        return m_shards[std::hash<std::string>()(path) % SHARD_COUNT];
+    }
+
+    StaticFileCache::Entry::ptr StaticFileCache::get(const std::string& path)
+    {
+        uint64_t now = now_ms();
+        Shard& shard = _shard(path);
+        Entry::ptr entry;
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+            auto it = shard.nodes.find(path);
+            if(it != shard.nodes.end())
+            {
+                Node& node = it->second;
+                // 只有上一次扫描之后第一次命中才写, 经常命中的条目不会反复修改cache line
+                if(!node.referenced)
+                    node.referenced = true;
+                if(now - node.checkedAt < m_ttl.load(std::memory_order_relaxed))
+                    return node.entry;
+                entry = node.entry;
+            }
+        }
+
+        // 过期了, 确认一下文件有没有变化
+        if(entry)
+        {
+            struct stat st;
+            if(stat(path.c_str(), &st) == 0 && same_file(*entry, st))
+            {
+                // .gz文件也可能单独更新或者删除
+                bool gzipChanged = false;
+                Entry::ptr gzip;
+                {
+                    WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+                    auto it = shard.nodes.find(path);
+                    if(it != shard.nodes.end() && it->second.entry == entry && it->second.gzipFile)
+                        gzip = it->second.gzip;
+                }
+                if(gzip)
+                {
+                    struct stat gst;
+                    gzipChanged = stat((path + ".gz").c_str(), &gst) == -1 || !same_file(*gzip, gst);
+                }
+                WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+                auto it = shard.nodes.find(path);
+                if(it != shard.nodes.end() && it->second.entry == entry)
+                {
+                    it->second.checkedAt = now;
+                    if(gzipChanged)
+                    {
+                        it->second.gzip.reset();
+                        it->second.gzipTried = false;
+                        it->second.gzipFile = false;
+                    }
+                }
+                return entry;
+            }
+        }
+
+        // 没有缓存或者文件已经变化, 重新加载
+        std::string mime = mimeOf(path);
+        entry = _load(path, mime, false);
+        if(!entry)
+        {
+            int err = errno;
+            invalidate(path);
+            errno = err;
+            return nullptr;
+        }
+        if(m_maxEntries > 0)
+            _insert(shard, path, entry, now);
+        return entry;
+    }
+
+    StaticFileCache::Entry::ptr StaticFileCache::_load(const std::string& path, const std::string& mime, bool gzip)
+    {
+        // O_NONBLOCK: 请求的路径可能是管道, 阻塞的open()要等到有写端
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if(fd == -1)
+            return nullptr;
+        std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+        entry->fd = fd;// 之后出错时由Entry的析构函数关闭
+
+        struct stat st;
+        if(fstat(fd, &st) == -1)
+            return nullptr;
+        if(!S_ISREG(st.st_mode))
+        {
+            // 目录, 管道, 设备等不缓存
+            errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+            return nullptr;
+        }
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim.tv_sec;
+        entry->mtimeNsec = st.st_mtim.tv_nsec;
+        entry->dev = st.st_dev;
+        entry->ino = st.st_ino;
+        entry->mime = mime;
+        entry->gzip = gzip;
+
+        size_t memThreshold;
+        std::string responseHeaders;
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+            memThreshold = m_memThreshold;
+            responseHeaders = m_responseHeaders;
+        }
+        if((size_t)st.st_size <= memThreshold)
+        {
+            entry->data.resize(st.st_size);
+            size_t total = 0;
+            while(total < (size_t)st.st_size)
+            {
+                ssize_t n = pread(fd, &entry->data[total], st.st_size - total, total);
+                if(n < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    return nullptr;
+                }
+                if(n == 0)
+                {
+                    // 读的过程中文件被截短了, 下一次再加载
+                    errno = EAGAIN;
+                    return nullptr;
+                }
+                total += n;
+            }
+            entry->inMemory = true;
+            // 内容已经在内存中, 不再需要fd
+            close(entry->fd);
+            entry->fd = -1;
+        }
+        _finish(*entry, responseHeaders);
+        return entry;
+    }
+
+    void StaticFileCache::_finish(Entry& entry, const std::string& responseHeaders)
+    {
+        // 和nginx一样用"mtime-大小"作为etag; gzip版本是不同的表示, 必须用不同的强标签
+        char etag[64];
+        snprintf(etag, sizeof(etag), "\"%lx-%lx%s\"", (unsigned long)entry.mtime, (unsigned long)entry.size,
+                 entry.gzip ? "-gz" : "");
+        entry.etag = etag;
+        entry.lastModified = http_conditional::formatDate(entry.mtime);
+        // 可以压缩的文件, 原版本也要带上Vary, 否则中间的缓存可能把原版本发给支持gzip的客户端(或者相反)
+        entry.vary = http_compress::isCompressible(entry.mime);
+
+        std::string& h = entry.headers;
+        h.reserve(192 + entry.mime.size());
+        h.append("Content-Type: ").append(entry.mime).append("\r\n");
+        if(entry.gzip)
+            h.append("Content-Encoding: gzip\r\n");
+        if(entry.vary)
+            h.append("Vary: Accept-Encoding\r\n");
+        h.append("ETag: ").append(entry.etag).append("\r\n");
+        h.append("Last-Modified: ").append(entry.lastModified).append("\r\n");
+        h.append("Accept-Ranges: bytes\r\n");
+        h.append("Content-Length: ").append(std::to_string(entry.size)).append("\r\n");
+
+        if(!entry.inMemory || responseHeaders.empty())
+            return;
+        std::string& resp = entry.response;
+        resp.reserve(64 + h.size() + responseHeaders.size() + entry.data.size());
+        resp.append("HTTP/1.1 200 OK\r\n");
+        resp.append(responseHeaders);
+        resp.append(h);
+        resp.append("\r\n");
+        entry.responseHeaderLen = resp.size();
+        resp.append(entry.data);
+        // 之后通过body()访问, 内存中只保留一份文件内容
+        std::string().swap(entry.data);
+    }
+
+    StaticFileCache::Entry::ptr StaticFileCache::getGzip(const std::string& path, const Entry::ptr& raw)
+    {
+        if(!http_compress::isCompressible(raw->mime))
+            return nullptr;
+        Shard& shard = _shard(path);
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+            auto it = shard.nodes.find(path);
+            if(it != shard.nodes.end() && it->second.entry == raw && it->second.gzipTried)
+                return it->second.gzip;
+        }
+        std::string responseHeaders;
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+            responseHeaders = m_responseHeaders;
+        }
+
+        // 优先使用事先压缩好的.gz文件
+        bool fromFile = true;
+        Entry::ptr gzip = _load(path + ".gz", raw->mime, true);
+        // 在线压缩在事件循环线程中同步执行, 只压缩已经在内存中的小文件(不超过内存阈值), 大文件要事先准备.gz
+        if(!gzip && http_compress::available() && raw->inMemory)
+        {
+            fromFile = false;
+            std::string compressed;
+            if(http_compress::gzipCompress(raw->body(), raw->size, compressed) &&
+               compressed.size() + GZIP_MIN_SAVING <= (size_t)raw->size)
+            {
+                std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+                entry->size = compressed.size();
+                entry->mtime = raw->mtime;
+                entry->mtimeNsec = raw->mtimeNsec;
+                entry->dev = raw->dev;
+                entry->ino = raw->ino;
+                entry->mime = raw->mime;
+                entry->gzip = true;
+                entry->data.swap(compressed);
+                entry->inMemory = true;
+                _finish(*entry, responseHeaders);
+                gzip = entry;
+            }
+        }
+
+        // 和原文件放在一起, 原文件重新加载时一起丢弃
+        WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+        auto it = shard.nodes.find(path);
+        if(it != shard.nodes.end() && it->second.entry == raw)
+        {
+            it->second.gzip = gzip;
+            it->second.gzipTried = true;
+            it->second.gzipFile = gzip && fromFile;
+        }
+        return gzip;
+    }
+
+    void StaticFileCache::_insert(Shard& shard, const std::string& path, const Entry::ptr& entry, uint64_t now)
+    {
+        // 旧条目的fd在最后一个使用者释放之后关闭
+        auto update = [&](Node& node)
+        {
+            node.entry = entry;
+            node.gzip.reset();
+            node.gzipTried = false;
+            node.gzipFile = false;
+            node.referenced = false;
+            node.checkedAt = now;
+        };
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+            auto it = shard.nodes.find(path);
+            if(it != shard.nodes.end())
+            {
+                update(it->second);
+                return;
+            }
+        }
+
+        // 新条目: 先腾出位置, 淘汰时要锁其它分片, 所以不能持有shard.mtx; 并发插入时总数可能暂时略超过上限
+        while(m_count >= m_maxEntries && _evict())
+            ;
+        WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+        auto res = shard.nodes.insert(std::make_pair(path, Node()));
+        if(res.second)
+        {
+            shard.ring.push_front(path);
+            res.first->second.ring = shard.ring.begin();
+            ++m_count;
+        }
+        update(res.first->second);
+    }
+
+    bool StaticFileCache::_evict()
+    {
+        // 第一轮可能只是清除了访问标记, 第二轮一定能淘汰一个
+        size_t start = m_hand.fetch_add(1, std::memory_order_relaxed);
+        for(size_t i = 0; i < SHARD_COUNT * 2; ++i)
+        {
+            Shard& shard = m_shards[(start + i) % SHARD_COUNT];
+            WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+            if(_evictFrom(shard))
+                return true;
+        }
+        return false;
+    }
+
+    bool StaticFileCache::_evictFrom(Shard& shard)
+    {
+        for(size_t n = shard.ring.size(); n > 0; --n)
+        {
+            auto it = shard.nodes.find(shard.ring.back());
+            if(it->second.referenced)
+            {
+                it->second.referenced = false;
+                shard.ring.splice(shard.ring.begin(), shard.ring, it->second.ring);
+                continue;
+            }
+            shard.ring.pop_back();
+            shard.nodes.erase(it);
+            --m_count;
+            return true;
+        }
+        return false;
+    }
+
+    void StaticFileCache::invalidate(const std::string& path)
+    {
+        Shard& shard = _shard(path);
+        WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+        auto it = shard.nodes.find(path);
+        if(it == shard.nodes.end())
+            return;
+        shard.ring.erase(it->second.ring);
+        shard.nodes.erase(it);
+        --m_count;
+    }
+
+    void StaticFileCache::clear()
+    {
+        for(Shard& shard : m_shards)
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(shard.mtx);
+            m_count -= shard.nodes.size();
+            shard.nodes.clear();
+            shard.ring.clear();
+        }
+    }
+
+    size_t StaticFileCache::size()
+    {
+        return m_count;
+    }
+}
@@ -0,0 +1,145 @@
+#include "http/http_chunked.h"
+
+#include <cstring>
+
+namespace WebServer
+{
+    static inline int decode_hex(char c)
+    {
+        if(c >= '0' && c <= '9')
+            return c - '0';
+        if(c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        if(c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        return -1;
+    }
+
+    void HttpChunkedDecoder::reset()
+    {
+        m_state = CHUNK_SIZE;
+        m_bytesLeft = 0;
+        m_hexCount = 0;
+    }
+
+    HttpChunkedDecoder::Status HttpChunkedDecoder::decode(char* buf, size_t* size, size_t* left)
+    {
+        size_t bufsz = *size;
+        size_t dst = 0;     // 解码得到的数据写到这里
+        size_t src = 0;     // 下一个要处理的字节
+        size_t avail;
+        int v;
+
+        while(true)
+        {
+            switch(m_state)
+            {
+                case CHUNK_SIZE:
+                    for(;; ++src)
+                    {
+                        if(src == bufsz)
+                            goto again;
+                        v = decode_hex(buf[src]);
+                        if(v == -1)
+                        {
+                            if(m_hexCount == 0)
+                                return ERROR;
+                            // chunk-size之后只能是空白, ';'(chunk-ext)或者行尾
+                            if(buf[src] != ' ' && buf[src] != '\t' && buf[src] != ';' &&
+                               buf[src] != '\r' && buf[src] != '\n')
+                                return ERROR;
+                            break;
+                        }
+                        // 防止溢出
+                        if(m_hexCount == (int)(sizeof(size_t) * 2))
+                            return ERROR;
+                        m_bytesLeft = m_bytesLeft * 16 + v;
+                        ++m_hexCount;
+                    }
+                    m_hexCount = 0;
+                    m_state = CHUNK_EXT;
+                    // fall through
+                case CHUNK_EXT:
+                    for(;; ++src)
+                    {
+                        if(src == bufsz)
+                            goto again;
+                        if(buf[src] == '\n')
+                            break;
+                    }
+                    ++src;
+                    if(m_bytesLeft == 0)
+                    {
+                        // 最后一个chunk
+                        m_state = TRAILER_LINE_HEAD;
+                        break;
+                    }
+                    m_state = CHUNK_DATA;
+                    // fall through
+                case CHUNK_DATA:
+                    avail = bufsz - src;
+                    if(avail < m_bytesLeft)
+                    {
+                        memmove(buf + dst, buf + src, avail);
+                        src += avail;
+                        dst += avail;
+                        m_bytesLeft -= avail;
+                        goto again;
+                    }
+                    memmove(buf + dst, buf + src, m_bytesLeft);
+                    src += m_bytesLeft;
+                    dst += m_bytesLeft;
+                    m_bytesLeft = 0;
+                    m_state = CHUNK_CRLF;
+                    // fall through
+                case CHUNK_CRLF:
+                    for(;; ++src)
+                    {
+                        if(src == bufsz)
+                            goto again;
+                        if(buf[src] != '\r')
+                            break;
+                    }
+                    if(buf[src] != '\n')
+                        return ERROR;
+                    ++src;
+                    m_state = CHUNK_SIZE;
+                    break;
+                case TRAILER_LINE_HEAD:
+                    for(;; ++src)
+                    {
+                        if(src == bufsz)
+                            goto again;
+                        if(buf[src] != '\r')
+                            break;
+                    }
+                    if(buf[src++] == '\n')
+                        goto complete;
+                    m_state = TRAILER_LINE_MIDDLE;
+                    // fall through
+                case TRAILER_LINE_MIDDLE:
+                    for(;; ++src)
+                    {
+                        if(src == bufsz)
+                            goto again;
+                        if(buf[src] == '\n')
+                            break;
+                    }
+                    ++src;
+                    m_state = TRAILER_LINE_HEAD;
+                    break;
+            }
+        }
+
+    complete:
+        // 剩下的数据属于下一个请求, 紧接着body数据放
+        memmove(buf + dst, buf + src, bufsz - src);
+        *left = bufsz - src;
+        *size = dst;
+        return SUCCESS;
+
+    again:
+        *size = dst;
+        return AGAIN;
+    }
+}
@@ -0,0 +1,120 @@
+#include "http/http_compress.h"
+
+#include <cstring>
+#include <strings.h>
+
+#ifdef WEBSERVER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace WebServer
+{
+    namespace http_compress
+    {
+        bool available()
+        {
+#ifdef WEBSERVER_HAVE_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        bool isCompressible(const std::string& mime)
+        {
+            static const char* const types[] = {
+                "application/javascript",
+                "application/json",
+                "application/xml",
+                "image/svg+xml",
+            };
+            if(mime.compare(0, 5, "text/") == 0)
+                return true;
+            for(const char* type : types)
+            {
+                if(mime == type)
+                    return true;
+            }
+            return false;
+        }
+
+        bool gzipCompress(const char* data, size_t len, std::string& out, int level)
+        {
+#ifdef WEBSERVER_HAVE_ZLIB
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            // windowBits加16表示输出gzip格式(带gzip头部和crc32), 而不是zlib格式
+            if(deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            out.resize(deflateBound(&zs, len));
+            zs.next_in = (Bytef*)data;
+            zs.avail_in = len;
+            zs.next_out = (Bytef*)&out[0];
+            zs.avail_out = out.size();
+            // deflateBound保证一次就能全部输出
+            int ret = deflate(&zs, Z_FINISH);
+            out.resize(zs.total_out);
+            deflateEnd(&zs);
+            return ret == Z_STREAM_END;
+#else
+            (void)data;
+            (void)len;
+            (void)out;
+            (void)level;
+            return false;
+#endif
+        }
+
+        static bool is_space(char c)
+        {
+            return c == ' ' || c == '\t';
+        }
+
+        /**
+         * @brief [p, end)是否是值为0的q参数("q=0", "q=0.0", "q=0.000")
+         */
+        static bool is_q_zero(const char* p, const char* end)
+        {
+            while(p < end && (is_space(*p) || *p == ';'))
+                ++p;
+            if(end - p < 3 || (p[0] != 'q' && p[0] != 'Q') || p[1] != '=' || p[2] != '0')
+                return false;
+            p += 3;
+            if(p < end && *p == '.')
+                ++p;
+            while(p < end && *p == '0')
+                ++p;
+            while(p < end && is_space(*p))
+                ++p;
+            return p == end;
+        }
+
+        bool acceptsGzip(const char* value, size_t len)
+        {
+            // 例如"gzip, deflate;q=0.5, br", 逐个编码检查; 明确写出的gzip优先于"*"
+            const char* p = value;
+            const char* end = value + len;
+            bool star = false;
+            while(p < end)
+            {
+                const char* item = p;
+                const char* next = (const char*)memchr(p, ',', end - p);
+                if(!next)
+                    next = end;
+                p = next + 1;
+
+                while(item < next && is_space(*item))
+                    ++item;
+                const char* name_end = item;
+                while(name_end < next && *name_end != ';' && !is_space(*name_end))
+                    ++name_end;
+                size_t name_len = name_end - item;
+                if(name_len == 4 && strncasecmp(item, "gzip", 4) == 0)
+                    return !is_q_zero(name_end, next);
+                if(name_len == 1 && *item == '*')
+                    star = !is_q_zero(name_end, next);
+            }
+            return star;
+        }
+    }
+}
@@ -0,0 +1,207 @@
+#include "http/http_conditional.h"
+
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+namespace WebServer
+{
+    namespace http_conditional
+    {
+        static const char* const WEEKDAYS[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static const char* const MONTHS[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+        static bool is_space(char c)
+        {
+            return c == ' ' || c == '\t';
+        }
+
+        std::string formatDate(time_t t)
+        {
+            // 不用strftime, 星期和月份的名字不能受locale影响
+            struct tm tm;
+            gmtime_r(&t, &tm);
+            char buf[32];
+            int n = snprintf(buf, sizeof(buf), "%s, %02d %s %04d %02d:%02d:%02d GMT",
+                             WEEKDAYS[tm.tm_wday], tm.tm_mday, MONTHS[tm.tm_mon], tm.tm_year + 1900,
+                             tm.tm_hour, tm.tm_min, tm.tm_sec);
+            return std::string(buf, n);
+        }
+
+        static bool parse_digits(const char* p, int n, int& value)
+        {
+            value = 0;
+            for(int i = 0; i < n; ++i)
+            {
+                if(p[i] < '0' || p[i] > '9')
+                    return false;
+                value = value * 10 + (p[i] - '0');
+            }
+            return true;
+        }
+
+        time_t parseDate(const char* value, size_t len)
+        {
+            // "Sun, 06 Nov 1994 08:49:37 GMT", 固定29个字符
+            while(len > 0 && is_space(value[len - 1]))
+                --len;
+            while(len > 0 && is_space(*value))
+                ++value, --len;
+            if(len != 29 || value[3] != ',' || value[4] != ' ' || value[7] != ' ' || value[11] != ' ' ||
+               value[16] != ' ' || value[19] != ':' || value[22] != ':' || memcmp(value + 25, " GMT", 4) != 0)
+                return -1;
+
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            int year;
+            tm.tm_mon = -1;
+            for(int i = 0; i < 12; ++i)
+            {
+                if(memcmp(value + 8, MONTHS[i], 3) == 0)
+                {
+                    tm.tm_mon = i;
+                    break;
+                }
+            }
+            if(tm.tm_mon == -1 || !parse_digits(value + 5, 2, tm.tm_mday) || !parse_digits(value + 12, 4, year) ||
+               !parse_digits(value + 17, 2, tm.tm_hour) || !parse_digits(value + 20, 2, tm.tm_min) ||
+               !parse_digits(value + 23, 2, tm.tm_sec))
+                return -1;
+            if(tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60)
+                return -1;
+            tm.tm_year = year - 1900;
+            return timegm(&tm);
+        }
+
+        bool etagMatches(const char* value, size_t len, const std::string& etag)
+        {
+            // etag本身可能是弱标签, 弱比较时去掉"W/"
+            const char* tag = etag.data();
+            size_t tag_len = etag.size();
+            if(tag_len > 2 && tag[0] == 'W' && tag[1] == '/')
+                tag += 2, tag_len -= 2;
+
+            const char* p = value;
+            const char* end = value + len;
+            while(p < end)
+            {
+                while(p < end && (is_space(*p) || *p == ','))
+                    ++p;
+                if(p == end)
+                    break;
+                if(*p == '*')
+                    return true;
+                if(end - p > 2 && p[0] == 'W' && p[1] == '/')
+                    p += 2;
+                if(*p != '"')
+                    return false;
+                const char* close = (const char*)memchr(p + 1, '"', end - p - 1);
+                if(!close)
+                    return false;
+                if((size_t)(close + 1 - p) == tag_len && memcmp(p, tag, tag_len) == 0)
+                    return true;
+                p = close + 1;
+            }
+            return false;
+        }
+
+        /**
+         * @brief 解析非负十进制数, 返回false表示格式错误或者溢出
+         */
+        static bool parse_offset(const char*& p, const char* end, off_t& value)
+        {
+            const char* start = p;
+            value = 0;
+            while(p < end && *p >= '0' && *p <= '9')
+            {
+                if(value > (off_t)((((unsigned long long)1 << 62) - 1) / 10))
+                    return false;
+                value = value * 10 + (*p - '0');
+                ++p;
+            }
+            return p != start;
+        }
+
+        RangeResult parseRange(const char* value, size_t len, off_t size, ByteRange* ranges, size_t& count)
+        {
+            count = 0;
+            const char* p = value;
+            const char* end = value + len;
+            while(p < end && is_space(*p))
+                ++p;
+            if(end - p < 6 || strncasecmp(p, "bytes=", 6) != 0)
+                return RANGE_NONE;
+            p += 6;
+
+            bool any = false;       // 是否至少有一个格式正确的范围
+            while(p < end)
+            {
+                while(p < end && (is_space(*p) || *p == ','))
+                    ++p;
+                if(p == end)
+                    break;
+
+                off_t first, last;
+                if(*p == '-')
+                {
+                    // "-n": 最后n个字节
+                    ++p;
+                    off_t suffix;
+                    if(!parse_offset(p, end, suffix))
+                        return RANGE_NONE;
+                    any = true;
+                    if(suffix == 0 || size == 0)
+                        goto next;
+                    first = suffix >= size ? 0 : size - suffix;
+                    last = size - 1;
+                }
+                else
+                {
+                    if(!parse_offset(p, end, first) || p == end || *p != '-')
+                        return RANGE_NONE;
+                    ++p;
+                    last = size - 1;
+                    if(p < end && *p >= '0' && *p <= '9')
+                    {
+                        off_t value_last;
+                        if(!parse_offset(p, end, value_last) || value_last < first)
+                            return RANGE_NONE;
+                        if(value_last < last)
+                            last = value_last;
+                    }
+                    any = true;
+                    if(first >= size)
+                        goto next;
+                }
+                if(count == MAX_RANGES)
+                {
+                    count = 0;
+                    return RANGE_NONE;
+                }
+                ranges[count].offset = first;
+                ranges[count].length = last - first + 1;
+                ++count;
+
+            next:
+                while(p < end && is_space(*p))
+                    ++p;
+                if(p < end && *p != ',')
+                    return RANGE_NONE;
+            }
+
+            if(!any)
+                return RANGE_NONE;
+            return count == 0 ? RANGE_UNSATISFIABLE : RANGE_OK;
+        }
+
+        RangeResult parseRange(const char* value, size_t len, off_t size, std::vector<ByteRange>& ranges)
+        {
+            ByteRange buf[MAX_RANGES];
+            size_t count;
+            RangeResult result = parseRange(value, len, size, buf, count);
+            ranges.assign(buf, buf + count);
+            return result;
+        }
+    }
+}
@@ -0,0 +1,166 @@
+#include "http/http_parser.h"
+#include "http/http_scan.h"
+
+#include <cstring>
+#include <strings.h>
+
+namespace WebServer
+{
+    static inline bool is_space(char c)
+    {
+        return c == ' ' || c == '\t';
+    }
+
+    void HttpRequestParser::reset(size_t start)
+    {
+        m_state = REQUEST_LINE;
+        m_start = start;
+        m_pos = start;
+        m_scan = start;
+        m_method.off = m_method.len = 0;
+        m_target.off = m_target.len = 0;
+        m_major = m_minor = -1;
+        m_headerCount = 0;
+    }
+
+    void HttpRequestParser::rebase(size_t delta)
+    {
+        m_start -= delta;
+        m_pos -= delta;
+        m_scan -= delta;
+        m_method.off -= (uint32_t)delta;
+        m_target.off -= (uint32_t)delta;
+        for(int i = 0; i < m_headerCount; ++i)
+        {
+            m_headers[i].name.off -= (uint32_t)delta;
+            m_headers[i].value.off -= (uint32_t)delta;
+        }
+    }
+
+    HttpRequestParser::Status HttpRequestParser::parse(const char* buf, size_t len)
+    {
+        while(m_state != DONE)
+        {
+            // 从上次停下的位置继续找行尾, 已经扫描过的字节不再扫描
+            const char* nl = buf + len;
+            if(m_scan < len)
+                nl = http_scan::findNewline(buf + m_scan, buf + len);
+            if(nl == buf + len)
+            {
+                m_scan = len;
+                if(len - m_start > MAX_HEADER_SIZE)
+                    return ERROR;
+                return AGAIN;
+            }
+
+            size_t begin = m_pos;
+            size_t next = nl - buf + 1;
+            size_t end = nl - buf;
+            // 兼容只有'\n'的行尾
+            if(end > begin && buf[end - 1] == '\r')
+                --end;
+
+            Status ret;
+            if(m_state == REQUEST_LINE && begin == end)
+            {
+                // 请求行之前的空行直接忽略(RFC 7230 3.5)
+                m_start = next;
+                ret = SUCCESS;
+            }
+            else if(m_state == REQUEST_LINE)
+            {
+                ret = _parseRequestLine(buf, begin, end);
+                m_state = HEADER_LINE;
+            }
+            else if(begin == end)
+            {
+                // 空行, 头部字段结束
+                ret = SUCCESS;
+                m_state = DONE;
+            }
+            else
+                ret = _parseHeaderLine(buf, begin, end);
+
+            if(ret == ERROR)
+                return ERROR;
+            m_pos = next;
+            m_scan = next;
+        }
+
+        if(m_pos - m_start > MAX_HEADER_SIZE)
+            return ERROR;
+        return SUCCESS;
+    }
+
+    HttpRequestParser::Status HttpRequestParser::_parseRequestLine(const char* buf, size_t begin, size_t end)
+    {
+        // method
+        size_t i = http_scan::skipToken(buf + begin, buf + end) - buf;
+        if(i == begin || i == end || buf[i] != ' ')
+            return ERROR;
+        m_method.off = (uint32_t)begin;
+        m_method.len = (uint32_t)(i - begin);
+
+        // request-target, 不包含空白和控制字符
+        size_t target = ++i;
+        i = http_scan::skipTarget(buf + target, buf + end) - buf;
+        if(i == target || i == end || buf[i] != ' ')
+            return ERROR;
+        m_target.off = (uint32_t)target;
+        m_target.len = (uint32_t)(i - target);
+
+        // HTTP-version: "HTTP/x.y"
+        ++i;
+        if(end - i != 8 || memcmp(buf + i, "HTTP/", 5) != 0)
+            return ERROR;
+        char major = buf[i + 5];
+        char minor = buf[i + 7];
+        if(major < '0' || major > '9' || buf[i + 6] != '.' || minor < '0' || minor > '9')
+            return ERROR;
+        m_major = major - '0';
+        m_minor = minor - '0';
+        return SUCCESS;
+    }
+
+    HttpRequestParser::Status HttpRequestParser::_parseHeaderLine(const char* buf, size_t begin, size_t end)
+    {
+        // 不支持已经废弃的多行头部字段(obs-fold)
+        if(is_space(buf[begin]) || m_headerCount == MAX_HEADERS)
+            return ERROR;
+
+        size_t i = http_scan::skipToken(buf + begin, buf + end) - buf;
+        if(i == begin || i == end || buf[i] != ':')
+            return ERROR;
+
+        HttpHeader& header = m_headers[m_headerCount];
+        header.name.off = (uint32_t)begin;
+        header.name.len = (uint32_t)(i - begin);
+
+        ++i;
+        while(i < end && is_space(buf[i]))
+            ++i;
+        size_t value_end = end;
+        while(value_end > i && is_space(buf[value_end - 1]))
+            --value_end;
+        header.value.off = (uint32_t)i;
+        header.value.len = (uint32_t)(value_end - i);
+
+        ++m_headerCount;
+        return SUCCESS;
+    }
+
+    const HttpHeader* HttpRequestParser::findHeader(const char* buf, const char* name) const
+    {
+        for(int i = 0; i < m_headerCount; ++i)
+        {
+            if(equalsIgnoreCase(buf, m_headers[i].name, name))
+                return &m_headers[i];
+        }
+        return nullptr;
+    }
+
+    bool HttpRequestParser::equalsIgnoreCase(const char* buf, const HttpSpan& span, const char* str)
+    {
+        return strlen(str) == span.len && strncasecmp(buf + span.off, str, span.len) == 0;
+    }
+}
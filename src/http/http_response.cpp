@@ -0,0 +1,228 @@
+#include "http/http_response.h"
+
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+
+// 一次sendmsg最多的段数
+#define RESPONSE_IOV_MAX    64
+
+namespace WebServer
+{
+    HttpResponseBuilder::HttpResponseBuilder(BufferPool* pool)
+        : m_buf(pool), m_head(0), m_size(0)
+    {}
+
+    HttpResponseBuilder::~HttpResponseBuilder()
+    {
+        clear();
+    }
+
+    const char* HttpResponseBuilder::reasonPhrase(int code)
+    {
+        switch(code)
+        {
+            case 200: return "OK";
+            case 206: return "Partial Content";
+            case 304: return "Not Modified";
+            case 400: return "Bad Request";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 412: return "Precondition Failed";
+            case 416: return "Range Not Satisfiable";
+            case 500: return "Internal Server Error";
+            case 501: return "Not Implemented";
+            default:  return "Unknown";
+        }
+    }
+
+    void HttpResponseBuilder::_appendMem(const char* data, size_t len)
+    {
+        if(len == 0)
+            return;
+        // 和上一个缓冲区中的段连续, 直接合并
+        if(m_head < m_segments.size())
+        {
+            Segment& last = m_segments.back();
+            if(last.ref == nullptr && last.fd == -1 && (size_t)last.off + last.len == m_buf.size())
+            {
+                m_buf.append(data, len);
+                last.len += len;
+                m_size += len;
+                return;
+            }
+        }
+        Segment seg = {nullptr, -1, (off_t)m_buf.size(), len};
+        m_buf.append(data, len);
+        m_segments.push_back(seg);
+        m_size += len;
+    }
+
+    void HttpResponseBuilder::appendStatus(int code, const char* reason)
+    {
+        char buf[16] = "HTTP/1.1 000 ";
+        buf[9] = '0' + code / 100 % 10;
+        buf[10] = '0' + code / 10 % 10;
+        buf[11] = '0' + code % 10;
+        _appendMem(buf, 13);
+        if(!reason)
+            reason = reasonPhrase(code);
+        _appendMem(reason, strlen(reason));
+        _appendMem("\r\n", 2);
+    }
+
+    void HttpResponseBuilder::appendHeader(const char* name, const char* value)
+    {
+        appendHeader(name, value, strlen(value));
+    }
+
+    void HttpResponseBuilder::appendHeader(const char* name, const char* value, size_t len)
+    {
+        _appendMem(name, strlen(name));
+        _appendMem(": ", 2);
+        _appendMem(value, len);
+        _appendMem("\r\n", 2);
+    }
+
+    void HttpResponseBuilder::appendHeader(const char* name, uint64_t value)
+    {
+        char buf[20];
+        char* p = buf + sizeof(buf);
+        do
+        {
+            *--p = '0' + value % 10;
+            value /= 10;
+        } while(value);
+        appendHeader(name, p, buf + sizeof(buf) - p);
+    }
+
+    void HttpResponseBuilder::appendEnd()
+    {
+        _appendMem("\r\n", 2);
+    }
+
+    void HttpResponseBuilder::append(const char* data, size_t len)
+    {
+        _appendMem(data, len);
+    }
+
+    void HttpResponseBuilder::appendRef(const char* data, size_t len)
+    {
+        if(len == 0)
+            return;
+        Segment seg = {data, -1, 0, len};
+        m_segments.push_back(seg);
+        m_size += len;
+    }
+
+    void HttpResponseBuilder::appendFile(int fd, off_t offset, size_t len)
+    {
+        if(len == 0)
+            return;
+        Segment seg = {nullptr, fd, offset, len};
+        m_segments.push_back(seg);
+        m_size += len;
+    }
+
+    void HttpResponseBuilder::_consume(size_t n)
+    {
+        m_size -= n;
+        while(n > 0)
+        {
+            Segment& seg = m_segments[m_head];
+            if(n < seg.len)
+            {
+                if(seg.ref)
+                    seg.ref += n;
+                else
+                    seg.off += n;
+                seg.len -= n;
+                return;
+            }
+            n -= seg.len;
+            ++m_head;
+        }
+    }
+
+    HttpResponseBuilder::Status HttpResponseBuilder::flush(int sockfd)
+    {
+        while(m_head < m_segments.size())
+        {
+            Segment& first = m_segments[m_head];
+            if(first.fd >= 0)
+            {
+                // sendfile会更新first.off
+                ssize_t n = sendfile(sockfd, first.fd, &first.off, first.len);
+                if(n < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    return errno == EAGAIN ? AGAIN : ERROR;
+                }
+                if(n == 0)
+                {
+                    // 文件被截短了, 已经发出去的Content-Length无法兑现
+                    errno = EIO;
+                    return ERROR;
+                }
+                m_size -= n;
+                first.len -= n;
+                if(first.len == 0)
+                    ++m_head;
+                continue;
+            }
+
+            // 收集连续的内存段, 一次发送
+            struct iovec iov[RESPONSE_IOV_MAX];
+            int cnt = 0;
+            size_t i = m_head;
+            for(; i < m_segments.size() && cnt < RESPONSE_IOV_MAX && m_segments[i].fd < 0; ++i)
+            {
+                const Segment& seg = m_segments[i];
+                iov[cnt].iov_base = (void*)(seg.ref ? seg.ref : m_buf.data() + seg.off);
+                iov[cnt].iov_len = seg.len;
+                ++cnt;
+            }
+
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = cnt;
+            // 后面还有文件要sendfile, 告诉内核先不要把头部单独发出去
+            int flags = MSG_NOSIGNAL;
+            if(i < m_segments.size())
+                flags |= MSG_MORE;
+            ssize_t n = sendmsg(sockfd, &msg, flags);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                    continue;
+                return errno == EAGAIN ? AGAIN : ERROR;
+            }
+            _consume(n);
+        }
+
+        // 全部发送完成: 池中的缓冲区马上还回去, 堆内存保留容量下次继续使用
+        if(m_buf.pool())
+            m_buf.release();
+        else
+            m_buf.clear();
+        m_segments.clear();
+        m_head = 0;
+        m_holds.clear();
+        return SUCCESS;
+    }
+
+    void HttpResponseBuilder::clear()
+    {
+        m_buf.release();
+        m_segments.clear();
+        m_head = 0;
+        m_size = 0;
+        m_holds.clear();
+    }
+}
@@ -0,0 +1,205 @@
+#include "http/http_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+# define HTTP_SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+namespace WebServer
+{
+namespace http_scan
+{
+    /**
+     * @brief RFC 7230 token字符表
+     */
+    static const unsigned char token_char_map[256] = {
+        // 0x00 - 0x1f 控制字符
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        //  SP !  "  #  $  %  &  '  (  )  *  +  ,  -  .  /
+        0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0,
+        //  0 - 9                         :  ;  <  =  >  ?
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+        //  @  A - O
+        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        //  P - Z                         [  \  ]  ^  _
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+        //  `  a - o
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+        //  p - z                         {  |  }  ~  DEL
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+        // 0x80 - 0xff
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    };
+
+    static inline bool is_target_char(unsigned char c)
+    {
+        return c > ' ' && c != 0x7f;
+    }
+
+    static const char* find_newline_scalar(const char* p, const char* end)
+    {
+        while(p < end && *p != '\n')
+            ++p;
+        return p;
+    }
+
+    static const char* skip_token_scalar(const char* p, const char* end)
+    {
+        while(p < end && token_char_map[(unsigned char)*p])
+            ++p;
+        return p;
+    }
+
+    static const char* skip_target_scalar(const char* p, const char* end)
+    {
+        while(p < end && is_target_char(*p))
+            ++p;
+        return p;
+    }
+
+#ifdef HTTP_SCAN_X86
+    __attribute__((target("sse2")))
+    static const char* find_newline_sse2(const char* p, const char* end)
+    {
+        const __m128i nl = _mm_set1_epi8('\n');
+        while(end - p >= 16)
+        {
+            __m128i b16 = _mm_loadu_si128((const __m128i*)p);
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(b16, nl));
+            if(mask)
+                return p + __builtin_ctz(mask);
+            p += 16;
+        }
+        return find_newline_scalar(p, end);
+    }
+
+    __attribute__((target("avx2")))
+    static const char* find_newline_avx2(const char* p, const char* end)
+    {
+        const __m256i nl = _mm256_set1_epi8('\n');
+        while(end - p >= 32)
+        {
+            __m256i b32 = _mm256_loadu_si256((const __m256i*)p);
+            unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b32, nl));
+            if(mask)
+                return p + __builtin_ctz(mask);
+            p += 32;
+        }
+        return find_newline_sse2(p, end);
+    }
+
+    /**
+     * @brief 每次比较16个字节, 返回第一个落在ranges中的字符的位置(picohttpparser的findchar_fast)
+     * 剩下不足16个字节, 或者找到的字符需要进一步判断时, 由调用者用逐字节的方式继续
+     * @param ranges 最多8个闭区间[lo, hi], 必须能读16个字节
+     */
+    __attribute__((target("sse4.2")))
+    static const char* findchar_fast(const char* p, const char* end, const char* ranges, int ranges_size)
+    {
+        const __m128i ranges16 = _mm_loadu_si128((const __m128i*)ranges);
+        while(end - p >= 16)
+        {
+            __m128i b16 = _mm_loadu_si128((const __m128i*)p);
+            int r = _mm_cmpestri(ranges16, ranges_size, b16, 16,
+                                 _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+            if(r != 16)
+                return p + r;
+            p += 16;
+        }
+        return p;
+    }
+
+    static const char* skip_token_sse42(const char* p, const char* end)
+    {
+        // 非token字符的区间; '|'和'~'也落在最后一个区间中, 由逐字节的部分再判断一次
+        static const char ranges[] __attribute__((aligned(16))) =
+            "\x00 "     // 控制字符和空格
+            "\"\""      // 0x22
+            "()"        // 0x28, 0x29
+            ",,"        // 0x2c
+            "//"        // 0x2f
+            ":@"        // 0x3a - 0x40
+            "[]"        // 0x5b - 0x5d
+            "{\xff";    // 0x7b - 0xff
+        return skip_token_scalar(findchar_fast(p, end, ranges, 16), end);
+    }
+
+    static const char* skip_target_sse42(const char* p, const char* end)
+    {
+        static const char ranges[16] __attribute__((aligned(16))) =
+            "\x00 "     // 控制字符和空格
+            "\x7f\x7f"; // DEL
+        return skip_target_scalar(findchar_fast(p, end, ranges, 4), end);
+    }
+#endif
+
+    struct Impl
+    {
+        Level level;
+        const char* (*find_newline)(const char*, const char*);
+        const char* (*skip_token)(const char*, const char*);
+        const char* (*skip_target)(const char*, const char*);
+    };
+
+    static const Impl impls[] = {
+        {SCALAR, find_newline_scalar, skip_token_scalar, skip_target_scalar},
+#ifdef HTTP_SCAN_X86
+        {SSE42, find_newline_sse2, skip_token_sse42, skip_target_sse42},
+        {AVX2, find_newline_avx2, skip_token_sse42, skip_target_sse42},
+#endif
+    };
+
+    /**
+     * @brief CPU支持的最高级别
+     */
+    static Level supported_level()
+    {
+#ifdef HTTP_SCAN_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+            return AVX2;
+        if(__builtin_cpu_supports("sse4.2"))
+            return SSE42;
+#endif
+        return SCALAR;
+    }
+
+    // 静态初始化时选择一次; setLevel只在测试中使用
+    static const Impl* impl = &impls[supported_level()];
+
+    Level level()
+    {
+        return impl->level;
+    }
+
+    Level setLevel(Level level)
+    {
+        Level max = supported_level();
+        impl = &impls[level < max ? level : max];
+        return impl->level;
+    }
+
+    const char* findNewline(const char* p, const char* end)
+    {
+        return impl->find_newline(p, end);
+    }
+
+    const char* skipToken(const char* p, const char* end)
+    {
+        return impl->skip_token(p, end);
+    }
+
+    const char* skipTarget(const char* p, const char* end)
+    {
+        return impl->skip_target(p, end);
+    }
+}
+}
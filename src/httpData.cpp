@@ -1,267 +1,519 @@
 #include "httpData.h"
 #include "util/util.h"
-#include "timer.h"
+#include "timer/thr_timer.h"
+#include "util/singleton.h"
+#include "http/file_cache.h"
+#include "http/http_compress.h"
+#include "log/log.h"
+#include "errmsg/my_errno.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/sendfile.h>
+#include <cstdint>
 #include <cstring>
 
 using namespace std;
-// 对EAGAIN这样的错误尝试超过一定的次数就抛弃
-const int AGAIN_MAX_TIMES = 5;
-extern const uint64_t TIMEOUT = 30000; // 要设置和main.cpp中的一样
-extern TimerManager timerQueue;    // 所有计时器
+using WebServer::HttpRequestParser;
+using WebServer::HttpHeader;
+using WebServer::HttpSpan;
+using WebServer::HttpChunkedDecoder;
+using WebServer::StaticFileCache;
+namespace http_conditional = WebServer::http_conditional;
+static Logger::ptr g_logger = LOG_NAME("system");
+// 长连接的空闲超时(毫秒)
+static uint64_t TIMEOUT = 30000;
+// 还没发送的响应超过该大小时, 暂停处理新的请求
+static const size_t OUTPUT_HIGH_WATER = 256 * 1024;
+// 接收缓冲区剩余空间少于该大小时先扩容再读
+static const size_t READ_MIN = 1024;
+// multipart/byteranges的分隔符
+#define BYTERANGES_BOUNDARY "WebServerByteRangesBoundary"
+
+// path中是否有".."路径段
+static bool has_dot_dot_segment(const char* path, size_t len)
+{
+    for(size_t i = 0; i + 1 < len; ++i)
+    {
+        if(path[i] == '.' && path[i + 1] == '.' && (i == 0 || path[i - 1] == '/') && (i + 2 == len || path[i + 2] == '/'))
+            return true;
+    }
+    return false;
+}
 
 httpData::httpData()
     : httpData(-1, "/")
 {}
 
 // 初始化列表的顺序必须和class的变量申明顺序一致
-httpData::httpData(int cfd, string resource)
-        : againTime(0),clientFd(cfd),
+httpData::httpData(int cfd, string resource, WebServer::BufferPool* pool)
+        : clientFd(cfd), content(pool), output(pool), arena(pool),
           method(httpMethod::ERROR),h_major(-1), h_minor(-1),
-          parseState(ParseRequest::PARSESTARTLINE),isKeepAlive(false),
-          resPath(resource), timer(nullptr)
-{}
+          parseState(ParseRequest::PARSEHEADERS),isKeepAlive(false),
+          resPath(resource), reqStart(0), isChunked(false), bodyLength(0), bodyReceived(0), bytesSent(0)
+{
+    thr_timer_init(&idleTimer.timer, nullptr, nullptr);
+    idleTimer.loop = nullptr;
+    idleTimer.conn = this;
+}
 
 httpData::~httpData()
 {}
 
-ParseResult httpData::parse_StartLine()
+ParseResult httpData::parse_Headers()
 {
-    string::size_type pos = content.find("\r\n");
-    if(pos == string::npos)
-        return ParseResult::AGAIN;
-    // 得到请求行
-    string request_line = content.substr(0 ,pos);
-    content.erase(0, pos + 2);// \r\n可以删除了
-
-    // 分析请求行
-    // http method
-    string md;
-    size_t i = 0;
-    while(i < request_line.size() && request_line[i] != ' ')
-        md += request_line[i++];
-    if(md == "GET")
-        method = httpMethod::GET;
-    else if(md == "POST")
-        method = httpMethod::POST;
-    else if(md == "HEAD")
-        method = httpMethod::HEAD;
-    else
+    HttpRequestParser::Status status = parser.parse(content.data(), content.size());
+    if(status == HttpRequestParser::AGAIN)
+        return ParseResult::AGAIN;// 数据不完整
+    if(status == HttpRequestParser::ERROR)
         return ParseResult::ERROR;
 
+    const char* buf = content.data();
+    // http method, 区分大小写
+    static const struct
+    {
+        const char* name;
+        httpMethod method;
+    } methods[] = {
+        {"GET", httpMethod::GET},
+        {"POST", httpMethod::POST},
+        {"HEAD", httpMethod::HEAD},
+        {"OPTIONS", httpMethod::OPTIONS},
+        {"DELETE", httpMethod::DELETE},
+        {"PUT", httpMethod::PUT},
+        {"TRACE", httpMethod::TRACE},
+        {"PATCH", httpMethod::PATCH},
+        {"CONNECT", httpMethod::CONNECT},
+    };
+    const HttpSpan& md = parser.method();
+    method = httpMethod::ERROR;
+    for(const auto& item : methods)
+    {
+        if(strlen(item.name) == md.len && memcmp(item.name, md.data(buf), md.len) == 0)
+        {
+            method = item.method;
+            break;
+        }
+    }
+
+    // HTTP版本号
+    h_major = parser.versionMajor();
+    h_minor = parser.versionMinor();
+
     // url
-    url = resPath;
-    if(i == request_line.size())
-        return ParseResult::ERROR;
-    ++i;
-    if(request_line[i] != '/')
+    const HttpSpan& target = parser.target();
+    const char* path = target.data(buf);
+    if(path[0] != '/')
         return ParseResult::ERROR;
-    while(request_line[i] != ' ' && i < request_line.size())
-        url.push_back(request_line[i++]);
-    // 看下是否有查询字符串, 也就是额外的参数
-    pos = url.find('?');
-    if(pos != string::npos)
-        url = url.substr(0, pos); // 这里选择忽略额外参数
+    // 看下是否有查询字符串, 也就是额外的参数; 这里选择忽略额外参数
+    const char* query = (const char*)memchr(path, '?', target.len);
+    url = resPath;
+    url.append(path, query ? query - path : target.len);
     // 目录
     if(url.back() == '/')
         url += "index.html";
 
-    // HTTP版本号
-    string ver = request_line.substr(i + 1);
-    if(ver.size() != 8)
-        return ParseResult::ERROR;
-    ver = ver.substr(5);
-    if(ver.size() != 3)
-        return ParseResult::ERROR;
-    h_major = ver[0] - '0';
-    if(ver[1] != '.')
-        return ParseResult::ERROR;
-    h_minor = ver[2] - '0';
-    //  下一个状态, 解析头部字段
-    return ParseResult::SUCCESS;
-}
+    // 确定body的长度: Transfer-Encoding优先于Content-Length(RFC 7230 3.3.3)
+    const HttpHeader* item = parser.findHeader(buf, "Transfer-Encoding");
+    if(item)
+    {
+        // 只支持最后一个编码是chunked
+        const char* value = item->value.data(buf);
+        const char* last = value + item->value.len;
+        while(last > value && last[-1] != ',' && last[-1] != ' ' && last[-1] != '\t')
+            --last;
+        HttpSpan coding = {(uint32_t)(last - buf), (uint32_t)(value + item->value.len - last)};
+        if(!HttpRequestParser::equalsIgnoreCase(buf, coding, "chunked"))
+            return ParseResult::ERROR;
+        // 同时有Content-Length: 前后的代理可能按不同的字段确定body的长度(请求走私), 直接拒绝(RFC 9112 6.1)
+        if(parser.findHeader(buf, "Content-Length"))
+            return ParseResult::ERROR;
+        isChunked = true;
+        return ParseResult::SUCCESS;
+    }
 
-ParseResult httpData::parse_Headers()
-{
-    while(true)
+    item = parser.findHeader(buf, "Content-Length");
+    if(item)
     {
-        string::size_type pos = content.find("\r\n");
-        if(pos == string::npos)
-            return ParseResult::AGAIN;// 数据不完整
-        string tmp(content.substr(0, pos));
-        content.erase(0, pos + 2);// 从content删掉这一行, \r\n也删掉
-        // 碰到空行, 头部解析完成
-        if(tmp.empty())
-            return ParseResult::SUCCESS;
-        else
+        if(item->value.empty())
+            return ParseResult::ERROR;
+        const char* p = item->value.data(buf);
+        size_t len = 0;
+        for(uint32_t i = 0; i < item->value.len; ++i)
         {
-            pos = tmp.find(':');
-            if(pos == string::npos)
-                break;// 格式错误
-            string key = tmp.substr(0, pos);
-            string value = tmp.substr(pos+2);
-            headerMap.insert(pair<string,string>(key, value));
+            if(p[i] < '0' || p[i] > '9')
+                return ParseResult::ERROR;
+            size_t d = p[i] - '0';
+            // 溢出之后长度会变小, 剩下的body会被当成下一个请求
+            if(len > (SIZE_MAX - d) / 10)
+                return ParseResult::ERROR;
+            len = len * 10 + d;
         }
+        bodyLength = len;
     }
-    return ParseResult::ERROR;
+    return ParseResult::SUCCESS;
 }
 
 ParseResult httpData::parse_Body()
 {
-    // 首先确定有没有body
-    auto item = headerMap.find("Content-Length");
-    if(item == headerMap.end())
-        return ParseResult::ERROR;
-    size_t len = stoi(item->second);
-    if(content.size() < len)
+    // body从头部之后开始; 收到的body数据马上交给onBody, 然后从content中删除,
+    // 所以content中只会有还没处理的body数据(以及之后的流水线请求)
+    size_t bodyStart = parser.headerEnd();
+    if(isChunked)
+    {
+        size_t size = content.size() - bodyStart;
+        size_t left = 0;
+        HttpChunkedDecoder::Status status = chunkedDecoder.decode(&content[bodyStart], &size, &left);
+        if(status == HttpChunkedDecoder::ERROR)
+            return ParseResult::ERROR;
+        onBody(content.data() + bodyStart, size);
+        // 去掉已经解码的body数据, 只留下属于下一个请求的数据
+        content.truncate(bodyStart + size + left);
+        content.erase(bodyStart, size);
+        if(status == HttpChunkedDecoder::AGAIN)
+            return ParseResult::AGAIN;
+        return ParseResult::SUCCESS;
+    }
+
+    size_t avail = content.size() - bodyStart;
+    if(avail > bodyLength - bodyReceived)
+        avail = bodyLength - bodyReceived;
+    onBody(content.data() + bodyStart, avail);
+    content.erase(bodyStart, avail);
+    if(bodyReceived < bodyLength)
         return ParseResult::AGAIN;
-    // body内容都在content中了
+    // body已经全部收到
     return ParseResult::SUCCESS;
 }
 
-SendResult httpData::sendResponse()
+void httpData::onBody(const char* data, size_t len)
 {
-    char send_header[4096] = "HTTP/1.1 200 OK\r\n";
-    // 长连接
-    // keep-alive写成keep_alive导致设置长连接失败,注意格式
-    if(headerMap.find("Connection") != headerMap.end() && headerMap["Connection"] == "keep-alive")
-    {
-        this->isKeepAlive = true;
-        sprintf(send_header, "%sConnection: keep-alive\r\n", send_header);
-        sprintf(send_header, "%sKeep-Alive: timeout=%lu\r\n", send_header, TIMEOUT/1000);
-    }
+    // 目前只统计body的长度, 不保存body数据
+    (void)data;
+    bodyReceived += len;
+}
+
+void httpData::setKeepAliveTimeout(uint64_t ms)
+{
+    TIMEOUT = ms;
+}
+
+uint64_t httpData::keepAliveTimeout()
+{
+    return TIMEOUT;
+}
+
+// 长连接
+// keep-alive写成keep_alive导致设置长连接失败,注意格式
+const string& httpData::keepAliveHeaders()
+{
+    // 空闲超时为0表示不关闭空闲连接, 这时不发送Keep-Alive, 否则告诉客户端实际配置的超时
+    static const string headers = TIMEOUT == 0 ? string("Connection: keep-alive\r\n")
+                                  : "Connection: keep-alive\r\nKeep-Alive: timeout=" + to_string(TIMEOUT / 1000) + "\r\n";
+    return headers;
+}
+
+void httpData::appendConnection()
+{
+    if(isKeepAlive)
+        output.append(keepAliveHeaders());
     else
+        output.appendHeader("Connection", "close");
+}
+
+SendResult httpData::sendResponse()
+{
+    // HTTP/1.1默认是长连接, 除非Connection: close; HTTP/1.0只有Connection: keep-alive才是长连接
+    const HttpHeader* connection = parser.findHeader(content.data(), "Connection");
+    bool http11 = h_major > 1 || (h_major == 1 && h_minor >= 1);
+    isKeepAlive = http11;
+    if(connection)
     {
-        this->isKeepAlive = false;
-        sprintf(send_header, "%sConnection: close\r\n", send_header);
+        if(HttpRequestParser::equalsIgnoreCase(content.data(), connection->value, "keep-alive"))
+            isKeepAlive = true;
+        else if(HttpRequestParser::equalsIgnoreCase(content.data(), connection->value, "close"))
+            isKeepAlive = false;
     }
 
     // 处理GET和POST
     if(method == httpMethod::POST)
     {
-        char send_content[4096] = "I have recv this!";
-        sprintf(send_header, "%sContent-Type: text/plain\r\n", send_header);
-        sprintf(send_header, "%sContent-Length: %zu\r\n", send_header, strlen(send_content));
-        // 加上空行
-        sprintf(send_header, "%s\r\n%s", send_header, send_content);
-        // 发送头部
-        int sendLen = util::writen(clientFd, send_header, strlen(send_header));
-        if((size_t)sendLen != strlen(send_header))
-            return SendResult::ERROR;
-
-        // 发送body
-        sendLen = util::writen(clientFd, send_content, strlen(send_content));
-        if((size_t)sendLen != strlen(send_content))
-            return SendResult::ERROR;
-        printf("成功接收POST请求! 内容: %s\n", content.data());
+        static const char send_content[] = "I have recv this!";
+        output.appendStatus(200);
+        appendConnection();
+        output.appendHeader("Content-Type", "text/plain");
+        output.appendHeader("Content-Length", (uint64_t)(sizeof(send_content) - 1));
+        output.appendEnd();
+        // body是常量, 不需要拷贝
+        output.appendRef(send_content, sizeof(send_content) - 1);
+        LOG_DEBUG(g_logger) << "POST body received, length " << bodyReceived << (isChunked ? " (chunked)" : "");
     }
     else if(method == httpMethod::GET || method == httpMethod::HEAD)
     {
-        size_t dot_pos = url.find('.');
-        string fileType;
-        if(dot_pos == string::npos)
-            fileType = util::getMimeType("default");// 无后缀, 当作文本文件展示
-        else
-            fileType = util::getMimeType(url.substr(dot_pos));
-        // 先判断文件是否存在
-        if(access(url.data(), F_OK) == -1)
-            return SendResult::NOTFOUND;
-        // 获取文件大小
-        struct stat statbuf;
-        if(-1 == stat(url.data(), &statbuf))
-            return SendResult::NOTFOUND;
-        sprintf(send_header, "%sContent-Type: %s\r\n", send_header, fileType.data());
-        sprintf(send_header, "%sContent-Length: %ld\r\n", send_header, statbuf.st_size);
-        sprintf(send_header, "%s\r\n", send_header);// 空行, 头部结束
-
-        // 发送头部
-        size_t send_len = util::writen(clientFd, send_header, strlen(send_header));
-        if(send_len != strlen(send_header))
-            return SendResult::ERROR;
-        // 如果是HEAD请求的话,只要发送头部
-        if(method == httpMethod::GET)
-        {// 发送body, 也就是发送文件内容
-            int fd = open(url.data(), O_RDONLY);
-            int ret = sendfile(clientFd, fd, nullptr, statbuf.st_size);
-            if (ret != statbuf.st_size)
-                return SendResult::ERROR;
-        }
+        // 不允许用".."访问资源文件夹之外的文件
+        if(has_dot_dot_segment(url.data() + resPath.size(), url.size() - resPath.size()))
+            return SendResult::FORBIDDEN;
+        // 普通文件从缓存中取: 命中时不需要stat()/open(), 头部字段也是事先拼好的
+        StaticFileCache::Entry::ptr file = Singleton<StaticFileCache>::getInstance().get(url);
+        if(file)
+            return sendFile(file);
+        // 管道, 字符设备等不是普通文件, 不发送(读它们可能阻塞事件循环, 或者永远读不完)
+        if(errno == EINVAL)
+            return SendResult::FORBIDDEN;
+        // 不存在或者是目录
+        return SendResult::NOTFOUND;
     }
     else
     {
-        printf("get, post之外的http method, 没有实现\n");
+        LOG_DEBUG(g_logger) << "http method not implemented: " << string(parser.method().data(content.data()), parser.method().len);
         return SendResult::NOTIMPL;
     }
     return SendResult::SUCCESS;
 }
 
+SendResult httpData::sendFile(StaticFileCache::Entry::ptr file)
+{
+    const char* buf = content.data();
+    // 客户端支持gzip时发送压缩版本(.gz文件或者缓存的压缩结果)
+    const HttpHeader* encoding = parser.findHeader(buf, "Accept-Encoding");
+    if(encoding && WebServer::http_compress::acceptsGzip(encoding->value.data(buf), encoding->value.len))
+    {
+        StaticFileCache::Entry::ptr gzip = Singleton<StaticFileCache>::getInstance().getGzip(url, file);
+        if(gzip)
+            file = gzip;
+    }
+
+    // 条件请求: 有If-None-Match时忽略If-Modified-Since(RFC 7232 3.3)
+    bool notModified = false;
+    const HttpHeader* item = parser.findHeader(buf, "If-None-Match");
+    if(item)
+        notModified = http_conditional::etagMatches(item->value.data(buf), item->value.len, file->etag);
+    else if((item = parser.findHeader(buf, "If-Modified-Since")) != nullptr)
+    {
+        time_t since = http_conditional::parseDate(item->value.data(buf), item->value.len);
+        notModified = since != -1 && file->mtime <= since;
+    }
+    if(notModified)
+    {
+        output.appendStatus(304);
+        appendConnection();
+        if(file->vary)
+            output.appendHeader("Vary", "Accept-Encoding");
+        output.appendHeader("ETag", file->etag.data(), file->etag.size());
+        output.appendHeader("Last-Modified", file->lastModified.data(), file->lastModified.size());
+        output.appendEnd();
+        return SendResult::SUCCESS;
+    }
+
+    // 范围请求, 只处理GET
+    item = method == httpMethod::GET ? parser.findHeader(buf, "Range") : nullptr;
+    if(item && ifRangeMatches(*file))
+    {
+        http_conditional::ByteRange* ranges = arena.allocArray<http_conditional::ByteRange>(http_conditional::MAX_RANGES);
+        size_t count;
+        switch(http_conditional::parseRange(item->value.data(buf), item->value.len, file->size, ranges, count))
+        {
+            case http_conditional::RANGE_OK:
+                sendRanges(*file, ranges, count);
+                output.hold(file);
+                return SendResult::SUCCESS;
+            case http_conditional::RANGE_UNSATISFIABLE:
+            {
+                size_t len;
+                const char* range = arena.format(len, "bytes */%lld", (long long)file->size);
+                output.appendStatus(416);
+                appendConnection();
+                output.appendHeader("Content-Range", range, len);
+                output.appendHeader("Content-Length", (uint64_t)0);
+                output.appendEnd();
+                return SendResult::SUCCESS;
+            }
+            case http_conditional::RANGE_NONE:
+                break;// 忽略Range, 发送整个文件
+        }
+    }
+
+    // 事先拼好的完整响应, 直接发送
+    if(isKeepAlive && !file->response.empty())
+    {
+        output.appendRef(file->response.data(),
+                         method == httpMethod::GET ? file->response.size() : file->responseHeaderLen);
+        output.hold(file);
+        return SendResult::SUCCESS;
+    }
+    output.appendStatus(200);
+    appendConnection();
+    output.append(file->headers);
+    output.appendEnd();// 空行, 头部结束
+    // 如果是HEAD请求的话,只要发送头部
+    if(method == httpMethod::GET)
+    {
+        // 小文件直接从内存发送, 和头部一起writev; 大文件在flush()中用缓存的fd sendfile
+        appendFileBody(*file, 0, file->size);
+        output.hold(file);
+    }
+    return SendResult::SUCCESS;
+}
+
+bool httpData::ifRangeMatches(const StaticFileCache::Entry& file)
+{
+    const HttpHeader* item = parser.findHeader(content.data(), "If-Range");
+    if(!item)
+        return true;
+    const char* value = item->value.data(content.data());
+    // 实体标签要强比较, 弱标签永远不匹配; 否则是HTTP-date, 必须和Last-Modified完全相同
+    if(item->value.len > 0 && (value[0] == '"' || value[0] == 'W'))
+        return item->value.len == file.etag.size() && memcmp(value, file.etag.data(), file.etag.size()) == 0;
+    return http_conditional::parseDate(value, item->value.len) == file.mtime;
+}
+
+void httpData::sendRanges(const StaticFileCache::Entry& file, const http_conditional::ByteRange* ranges, size_t count)
+{
+    output.appendStatus(206);
+    appendConnection();
+    if(file.gzip)
+        output.appendHeader("Content-Encoding", "gzip");
+    if(file.vary)
+        output.appendHeader("Vary", "Accept-Encoding");
+    output.appendHeader("ETag", file.etag.data(), file.etag.size());
+    output.appendHeader("Last-Modified", file.lastModified.data(), file.lastModified.size());
+
+    long long size = file.size;
+    if(count == 1)
+    {
+        const http_conditional::ByteRange& r = ranges[0];
+        size_t len;
+        const char* range = arena.format(len, "bytes %lld-%lld/%lld",
+                                         (long long)r.offset, (long long)(r.offset + r.length - 1), size);
+        output.appendHeader("Content-Type", file.mime.data(), file.mime.size());
+        output.appendHeader("Content-Range", range, len);
+        output.appendHeader("Content-Length", (uint64_t)r.length);
+        output.appendEnd();
+        appendFileBody(file, r.offset, r.length);
+        return;
+    }
+
+    // multipart/byteranges: 每个范围一个部分, 先算出总长度
+    static const char last[] = "\r\n--" BYTERANGES_BOUNDARY "--\r\n";
+    const char** parts = arena.allocArray<const char*>(count);
+    size_t* partLens = arena.allocArray<size_t>(count);
+    uint64_t total = sizeof(last) - 1;
+    for(size_t i = 0; i < count; ++i)
+    {
+        const http_conditional::ByteRange& r = ranges[i];
+        parts[i] = arena.format(partLens[i], "\r\n--" BYTERANGES_BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                                file.mime.c_str(), (long long)r.offset, (long long)(r.offset + r.length - 1), size);
+        total += partLens[i] + r.length;
+    }
+
+    output.appendHeader("Content-Type", "multipart/byteranges; boundary=" BYTERANGES_BOUNDARY);
+    output.appendHeader("Content-Length", total);
+    output.appendEnd();
+    for(size_t i = 0; i < count; ++i)
+    {
+        output.append(parts[i], partLens[i]);
+        appendFileBody(file, ranges[i].offset, ranges[i].length);
+    }
+    output.appendRef(last, sizeof(last) - 1);
+}
+
+void httpData::appendFileBody(const StaticFileCache::Entry& file, off_t offset, off_t len)
+{
+    if(file.inMemory)
+        output.appendRef(file.body() + offset, len);
+    else
+        output.appendFile(file.fd, offset, len);
+}
+
 // 处理http请求，一切的起点
 ParseRequest httpData::handleRequest()
 {
-    char buf[4096];
-    bool isError = false;
-    while(parseState != ParseRequest::FINISH){
-        // 读数据
-        int readSum = util::readn(clientFd, buf, 4096);
+    while(true)
+    {
+        // 先处理缓冲区中所有完整的请求(流水线), 响应暂存在output中
+        processRequests();
+        if(parseState == ParseRequest::FINISH || parseState == ParseRequest::ERROR)
+            break;
+
+        // 积压的响应太多: 先发送, 发不完就等待可写, 暂时不再读新的请求(客户端接收得慢, 不能无限缓存它的响应)
+        if(output.size() >= OUTPUT_HIGH_WATER)
+        {
+            if(!flush())
+            {
+                parseState = ParseRequest::ERROR;
+                break;
+            }
+            if(wantWrite())
+                break;
+        }
+
+        // 已经处理完的请求不再需要, 把剩下的不完整请求移动到缓冲区开头
+        if(reqStart > 0)
+        {
+            content.erase(0, reqStart);
+            parser.rebase(reqStart);
+            reqStart = 0;
+        }
+
+        // 读数据; fd是非阻塞的, 由事件循环在可读时调用
+        // 直接读到content的尾部, 不经过临时缓冲区; 把缓冲区剩下的空间读满, 放不下时才扩容
+        errno = 0;
+        char* p = content.prepare(READ_MIN);
+        int readSum = util::readn(clientFd, p, content.writable());
+        if(readSum > 0)
+            content.commit(readSum);
         if(readSum < 0)
         {
-            isError = true;
+            parseState = ParseRequest::ERROR;
             break;
         }
         else if(readSum == 0)
         {
-            // 有请求但是读不到数据，可能是Request Aborted, 或者是对方的数据还没有到达
+            // 对端数据还没有到达, 回到事件循环等待下一次可读事件
             if(errno == EAGAIN || errno == EWOULDBLOCK)
-            {// 到达一定次数, 就不再尝试
-                if(againTime > AGAIN_MAX_TIMES)
-                    isError = true;
-                else
-                    ++againTime;
-            }
-            else if(errno != 0)
-            {
-                isError = true;// 有错误发生
                 break;
-            }
-            else
-                break;// 对端关闭, 也会返回0
+            // 对端关闭(可能只是关闭了写端), 也会返回0; 已经收到的请求的响应还是要发出去
+            isKeepAlive = false;
+            parseState = ParseRequest::FINISH;
+            break;
         }
-        else
-            // 将读到的数据添加到content成员变量中
-            content += std::string(buf, buf + readSum);
+    }
+
+    // 收到的数据全部处理完了(最常见的情况): 接收缓冲区还给内存池, 等待下一个请求的长连接不占用缓冲区
+    if(parseState == ParseRequest::PARSEHEADERS && reqStart == content.size())
+    {
+        content.release();
+        parser.reset();
+        reqStart = 0;
+    }
 
+    // 这一轮所有请求的响应一次写出去, 发不完的部分等EPOLLOUT
+    if(!flush())
+        parseState = ParseRequest::ERROR;
+    return parseState;
+}
+
+void httpData::processRequests()
+{
+    while(true)
+    {
         // 状态机解析
-        if(this->parseState == ParseRequest::PARSESTARTLINE)
-        {// 处于解析请求头的状态
-            ParseResult flag = parse_StartLine();
-            if(flag == ParseResult::AGAIN)
-                continue; // 重新进行while循环, 再尝试一次readn
-            else if(flag == ParseResult::ERROR)
-            {
-                isError = true;
-                break;
-            }
-            else
-                parseState = ParseRequest::PARSEHEADERS;
-        }
-        // 解析头部字段
+        // 解析请求行和头部字段
         if(this->parseState == ParseRequest::PARSEHEADERS)
         {
             ParseResult flag = parse_Headers();
             if(flag == ParseResult::AGAIN)
-                continue;
+                return; // 等待更多数据
             else if(flag == ParseResult::ERROR)
             {
-                isError = true;
-                break;
+                // 不知道请求在哪里结束, 回复400之后关闭连接
+                handleError(400, "Bad Request!");
+                parseState = ParseRequest::FINISH;
+                return;
             }
             else
-            {// get请求也可以有body数据, 但是通常不建议
-                if(method == httpMethod::POST)
+            {// get请求也可以有body数据, 但是通常不建议; 无论什么方法, 有body都要先收完
+                if(isChunked || bodyLength > 0)
                     parseState = ParseRequest::PARSEBODY;
                 else
                     parseState = ParseRequest::SENDRESPONE;
@@ -272,11 +524,11 @@ ParseRequest httpData::handleRequest()
         {
             ParseResult flag = parse_Body();
             if(flag == ParseResult::AGAIN)
-                continue;
+                return;
             else if(flag == ParseResult::ERROR)
             {
-                isError = true;
-                break;
+                parseState = ParseRequest::ERROR;
+                return;
             }
             else
                 parseState = ParseRequest::SENDRESPONE;
@@ -288,60 +540,112 @@ ParseRequest httpData::handleRequest()
             switch (flag)
             {
                 case SendResult::SUCCESS:
-                    parseState = ParseRequest::FINISH;
                     break;
                 case SendResult::NOTFOUND:
-                    perror("sendResponse");
+                    LOG_DEBUG(g_logger) << "not found: " << url;
                     handleError(404, "Not Found!");
+                    isKeepAlive = false;// handleError回复的是Connection: close
+                    break;
+                case SendResult::FORBIDDEN:
+                    handleError(403, "Forbidden!");
+                    isKeepAlive = false;
                     break;
                 case SendResult::NOTIMPL:
                     handleError(501, "Not Implemented!");
+                    isKeepAlive = false;
                     break;
                 case SendResult::ERROR:
-                    perror("sendResponse");
-                    isError = true;
-                    break;
+                    LOG_WARN(g_logger) << "send response failed: " << my_strerror(errno);
+                    parseState = ParseRequest::ERROR;
+                    return;
             }
-            break;
+            if(!isKeepAlive)
+            {
+                parseState = ParseRequest::FINISH;
+                return;
+            }
+            // 长连接: 继续处理缓冲区中的下一个请求
+            nextRequest();
         }
     }
-    if(isError)
-        return ParseRequest::ERROR;
-    if(isKeepAlive)
-        return ParseRequest::KEEPALIVE;
-    return parseState;
 }
 
-void httpData::handleError(int statusCode, std::string short_msg)
+void httpData::nextRequest()
+{
+    // body数据在parse_Body中已经从content中删除了, 下一个请求紧跟在头部之后
+    reqStart = parser.headerEnd();
+    method = httpMethod::ERROR;
+    parseState = ParseRequest::PARSEHEADERS;
+    url.clear();
+    this->h_major = this->h_minor = -1;
+    isKeepAlive = false;
+    parser.reset(reqStart);
+    arena.reset();
+    isChunked = false;
+    bodyLength = 0;
+    bodyReceived = 0;
+    chunkedDecoder.reset();
+}
+
+bool httpData::flush()
+{
+    size_t pending = output.size();
+    WebServer::HttpResponseBuilder::Status status = output.flush(clientFd);
+    bytesSent += pending - output.size();
+    if(status == WebServer::HttpResponseBuilder::ERROR)
+    {
+        output.clear();
+        return false;
+    }
+    // 发送缓冲区满了(AGAIN), 剩下的数据(包括文件的偏移)保留在output中
+    return true;
+}
+
+ParseRequest httpData::handleWrite()
 {
-    short_msg = " " + short_msg;
-    string body =
+    if(!flush())
+        return parseState = ParseRequest::ERROR;
+    if(wantWrite() || parseState == ParseRequest::FINISH)
+        return parseState;
+    // 全部发送完了, 继续处理之前因为等待发送而暂停的请求
+    return handleRequest();
+}
+
+void httpData::handleError(int statusCode, const char* short_msg)
+{
+    size_t len;
+    const char* body = arena.format(len,
             "<html>"
             "   <title>Error</title>"
-            "   <body><h1>";
-    body += to_string(statusCode) + short_msg+ "<h1/>";
-    body += "       <hr><em> Linglong's Web Server</em>"
+            "   <body><h1>%d %s<h1/>"
+            "       <hr><em> Linglong's Web Server</em>"
             "   </body>"
-            "</html>";
-
-    string header;
-    header += "HTTP/1.1 " + to_string(statusCode) + short_msg + "\r\n";
-    header += "Content-type: text/html\r\n";
-    header += "Connection: close\r\n";
-    header += "Content-length: " + to_string(body.size()) + "\r\n";
-    header += "\r\n";
+            "</html>", statusCode, short_msg);
 
-    util::writen(clientFd, header.data(), header.size());// 写入header
-    util::writen(clientFd, body.data(), body.size());// 写入body
+    output.appendStatus(statusCode);
+    output.appendHeader("Content-Type", "text/html");
+    output.appendHeader("Connection", "close");
+    output.appendHeader("Content-Length", (uint64_t)len);
+    output.appendEnd();
+    // 和其它响应一起发送; body在arena中, 要拷贝
+    output.append(body, len);
 }
 
 void httpData::reset()
 {
-    againTime = 0;
-    content.clear();
+    content.release();
+    output.clear();
+    reqStart = 0;
     method = httpMethod::ERROR;
-    parseState = ParseRequest::PARSESTARTLINE;
+    parseState = ParseRequest::PARSEHEADERS;
     url.clear();
     this->h_major = this->h_minor = -1;
-    headerMap.clear();
+    isKeepAlive = false;
+    parser.reset();
+    arena.reset();
+    isChunked = false;
+    bodyLength = 0;
+    bodyReceived = 0;
+    chunkedDecoder.reset();
+    bytesSent = 0;
 }
\ No newline at end of file
@@ -0,0 +1,414 @@
+#include "net/eventloop.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "errmsg/my_errno.h"
+#include "log/log.h"
+#include "httpData.h"
+#include "util/util.h"
+
+#define LOOP_EVENT_MAX  1024
+// 收发缓冲区的块大小, 以及每次向系统申请的块数
+#define LOOP_BUFFER_SIZE        (8 * 1024)
+#define LOOP_BUFFERS_PER_SLAB   32
+// 最多保留的空闲连接对象, 连接数的高峰过去之后多出来的对象释放掉
+#define LOOP_FREE_CONN_MAX      4096
+// 定时器队列的初始大小, 不够时每次再扩大这么多(只有时间堆使用)
+#define LOOP_TIMER_QUEUE_SIZE   1024
+// epoll_event.data.ptr的特殊取值, 其余取值都是httpData指针
+#define LOOP_WAKEUP_TAG ((void*)0)
+#define LOOP_LISTEN_TAG ((void*)1)
+#define LOOP_TIMER_TAG  ((void*)2)
+
+namespace WebServer
+{
+    static Logger::ptr g_logger = LOG_NAME("system");
+
+    EventLoop::EventLoop(const std::string& resPath, uint64_t idleTimeout, uint64_t timerSlack)
+        : m_epollFd(-1), m_wakeupFd(-1), m_listenFd(-1), m_quit(false), m_resPath(resPath),
+          m_timers(nullptr), m_idleTimeout(idleTimeout), m_bufferPool(LOOP_BUFFER_SIZE, LOOP_BUFFERS_PER_SLAB)
+    {
+        m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if(m_epollFd == -1)
+        {
+            LOG_ERROR(g_logger) << "epoll_create1 failed: " << my_strerror(errno);
+            throw std::logic_error("epoll_create1 failed!");
+        }
+
+        m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(m_wakeupFd == -1)
+        {
+            LOG_ERROR(g_logger) << "eventfd failed: " << my_strerror(errno);
+            close(m_epollFd);
+            throw std::logic_error("eventfd failed!");
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = LOOP_WAKEUP_TAG;
+        if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeupFd, &ev) == -1)
+        {
+            LOG_ERROR(g_logger) << "epoll_ctl add eventfd failed: " << my_strerror(errno);
+            close(m_wakeupFd);
+            close(m_epollFd);
+            throw std::logic_error("epoll_ctl failed!");
+        }
+
+        // 每个连接一个空闲定时器, 而且每次处理完事件都要重新设置: 用时间轮, 添加/删除都是O(1);
+        // 只在本线程中使用, 不需要工作线程和锁; 到期由CLOCK_MONOTONIC的timerfd通知, 不受修改系统时间影响
+        if(m_idleTimeout > 0)
+        {
+            m_timers = new TimerManager(LOOP_TIMER_QUEUE_SIZE, TimerManager::WHEEL, false);
+            m_timers->setSlack(timerSlack * 1000);
+            int timer_fd = m_timers->timerFd();
+            ev.events = EPOLLIN;
+            ev.data.ptr = LOOP_TIMER_TAG;
+            if(timer_fd == -1 || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, timer_fd, &ev) == -1)
+            {
+                LOG_ERROR(g_logger) << "register timerfd failed: " << my_strerror(errno);
+                delete m_timers;
+                close(m_wakeupFd);
+                close(m_epollFd);
+                throw std::logic_error("timerfd failed!");
+            }
+        }
+    }
+
+    EventLoop::~EventLoop()
+    {
+        for(httpData* conn : m_connections)
+        {
+            if(!conn)
+                continue;
+            if(m_timers)
+                m_timers->removeTimer(&conn->idleTimer.timer);
+            close(conn->getFd());
+            delete conn;
+        }
+        m_connections.clear();
+        for(httpData* conn : m_freeConns)
+            delete conn;
+        m_freeConns.clear();
+        for(int fd : m_pendingFds)
+            close(fd);
+        m_pendingFds.clear();
+
+        if(m_listenFd != -1)
+            close(m_listenFd);
+        close(m_wakeupFd);
+        close(m_epollFd);
+        delete m_timers;
+    }
+
+    void EventLoop::loop()
+    {
+        struct epoll_event events[LOOP_EVENT_MAX];
+        while(!m_quit)
+        {
+            int nevents = epoll_wait(m_epollFd, events, LOOP_EVENT_MAX, -1);
+            if(nevents == -1)
+            {
+                if(errno != EINTR)
+                    LOG_WARN(g_logger) << "epoll_wait failed: " << my_strerror(errno);
+                nevents = 0;
+            }
+
+            bool timersDue = false;
+            for(int i = 0; i < nevents; ++i)
+            {
+                void* ptr = events[i].data.ptr;
+                if(ptr == LOOP_TIMER_TAG)
+                    timersDue = true;
+                else if(ptr == LOOP_WAKEUP_TAG)
+                    _handleWakeup();
+                else if(ptr == LOOP_LISTEN_TAG)
+                    _handleAccept();
+                else
+                    _handleConnection((httpData*)ptr, events[i].events);
+            }
+            // 最后再执行到期的定时器: 回调会关闭连接, 不能让events中后面的事件用到已经关闭的连接;
+            // 而且刚刚有数据到来的连接已经重新设置过定时器, 不会被误关
+            if(timersDue)
+                m_timers->processTimers();
+        }
+    }
+
+    void EventLoop::quit()
+    {
+        m_quit = true;
+        _wakeup();
+    }
+
+    int EventLoop::listen(int listen_fd)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = LOOP_LISTEN_TAG;
+        if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, listen_fd, &ev) == -1)
+            return -1;
+        m_listenFd = listen_fd;
+        return 0;
+    }
+
+    void EventLoop::unlisten()
+    {
+        if(m_listenFd == -1)
+            return;
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, m_listenFd, nullptr);
+        close(m_listenFd);
+        m_listenFd = -1;
+    }
+
+    void EventLoop::queueConnection(int fd)
+    {
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+            m_pendingFds.push_back(fd);
+        }
+        _wakeup();
+    }
+
+    void EventLoop::_wakeup()
+    {
+        uint64_t one = 1;
+        if(write(m_wakeupFd, &one, sizeof(one)) != sizeof(one))
+            LOG_WARN(g_logger) << "wakeup event loop failed: " << my_strerror(errno);
+    }
+
+    void EventLoop::_handleWakeup()
+    {
+        uint64_t cnt;
+        if(read(m_wakeupFd, &cnt, sizeof(cnt)) != sizeof(cnt) && errno != EAGAIN)
+            LOG_WARN(g_logger) << "read eventfd failed: " << my_strerror(errno);
+
+        // 先把待注册的fd全部拿出来, 减少持锁时间
+        std::vector<int> fds;
+        {
+            WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
+            fds.swap(m_pendingFds);
+        }
+        for(int fd : fds)
+            _addConnection(fd);
+    }
+
+    void EventLoop::_handleAccept()
+    {
+        // 一直重复尝试接收新连接, 直到没有新连接为止; 其它事件循环的listening socket互不影响
+        while(true)
+        {
+            struct sockaddr_storage client_addr;
+            socklen_t len = sizeof(client_addr);
+            int fd = accept4(m_listenFd, (struct sockaddr*)&client_addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd == -1)
+            {
+                if(errno == EINTR)
+                    continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    LOG_WARN(g_logger) << "accept failed: " << my_strerror(errno);
+                break;
+            }
+            _addConnection(fd);
+        }
+    }
+
+    void EventLoop::_addConnection(int fd)
+    {
+        httpData* conn;
+        if(m_freeConns.empty())
+            conn = new httpData(fd, m_resPath, &m_bufferPool);
+        else
+        {
+            conn = m_freeConns.back();
+            m_freeConns.pop_back();
+            conn->setFd(fd);
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            LOG_WARN(g_logger) << "epoll_ctl add fd " << fd << " failed: " << my_strerror(errno);
+            close(fd);
+            _releaseConnection(conn);
+            return;
+        }
+        if((size_t)fd >= m_connections.size())
+            m_connections.resize(fd + 1, nullptr);
+        m_connections[fd] = conn;
+        // 定时器只在连接关闭时移除, 这里一定不在队列中
+        thr_timer_init(&conn->idleTimer.timer, _onIdleTimeout, &conn->idleTimer);
+        conn->idleTimer.loop = this;
+        _armIdleTimer(conn);
+    }
+
+    void EventLoop::_handleConnection(httpData* conn, uint32_t events)
+    {
+        // 有没发送完的响应时只关注EPOLLOUT; 事件循环注册的事件总是和调用之前的wantWrite()一致
+        bool writing = conn->wantWrite();
+        uint64_t sent = conn->getBytesSent();
+        ParseRequest state = writing ? conn->handleWrite() : conn->handleRequest();
+        if(state == ParseRequest::ERROR || (writing && (events & (EPOLLERR | EPOLLHUP))))
+        {
+            _closeConnection(conn);
+            return;
+        }
+
+        if(conn->wantWrite())
+        {
+            // 发送缓冲区满了: 等可写之后从停下的位置继续发送, 不占用线程等待; 此时不再读新的请求
+            // 只关注EPOLLOUT: EPOLLRDHUP是水平触发的, 客户端关闭写端之后不接收数据时epoll_wait会一直返回
+            if(!writing && !_updateConnection(conn, EPOLLOUT))
+                return;
+            // 客户端一直不接收数据也算空闲, 只有真的发送出了数据才重新计时
+            if(!writing || conn->getBytesSent() != sent)
+                _armIdleTimer(conn);
+            return;
+        }
+        if(state == ParseRequest::FINISH)
+        {
+            // 响应已经全部发送, 可以关闭了
+            _closeConnection(conn);
+            return;
+        }
+        // 长连接, 或者请求还不完整, 等待下一次可读事件
+        if(writing && !_updateConnection(conn, EPOLLIN | EPOLLRDHUP))
+            return;
+        _armIdleTimer(conn);
+    }
+
+    bool EventLoop::_updateConnection(httpData* conn, uint32_t events)
+    {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = conn;
+        if(epoll_ctl(m_epollFd, EPOLL_CTL_MOD, conn->getFd(), &ev) == -1)
+        {
+            LOG_WARN(g_logger) << "epoll_ctl mod fd " << conn->getFd() << " failed: " << my_strerror(errno);
+            _closeConnection(conn);
+            return false;
+        }
+        return true;
+    }
+
+    void EventLoop::_closeConnection(httpData* conn)
+    {
+        int fd = conn->getFd();
+        // 之后对象会被重新使用或者释放, 定时器必须先从队列中移除
+        if(m_timers)
+            m_timers->removeTimer(&conn->idleTimer.timer);
+        epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        m_connections[fd] = nullptr;
+        _releaseConnection(conn);
+    }
+
+    void EventLoop::_releaseConnection(httpData* conn)
+    {
+        if(m_freeConns.size() >= LOOP_FREE_CONN_MAX)
+        {
+            delete conn;
+            return;
+        }
+        // 缓冲区还给内存池, 对象留着给下一个连接
+        conn->reset();
+        conn->setFd(-1);
+        m_freeConns.push_back(conn);
+    }
+
+    void EventLoop::_armIdleTimer(httpData* conn)
+    {
+        if(!m_timers)
+            return;
+        thr_timer_t* timer = &conn->idleTimer.timer;
+        m_timers->removeTimer(timer);
+        if(!m_timers->addTimer(timer, m_idleTimeout * 1000))
+            LOG_WARN(g_logger) << "add idle timer for fd " << conn->getFd() << " failed";
+    }
+
+    void EventLoop::_onIdleTimeout(void* arg)
+    {
+        // 事件循环线程, 定时器已经不在队列中了, 直接关闭连接
+        httpData::IdleTimer* t = (httpData::IdleTimer*)arg;
+        LOG_DEBUG(g_logger) << "close idle connection fd " << t->conn->getFd();
+        t->loop->_closeConnection(t->conn);
+    }
+
+
+    EventLoopThreadPool::EventLoopThreadPool(int loop_count, const std::string& resPath, uint64_t idle_timeout, uint64_t timer_slack)
+        : m_next(0)
+    {
+        if(loop_count <= 0)
+            loop_count = 1;
+        for(int i = 0; i < loop_count; ++i)
+            m_loops.push_back(new EventLoop(resPath, idle_timeout, timer_slack));
+    }
+
+    void EventLoopThreadPool::start()
+    {
+        std::string name = "loop_";
+        for(size_t i = 0; i < m_loops.size(); ++i)
+        {
+            EventLoop* loop = m_loops[i];
+            m_threads.push_back(std::make_shared<Thread>([loop](){ loop->loop(); }, name + std::to_string(i)));
+        }
+    }
+
+    EventLoopThreadPool::~EventLoopThreadPool()
+    {
+        stop();
+    }
+
+    EventLoop* EventLoopThreadPool::getNextLoop()
+    {
+        EventLoop* loop = m_loops[m_next];
+        if(++m_next == m_loops.size())
+            m_next = 0;
+        return loop;
+    }
+
+    int EventLoopThreadPool::listenReusePort(unsigned short port, int backlog)
+    {
+        // 事件循环的线程还没有启动, 直接修改它们的状态不需要同步
+        for(size_t i = 0; i < m_loops.size(); ++i)
+        {
+            int listen_fd = util::socket_bind_listen(port, backlog, true);
+            if(listen_fd != -1 && (util::set_nonblock(listen_fd) == -1 || m_loops[i]->listen(listen_fd) == -1))
+            {
+                int err = errno;
+                close(listen_fd);
+                errno = err;
+                listen_fd = -1;
+            }
+            if(listen_fd == -1)
+            {
+                // 已经创建的也全部关闭, 不能只有一部分事件循环在监听
+                int err = errno;
+                for(size_t j = 0; j < i; ++j)
+                    m_loops[j]->unlisten();
+                errno = err;
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    void EventLoopThreadPool::stop()
+    {
+        for(EventLoop* loop : m_loops)
+            loop->quit();
+        for(Thread::ptr& t : m_threads)
+            t->join();
+        m_threads.clear();
+
+        for(EventLoop* loop : m_loops)
+            delete loop;
+        m_loops.clear();
+    }
+}
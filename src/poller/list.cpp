@@ -64,13 +64,13 @@ void ListDel(struct list_head* entry)
 
 void ListMove(struct list_head* node, struct list_head* head)
 {
-    __ListDel(node->prev, node->prev);
+    __ListDel(node->prev, node->next);
     ListAdd(node, head);
 }
 
 void ListMoveTail(struct list_head* node, struct list_head* head)
 {
-    __ListDel(node->prev, node->prev);
+    __ListDel(node->prev, node->next);
     ListAddTail(node, head);
 }
 
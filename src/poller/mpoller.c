@@ -0,0 +1,93 @@
+#include "poller/mpoller.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+
+static int __mpoller_create(const struct poller_params *params, mpoller_t *mpoller)
+{
+    unsigned int i;
+
+    for(i = 0; i < mpoller->nthreads; ++i)
+    {
+        // 每个poller只负责fd % nthreads == i的fd, nodes数组只需要原来的1/nthreads
+        mpoller->poller[i] = __poller_create_slice(params, mpoller->nthreads);
+        if(!mpoller->poller[i])
+            break;
+    }
+
+    if(i == mpoller->nthreads)
+        return 0;
+
+    while(i > 0)
+        poller_destroy(mpoller->poller[--i]);
+
+    return -1;
+}
+
+mpoller_t *mpoller_create(const struct poller_params *params, size_t nthreads)
+{
+    mpoller_t *mpoller;
+    size_t size;
+
+    if(nthreads == 0)
+        nthreads = 1;
+
+    size = offsetof(mpoller_t, poller) + nthreads * sizeof(void *);
+    mpoller = (mpoller_t *)malloc(size);
+    if(mpoller)
+    {
+        mpoller->nthreads = (unsigned int)nthreads;
+        mpoller->timer_index = 0;
+        if(__mpoller_create(params, mpoller) >= 0)
+            return mpoller;
+
+        free(mpoller);
+    }
+
+    return NULL;
+}
+
+int mpoller_start(mpoller_t *mpoller)
+{
+    size_t i;
+
+    for(i = 0; i < mpoller->nthreads; ++i)
+    {
+        if(poller_start(mpoller->poller[i]) < 0)
+            break;
+    }
+
+    if(i == mpoller->nthreads)
+        return 0;
+
+    while(i > 0)
+        poller_stop(mpoller->poller[--i]);
+
+    return -1;
+}
+
+void mpoller_stop(mpoller_t *mpoller)
+{
+    size_t i;
+
+    for(i = 0; i < mpoller->nthreads; ++i)
+        poller_stop(mpoller->poller[i]);
+}
+
+void mpoller_destroy(mpoller_t *mpoller)
+{
+    size_t i;
+
+    for(i = 0; i < mpoller->nthreads; ++i)
+        poller_destroy(mpoller->poller[i]);
+
+    free(mpoller);
+}
+
+int mpoller_add_timer(const struct timespec *value, void *context, mpoller_t *mpoller)
+{
+    // 多个线程可能同时添加定时器, 计数器用原子操作; 回绕之后取模依然是均匀的
+    unsigned int index = __sync_fetch_and_add(&mpoller->timer_index, 1);
+    return poller_add_timer(value, context, mpoller->poller[index % mpoller->nthreads]);
+}
@@ -1,9 +1,12 @@
 #include "poller/poller.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <errno.h>
@@ -11,11 +14,20 @@
 #include "poller/rbtree.h"
 #include "poller/list.h"
 
+#ifndef IOV_MAX
+# ifdef UIO_MAXIOV
+#  define IOV_MAX   UIO_MAXIOV
+# else
+#  define IOV_MAX   1024
+# endif
+#endif
+
 #define POLLER_BUFSIZE      (256 * 1024)
 #define POLLER_EVENT_MAX    256
 
 struct __poller_node
 {
+    // 前三个成员必须和struct poller_result保持一致, callback时直接强转成poller_result
     int state;
     int error;
     struct poller_data data;
@@ -26,16 +38,18 @@ struct __poller_node
         struct rb_node rb;
     };
 #pragma pack()
-    char in_rbtrees;
+    char in_rbtree;
     char removed;
     int event;
     struct timespec timeout;
     struct __poller_node* res;
+    struct __poller_node* next;     // 在poller->queue中的下一个节点
 };
 
 struct __poller
 {
     size_t max_open_files;
+    size_t nodes_stride;    // nodes只保存fd % nodes_stride相同的那部分fd, 下标为fd / nodes_stride
     struct poller_message_t *(*create_message)(void *);
     int (*partial_written)(size_t, void *);
     void (*cb)(struct poller_result *, void *);
@@ -44,8 +58,10 @@ struct __poller
     pthread_t tid;
     int pfd;
     int timerfd;
-    int pipe_rd;
-    int pipe_wr;
+    int eventfd;                    // 其它线程通过eventfd唤醒poller线程
+    int notified;                   // eventfd已经写过, 还没被poller线程处理; 避免每次入队都write
+    int stop_flag;                  // poller_stop请求poller线程退出
+    struct __poller_node* queue;    // 无锁MPSC队列(链栈), 保存被poller_del/poller_mod移除, 等待poller线程回调的node
     int stopped;
     struct rb_root timeo_tree;
     struct rb_node *tree_first;
@@ -59,7 +75,16 @@ struct __poller
 
 typedef struct epoll_event __poller_event_t;
 
-static inline long __timeout_cmp(struct __poller_node* node1,struct __poller_node* node2)
+/**
+ * @brief fd在poller->nodes中对应的位置
+ * 单独使用时nodes_stride为1; 在mpoller中每个poller只负责一部分fd, 各自的nodes数组互不重叠
+ */
+static inline struct __poller_node** __poller_node_slot(int fd, poller_t* poller)
+{
+    return &poller->nodes[(size_t)fd / poller->nodes_stride];
+}
+
+static inline long __timeout_cmp(const struct __poller_node* node1, const struct __poller_node* node2)
 {
     long ret = node1->timeout.tv_sec - node2->timeout.tv_sec;
     if(ret == 0)
@@ -100,18 +125,23 @@ static inline int __poller_add_timerfd(int timerfd, poller_t* poller)
             }
     };
     // 使用epoll监听 timerfd的读事件 何时触发？读事件触发就表示定时器到期。
-    // 疑问1：为什么是EPOLLET，边缘触发？
+    // 为什么是EPOLLET：到期之后并不会去read timerfd(超时的处理统一在每轮epoll_wait之后做), 水平触发的话epoll_wait会一直返回。
     return epoll_ctl(poller->pfd, EPOLL_CTL_ADD, timerfd, &ev);
 }
 
 
-static inline int __poller_set_timerfd(int timerfd, struct timespec* abstime, poller_t* poller)
+/**
+ * @brief 设置timerfd的到期时间
+ * @param abstime CLOCK_MONOTONIC的绝对时间; 全0表示关闭定时器
+ */
+static inline int __poller_set_timerfd(int timerfd, const struct timespec* abstime, poller_t* poller)
 {
     struct itimerspec timer = {
             .it_interval = {},
             .it_value = *abstime
     };
-    return timerfd_settime(timerfd, 0, &timer, NULL);
+    (void)poller;
+    return timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &timer, NULL);
 }
 
 static inline int __poller_add_fd(int fd, int event, void* data, poller_t* poller)
@@ -125,6 +155,24 @@ static inline int __poller_add_fd(int fd, int event, void* data, poller_t* polle
     return epoll_ctl(poller->pfd, EPOLL_CTL_ADD, fd, &ev);
 }
 
+static inline int __poller_del_fd(int fd, int event, poller_t* poller)
+{
+    (void)event;
+    return epoll_ctl(poller->pfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static inline int __poller_mod_fd(int fd, int old_event, int new_event, void* data, poller_t* poller)
+{
+    struct epoll_event ev = {
+            .events = new_event,
+            .data = {
+                    .ptr = data
+            }
+    };
+    (void)old_event;
+    return epoll_ctl(poller->pfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
 /**
  * @brief
  * @param [out] events 已就绪的事件
@@ -170,53 +218,726 @@ static int __poller_create_timer(poller_t* poller)
 
 
 /**
- * @brief 设置poller的定时器超时时间（从任务中找到最近一个要到期的任务，到期时间）
- * @param poller
- * @return
+ * @brief 最早超时的node, 没有则返回NULL; 调用者持有poller->mutex
+ * 超时的node有两种存放方式: 超时时间单调递增的直接追加到timeo_list尾部(O(1)), 否则放到红黑树中,
+ * 所以最早超时的node只可能是链表首元素或者红黑树最左节点
  */
-static int __poller_set_timer(poller_t* poller)
+static inline struct __poller_node* __poller_first_node(poller_t* poller)
 {
-    struct __poller_node *node = NULL;
-    struct __poller_node *first = NULL;
-    struct timespec abstime;
+    struct __poller_node* node = NULL;
+    struct __poller_node* first;
 
-    pthread_mutex_lock(&poller->mutex);
-
-    // 由于__poller_node结构体中有union,所以无法确定__poller_node对象是使用的list还是rbtree, 所以两种都支持
-
-    // 通过timeo_list.next拿到其绑定的的__poller_node(链表首元素)
-    if (!ListEmpty(&poller->timeo_list))
+    if(!ListEmpty(&poller->timeo_list))
         node = list_entry(poller->timeo_list.next, struct __poller_node, list);
 
-    /// 通过timeo_tree.first拿到其绑定的__poller_node, 选出其中最快要超时的一个node
-    if(!poller->tree_first)
+    if(poller->tree_first)
     {
         first = rb_entry(poller->tree_first, struct __poller_node, rb);
-        if(!node || __timeout_cmp(first, node))
+        if(!node || __timeout_cmp(first, node) < 0)
             node = first;
     }
 
+    return node;
+}
+
+/**
+ * @brief 按照最早超时的node重新设置timerfd, 没有超时的node时关闭timerfd; 调用者持有poller->mutex
+ * 只在最早的超时时间可能变化的时候调用: 插入了更早的node(__poller_insert_node), 或者有node到期(__poller_handle_timeout)。
+ * 移除node时不重新设置, 最多多触发一次timerfd, 到期处理时发现没有node超时就会重新设置。
+ */
+static int __poller_update_timer(poller_t* poller)
+{
+    struct __poller_node* node = __poller_first_node(poller);
+    struct timespec abstime;
+
     if(node)
-    {
-       abstime = node->timeout;
-    }
+        abstime = node->timeout;
     else
     {
         abstime.tv_sec = 0;
         abstime.tv_nsec = 0;
     }
-    __poller_set_timerfd(poller->timerfd, &abstime, poller);
+    return __poller_set_timerfd(poller->timerfd, &abstime, poller);
+}
+
+
+/**
+ * @brief 把node插入到红黑树中, 同时维护tree_first和tree_last
+ */
+static void __poller_tree_insert(struct __poller_node* node, poller_t* poller)
+{
+    struct rb_node** p = &poller->timeo_tree.rb_node;
+    struct rb_node* parent = NULL;
+    struct __poller_node* entry;
+
+    if(!*p)
+    {
+        poller->tree_first = &node->rb;
+        poller->tree_last = &node->rb;
+    }
+    else
+    {
+        entry = rb_entry(poller->tree_last, struct __poller_node, rb);
+        if(__timeout_cmp(node, entry) >= 0)
+        {
+            // 比树中最大的还大, 直接挂到tree_last的右边, 不用从root开始找
+            parent = poller->tree_last;
+            p = &parent->rb_right;
+            poller->tree_last = &node->rb;
+        }
+        else
+        {
+            do
+            {
+                parent = *p;
+                entry = rb_entry(*p, struct __poller_node, rb);
+                if(__timeout_cmp(node, entry) < 0)
+                    p = &(*p)->rb_left;
+                else
+                    p = &(*p)->rb_right;
+            } while(*p);
+
+            if(p == &poller->tree_first->rb_left)
+                poller->tree_first = &node->rb;
+        }
+    }
+
+    node->in_rbtree = 1;
+    rb_link_node(&node->rb, parent, p);
+    rb_insert_color(&node->rb, &poller->timeo_tree);
+}
+
+static inline void __poller_tree_erase(struct __poller_node* node, poller_t* poller)
+{
+    if(&node->rb == poller->tree_first)
+        poller->tree_first = rb_next(&node->rb);
+
+    if(&node->rb == poller->tree_last)
+        poller->tree_last = rb_prev(&node->rb);
+
+    rb_erase(&node->rb, &poller->timeo_tree);
+    node->in_rbtree = 0;
+}
+
+/**
+ * @brief 把有超时时间的node加入到poller中; 大部分情况下超时时间都是递增的, 追加到链表尾部即可
+ */
+static void __poller_insert_node(struct __poller_node* node, poller_t* poller)
+{
+    struct __poller_node* end;
+
+    node->in_rbtree = 0;
+    if(ListEmpty(&poller->timeo_list))
+    {
+        ListAdd(&node->list, &poller->timeo_list);
+        // 链表原来为空, node可能比红黑树中所有节点都早
+        end = poller->tree_first ? rb_entry(poller->tree_first, struct __poller_node, rb) : NULL;
+    }
+    else
+    {
+        end = list_entry(poller->timeo_list.prev, struct __poller_node, list);
+        if(__timeout_cmp(node, end) >= 0)
+        {
+            // 比链表尾部晚, 不可能是最早的
+            ListAddTail(&node->list, &poller->timeo_list);
+            return;
+        }
+
+        __poller_tree_insert(node, poller);
+        if(&node->rb != poller->tree_first)
+            return;
+
+        end = list_entry(poller->timeo_list.next, struct __poller_node, list);
+    }
+
+    // node成为最早超时的节点, poller线程可能正阻塞在epoll_wait中, 需要马上重新设置timerfd
+    if(!end || __timeout_cmp(node, end) < 0)
+        __poller_set_timerfd(poller->timerfd, &node->timeout, poller);
+}
+
+/**
+ * @brief node从超时结构(链表/红黑树)中删除
+ */
+static inline void __poller_unlink_node(struct __poller_node* node, poller_t* poller)
+{
+    if(node->in_rbtree)
+        __poller_tree_erase(node, poller);
+    else
+        ListDel(&node->list);
+}
+
+static void __poller_node_set_timeout(int timeout, struct __poller_node* node)
+{
+    clock_gettime(CLOCK_MONOTONIC, &node->timeout);
+    node->timeout.tv_sec += timeout / 1000;
+    node->timeout.tv_nsec += timeout % 1000 * 1000000;
+    if(node->timeout.tv_nsec >= 1000000000)
+    {
+        node->timeout.tv_nsec -= 1000000000;
+        node->timeout.tv_sec++;
+    }
+}
+
+/**
+ * @brief 根据操作类型得到需要监听的epoll事件
+ * @return 1表示需要预先分配一个res节点(会多次回调的操作), 0不需要, -1表示不支持的操作
+ */
+static int __poller_data_get_event(int* event, const struct poller_data* data)
+{
+    switch(data->operation)
+    {
+        case PD_OP_READ:
+            *event = EPOLLIN;
+            return !!data->message;
+        case PD_OP_WRITE:
+            *event = EPOLLOUT | EPOLLET;
+            return 0;
+        case PD_OP_LISTEN:
+            *event = EPOLLIN;
+            return 1;
+        case PD_OP_CONNECT:
+            *event = EPOLLOUT | EPOLLET;
+            return 0;
+        case PD_OP_EVENT:
+            *event = EPOLLIN | EPOLLET;
+            return 1;
+        case PD_OP_NOTIFY:
+            *event = EPOLLIN | EPOLLET;
+            return 1;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+/**
+ * @brief 在poller线程中把node移除; 如果node已经被其它线程poller_del/poller_mod移除, 返回1
+ */
+static int __poller_remove_node(struct __poller_node* node, poller_t* poller)
+{
+    int removed;
+
+    pthread_mutex_lock(&poller->mutex);
+    removed = node->removed;
+    if(!removed)
+    {
+        *__poller_node_slot(node->data.fd, poller) = NULL;
+        __poller_unlink_node(node, poller);
+        __poller_del_fd(node->data.fd, node->event, poller);
+    }
     pthread_mutex_unlock(&poller->mutex);
+    return removed;
+}
+
+/**
+ * @brief 把读到的数据交给message; 消息完整时通过res回调给用户, 然后准备接收下一个消息
+ * @return 和append返回值一致
+ */
+static int __poller_append_message(const void* buf, size_t* n, struct __poller_node* node, poller_t* poller)
+{
+    struct poller_message_t* msg = node->data.message;
+    struct __poller_node* res;
+    int ret;
+
+    if(!msg)
+    {
+        res = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+        if(!res)
+            return -1;
+
+        msg = poller->create_message(node->data.context);
+        if(!msg)
+        {
+            free(res);
+            return -1;
+        }
+
+        node->data.message = msg;
+        node->res = res;
+    }
+    else
+        res = node->res;
+
+    ret = msg->append(buf, n, msg);
+    if(ret > 0)
+    {
+        res->data = node->data;
+        res->error = 0;
+        res->state = PR_ST_SUCCESS;
+        poller->cb((struct poller_result*)res, poller->ctx);
+
+        node->data.message = NULL;
+        node->res = NULL;
+    }
+
+    return ret;
+}
+
+static void __poller_handle_read(struct __poller_node* node, poller_t* poller)
+{
+    ssize_t nleft;
+    size_t n;
+    char* p;
+
+    while(1)
+    {
+        p = poller->buf;
+        nleft = read(node->data.fd, p, POLLER_BUFSIZE);
+        if(nleft < 0)
+        {
+            if(errno == EAGAIN)
+                return;
+            if(errno == EINTR)
+                continue;
+        }
+
+        if(nleft <= 0)
+            break;
+
+        // 一次读到的数据可能包含多个消息, 也可能不足一个消息
+        do
+        {
+            n = nleft;
+            if(__poller_append_message(p, &n, node, poller) >= 0)
+            {
+                nleft -= n;
+                p += n;
+            }
+            else
+                nleft = -1;
+        } while(nleft > 0);
+
+        if(nleft < 0)
+            break;
+    }
+
+    if(__poller_remove_node(node, poller))
+        return;
+
+    // nleft == 0 表示对端关闭
+    if(nleft == 0)
+    {
+        node->error = 0;
+        node->state = PR_ST_FINISHED;
+    }
+    else
+    {
+        node->error = errno;
+        node->state = PR_ST_ERROR;
+    }
+
+    free(node->res);
+    poller->cb((struct poller_result*)node, poller->ctx);
+}
+
+static void __poller_handle_write(struct __poller_node* node, poller_t* poller)
+{
+    struct iovec* iov = node->data.write_iov;
+    size_t count = 0;
+    ssize_t nleft;
+    int iovcnt;
+    int ret = 0;
+
+    while(node->data.iovcnt > 0)
+    {
+        iovcnt = node->data.iovcnt;
+        if(iovcnt > IOV_MAX)
+            iovcnt = IOV_MAX;
+
+        nleft = writev(node->data.fd, iov, iovcnt);
+        if(nleft < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            ret = errno == EAGAIN ? 0 : -1;
+            break;
+        }
+
+        count += nleft;
+        // 跳过已经写完的iovec, 修正写了一部分的iovec
+        do
+        {
+            if((size_t)nleft >= iov->iov_len)
+            {
+                nleft -= iov->iov_len;
+                iov->iov_base = (char*)iov->iov_base + iov->iov_len;
+                iov->iov_len = 0;
+                iov++;
+                node->data.iovcnt--;
+            }
+            else
+            {
+                iov->iov_base = (char*)iov->iov_base + nleft;
+                iov->iov_len -= nleft;
+                break;
+            }
+        } while(node->data.iovcnt > 0);
+    }
+
+    node->data.write_iov = iov;
+    if(node->data.iovcnt > 0 && ret >= 0)
+    {
+        // 没写完(EAGAIN), 等下一次可写事件; 写了一部分的话通知用户, 用户可以借此刷新超时时间
+        if(count == 0)
+            return;
+
+        if(poller->partial_written(count, node->data.context) >= 0)
+            return;
+    }
+
+    if(__poller_remove_node(node, poller))
+        return;
+
+    if(node->data.iovcnt == 0)
+    {
+        node->error = 0;
+        node->state = PR_ST_FINISHED;
+    }
+    else
+    {
+        node->error = errno;
+        node->state = PR_ST_ERROR;
+    }
+
+    poller->cb((struct poller_result*)node, poller->ctx);
+}
+
+static void __poller_handle_listen(struct __poller_node* node, poller_t* poller)
+{
+    struct __poller_node* res = node->res;
+    struct sockaddr_storage ss;
+    socklen_t len;
+    int sockfd;
+    void* p;
+
+    while(1)
+    {
+        len = sizeof(struct sockaddr_storage);
+        sockfd = accept(node->data.fd, (struct sockaddr*)&ss, &len);
+        if(sockfd < 0)
+        {
+            if(errno == EAGAIN)
+                return;
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        p = node->data.accept((const struct sockaddr*)&ss, len, sockfd, node->data.context);
+        if(!p)
+            break;
+
+        res->data = node->data;
+        res->data.result = p;
+        res->error = 0;
+        res->state = PR_ST_SUCCESS;
+        poller->cb((struct poller_result*)res, poller->ctx);
+
+        // res已经交给用户了, 为下一个连接准备新的res
+        res = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+        node->res = res;
+        if(!res)
+            break;
+    }
+
+    if(__poller_remove_node(node, poller))
+        return;
+
+    node->error = errno;
+    node->state = PR_ST_ERROR;
+    free(node->res);
+    poller->cb((struct poller_result*)node, poller->ctx);
+}
+
+static void __poller_handle_connect(struct __poller_node* node, poller_t* poller)
+{
+    socklen_t len = sizeof(int);
+    int error;
+
+    if(getsockopt(node->data.fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+        error = errno;
+
+    if(__poller_remove_node(node, poller))
+        return;
+
+    if(error == 0)
+    {
+        node->error = 0;
+        node->state = PR_ST_FINISHED;
+    }
+    else
+    {
+        node->error = error;
+        node->state = PR_ST_ERROR;
+    }
+
+    poller->cb((struct poller_result*)node, poller->ctx);
+}
+
+static void __poller_handle_event(struct __poller_node* node, poller_t* poller)
+{
+    struct __poller_node* res = node->res;
+    unsigned long long cnt = 0;
+    unsigned long long value;
+    void* p;
+    int n;
+
+    while(1)
+    {
+        n = read(node->data.fd, &value, sizeof(unsigned long long));
+        if(n == sizeof(unsigned long long))
+            cnt += value;
+        else
+        {
+            if(n >= 0)
+                errno = EINVAL;
+            break;
+        }
+    }
+
+    if(errno == EAGAIN)
+    {
+        while(1)
+        {
+            if(cnt == 0)
+                return;
+
+            cnt--;
+            p = node->data.event(node->data.context);
+            if(!p)
+                break;
+
+            res->data = node->data;
+            res->data.result = p;
+            res->error = 0;
+            res->state = PR_ST_SUCCESS;
+            poller->cb((struct poller_result*)res, poller->ctx);
+
+            res = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+            node->res = res;
+            if(!res)
+                break;
+        }
+    }
+
+    // 没处理完的计数写回去
+    if(cnt != 0 && write(node->data.fd, &cnt, sizeof(unsigned long long)) < 0)
+        cnt = 0;
+
+    if(__poller_remove_node(node, poller))
+        return;
+
+    node->error = errno;
+    node->state = PR_ST_ERROR;
+    free(node->res);
+    poller->cb((struct poller_result*)node, poller->ctx);
+}
+
+static void __poller_handle_notify(struct __poller_node* node, poller_t* poller)
+{
+    struct __poller_node* res = node->res;
+    void* p;
+    int n;
+
+    while(1)
+    {
+        n = read(node->data.fd, &p, sizeof(void*));
+        if(n == sizeof(void*))
+        {
+            p = node->data.notify(p, node->data.context);
+            if(!p)
+                break;
+
+            res->data = node->data;
+            res->data.result = p;
+            res->error = 0;
+            res->state = PR_ST_SUCCESS;
+            poller->cb((struct poller_result*)res, poller->ctx);
+
+            res = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+            node->res = res;
+            if(!res)
+                break;
+        }
+        else if(n < 0 && errno == EAGAIN)
+            return;
+        else
+        {
+            if(n > 0)
+                errno = EINVAL;
+            break;
+        }
+    }
+
+    if(__poller_remove_node(node, poller))
+        return;
+
+    if(n == 0)
+    {
+        node->error = 0;
+        node->state = PR_ST_FINISHED;
+    }
+    else
+    {
+        node->error = errno;
+        node->state = PR_ST_ERROR;
+    }
+
+    free(node->res);
+    poller->cb((struct poller_result*)node, poller->ctx);
+}
+
+/**
+ * @brief 唤醒阻塞在epoll_wait中的poller线程
+ */
+static inline void __poller_wakeup(poller_t* poller)
+{
+    uint64_t n = 1;
+    if(write(poller->eventfd, &n, sizeof(n)) < 0)
+        abort();
+}
+
+/**
+ * @brief 任意线程把被移除的node交给poller线程回调; 这样可以保证同一轮epoll_wait返回的事件中,
+ * 即使引用了被移除的node, node也还没有被用户释放。
+ * 入队只是一次CAS, 不需要加锁; 在poller线程处理之前多次入队只write一次eventfd。
+ */
+static void __poller_queue_push(struct __poller_node* node, poller_t* poller)
+{
+    struct __poller_node* head = __atomic_load_n(&poller->queue, __ATOMIC_RELAXED);
+
+    do
+    {
+        node->next = head;
+    } while(!__atomic_compare_exchange_n(&poller->queue, &head, node, 1,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if(!__atomic_exchange_n(&poller->notified, 1, __ATOMIC_SEQ_CST))
+        __poller_wakeup(poller);
+}
+
+/**
+ * @brief 只能由唯一的消费者调用(poller线程, 或者poller线程退出后的poller_stop):
+ * 一次取走整个队列, 按入队顺序回调
+ */
+static void __poller_handle_queue(poller_t* poller)
+{
+    struct __poller_node* node;
+    struct __poller_node* prev = NULL;
+    struct __poller_node* next;
+    uint64_t n;
+
+    if(read(poller->eventfd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+        abort();
+
+    // 先清除notified再取队列: 之后入队的node要么这次被取走, 要么会重新write eventfd
+    __atomic_store_n(&poller->notified, 0, __ATOMIC_SEQ_CST);
+    node = __atomic_exchange_n(&poller->queue, NULL, __ATOMIC_SEQ_CST);
+
+    // 链栈是后进先出的, 反转一次恢复入队顺序
+    while(node)
+    {
+        next = node->next;
+        node->next = prev;
+        prev = node;
+        node = next;
+    }
+
+    while(prev)
+    {
+        node = prev;
+        prev = node->next;
+        free(node->res);
+        poller->cb((struct poller_result*)node, poller->ctx);
+    }
+}
+
+/**
+ * @brief 处理所有已经超时的node(包括poller_add_timer添加的定时器), 然后按照新的最早超时时间设置timerfd
+ * @param time_node 只用到了其中的timeout, 当前时间
+ */
+static void __poller_handle_timeout(const struct __poller_node* time_node, poller_t* poller)
+{
+    struct __poller_node* node;
+    struct list_head* pos;
+    struct list_head timeo_list;
+
+    ListInit(&timeo_list);
+    pthread_mutex_lock(&poller->mutex);
+    // 链表是有序的, 碰到第一个没超时的就可以停止
+    while(!ListEmpty(&poller->timeo_list))
+    {
+        pos = poller->timeo_list.next;
+        node = list_entry(pos, struct __poller_node, list);
+        if(__timeout_cmp(node, time_node) > 0)
+            break;
+
+        if(node->data.fd >= 0)
+        {
+            *__poller_node_slot(node->data.fd, poller) = NULL;
+            __poller_del_fd(node->data.fd, node->event, poller);
+        }
+
+        node->removed = 1;
+        ListMoveTail(pos, &timeo_list);
+    }
+
+    while(poller->tree_first)
+    {
+        node = rb_entry(poller->tree_first, struct __poller_node, rb);
+        if(__timeout_cmp(node, time_node) > 0)
+            break;
+
+        if(node->data.fd >= 0)
+        {
+            *__poller_node_slot(node->data.fd, poller) = NULL;
+            __poller_del_fd(node->data.fd, node->event, poller);
+        }
+
+        poller->tree_first = rb_next(poller->tree_first);
+        rb_erase(&node->rb, &poller->timeo_tree);
+        ListAddTail(&node->list, &timeo_list);
+        if(!poller->tree_first)
+            poller->tree_last = NULL;
+
+        node->in_rbtree = 0;
+        node->removed = 1;
+    }
+
+    // 只有timerfd到期时才会调用这里, 最早的超时时间已经变化
+    __poller_update_timer(poller);
+    pthread_mutex_unlock(&poller->mutex);
+
+    // 回调不持锁, 回调里面可能会再调用poller_add等接口
+    while(!ListEmpty(&timeo_list))
+    {
+        node = list_entry(timeo_list.next, struct __poller_node, list);
+        ListDel(&node->list);
+
+        if(node->data.operation == PD_OP_TIMER)
+        {
+            node->error = 0;
+            node->state = PR_ST_FINISHED;
+        }
+        else
+        {
+            node->error = ETIMEDOUT;
+            node->state = PR_ST_ERROR;
+        }
+        free(node->res);
+        poller->cb((struct poller_result*)node, poller->ctx);
+    }
 }
 
 
 /**
  * @brief 初始化一个poller_t对象并返回其地址。
- * @param nodes_buf
+ * @param nodes_buf   fd到node的映射数组, 由poller负责释放
+ * @param nodes_stride 见struct __poller的nodes_stride
  * @param params
  * @return 成功返回地址，失败NULL
  */
-static inline poller_t* __poller_create(void** nodes_buf, const struct poller_params* params)
+static inline poller_t* __poller_create(void** nodes_buf, size_t nodes_stride, const struct poller_params* params)
 {
     poller_t* poller =  (poller_t*)malloc(sizeof(poller_t));
     if(!poller)
@@ -228,11 +949,26 @@ static inline poller_t* __poller_create(void** nodes_buf, const struct poller_pa
         // 创建一个timerfd，并且与poller绑定
         if(__poller_create_timer(poller) >= 0)
         {
-            int ret = pthread_mutex_init(&poller->mutex, NULL);
+            int ret = -1;
+            // eventfd用于其它线程唤醒poller线程: 有被移除的node需要回调, 或者poller_stop
+            poller->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(poller->eventfd >= 0)
+            {
+                if(__poller_add_fd(poller->eventfd, EPOLLIN, (void*)1, poller) >= 0)
+                    ret = pthread_mutex_init(&poller->mutex, NULL);
+                else
+                    ret = errno;
+                if(ret != 0)
+                    close(poller->eventfd);
+            }
+            else
+                ret = errno;
+
             if(ret == 0)
             {
                 poller->nodes = (struct __poller_node**)nodes_buf;
                 poller->max_open_files = params->max_open_files;
+                poller->nodes_stride = nodes_stride;
                 poller->create_message = params->create_message;
                 poller->partial_written = params->partial_written;
                 poller->cb = params->callback;
@@ -245,35 +981,21 @@ static inline poller_t* __poller_create(void** nodes_buf, const struct poller_pa
                 ListInit(&poller->timeo_list);
                 ListInit(&poller->no_timeo_list);
 
+                poller->queue = NULL;
+                poller->notified = 0;
+                poller->stop_flag = 0;
                 poller->stopped = 1;
                 return poller;
             }
             errno = ret;
             close(poller->timerfd);
         }
+        close(poller->pfd);
     }
     free(poller);
     return NULL;
 }
 
-static int __poller_open_pipe(poller_t* poller)
-{
-    int pipefd[2];
-    if(pipe(pipefd) >= 0)
-    {
-        // 疑问2： 为什么要打开一个匿名管道？
-        if(__poller_add_fd(pipefd[0], EPOLLIN, (void*)1, poller) >= 0)
-        {
-            poller->pipe_rd = pipefd[0];
-            poller->pipe_wr = pipefd[1];
-            return 0;
-        }
-        close(pipefd[0]);
-        close(pipefd[1]);
-    }
-    return -1;
-}
-
 static void* __poller_thread_routine(void* arg)
 {
     poller_t *poller = (poller_t*)arg;
@@ -281,18 +1003,21 @@ static void* __poller_thread_routine(void* arg)
     struct __poller_node time_node;
     struct __poller_node *node;
 
-    int has_pipe_event;
+    int has_wakeup_event;
+    int has_timer_event;
     int nevents;
+    int i;
 
     while(1)
     {
-        __poller_set_timer(poller);
+        // 这里不需要加锁: timerfd只在最早的超时时间变化时重新设置, 队列也是无锁的
         nevents = __poller_wait(events, POLLER_EVENT_MAX, poller);
         clock_gettime(CLOCK_MONOTONIC, &time_node.timeout);
-        has_pipe_event = 0;
-        for(int i = 0; i < nevents; ++i)
+        has_wakeup_event = 0;
+        has_timer_event = 0;
+        for(i = 0; i < nevents; ++i)
         {
-            // 读取当前被触发的事件，根据不同的类型，进行处理
+            // 读取当前被触发的事件，根据不同的类型，进行处理; NULL是timerfd, 1是eventfd
             node = (struct __poller_node*)__poller_event_data(&events[i]);
             if(node > (struct __poller_node*)1)
             {
@@ -300,44 +1025,55 @@ static void* __poller_thread_routine(void* arg)
                 {
                     case PD_OP_READ:
                         __poller_handle_read(node, poller);
+                        break;
                     case PD_OP_WRITE:
                         __poller_handle_write(node, poller);
+                        break;
                     case PD_OP_LISTEN:
                         __poller_handle_listen(node, poller);
+                        break;
                     case PD_OP_CONNECT:
                         __poller_handle_connect(node, poller);
+                        break;
                     case PD_OP_EVENT:
                         __poller_handle_event(node, poller);
+                        break;
                     case PD_OP_NOTIFY:
-                        __poller__handle_notify(node, poller);
-                    case PD_OP_TIMER:
-                        __poller__handle_timer(node, poller);
+                        __poller_handle_notify(node, poller);
+                        break;
                 }
             }
             else if (node == (struct __poller_node*)1)
-            {
-                has_pipe_event = 1;
-            }
+                has_wakeup_event = 1;
+            else
+                has_timer_event = 1;
         }
-        if(has_pipe_event)
+
+        // 被移除的node要等本轮事件处理完才能回调
+        if(has_wakeup_event)
         {
-            if(__poller_handle_pipe(poller))
+            __poller_handle_queue(poller);
+            if(__atomic_load_n(&poller->stop_flag, __ATOMIC_ACQUIRE))
                 break;
         }
 
-        __poller_handle_timeout(&time_node, poller);
+        if(has_timer_event)
+            __poller_handle_timeout(&time_node, poller);
     }
+
+    return NULL;
 }
 
-poller_t* poller_create(const struct poller_params* params)
+poller_t* __poller_create_slice(const struct poller_params* params, size_t nslices)
 {
     // calloc函数是stdlib.h头文件中的，作用是分配内存，并且初始化所有位为0
-    void** nodes_buf = (void**) calloc(params->max_open_files, sizeof(void*));
+    size_t n = (params->max_open_files + nslices - 1) / nslices;
+    void** nodes_buf = (void**) calloc(n, sizeof(void*));
     poller_t* poller;
 
     if(nodes_buf)
     {
-        poller = __poller_create(nodes_buf, params);
+        poller = __poller_create(nodes_buf, nslices, params);
         if(poller)
             return poller;
         free(nodes_buf);
@@ -346,28 +1082,332 @@ poller_t* poller_create(const struct poller_params* params)
     return NULL;
 }
 
+poller_t* poller_create(const struct poller_params* params)
+{
+    return __poller_create_slice(params, 1);
+}
+
 int poller_start(poller_t* poller)
 {
     pthread_t tid;
     int ret;
 
     pthread_mutex_lock(&poller->mutex);
-    if(__poller_open_pipe(poller) >= 0)
+    poller->stop_flag = 0;
+    ret = pthread_create(&tid, NULL, __poller_thread_routine, poller);
+    if(ret == 0)
     {
-        ret = pthread_create(&tid, NULL, __poller_thread_routine, poller);
-        if(ret == 0)
+        poller->tid = tid;
+        poller->stopped = 0;
+    }
+    else
+        errno = ret;
+    pthread_mutex_unlock(&poller->mutex);
+    return -poller->stopped;
+}
+
+int poller_add(const struct poller_data* data, int timeout, poller_t* poller)
+{
+    struct __poller_node* res = NULL;
+    struct __poller_node* node;
+    int need_res;
+    int event;
+
+    if((size_t)data->fd >= poller->max_open_files)
+    {
+        errno = data->fd < 0 ? EBADF : EMFILE;
+        return -1;
+    }
+
+    need_res = __poller_data_get_event(&event, data);
+    if(need_res < 0)
+        return -1;
+
+    if(need_res)
+    {
+        res = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+        if(!res)
+            return -1;
+    }
+
+    node = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+    if(node)
+    {
+        node->data = *data;
+        node->event = event;
+        node->in_rbtree = 0;
+        node->removed = 0;
+        node->res = res;
+        if(timeout >= 0)
+            __poller_node_set_timeout(timeout, node);
+
+        pthread_mutex_lock(&poller->mutex);
+        if(!*__poller_node_slot(data->fd, poller))
         {
-            poller->tid = tid;
-            poller->stopped = 0;
+            if(__poller_add_fd(data->fd, event, node, poller) >= 0)
+            {
+                if(timeout >= 0)
+                    __poller_insert_node(node, poller);
+                else
+                    ListAddTail(&node->list, &poller->no_timeo_list);
+
+                *__poller_node_slot(data->fd, poller) = node;
+                node = NULL;
+            }
         }
         else
+            errno = EEXIST;
+
+        pthread_mutex_unlock(&poller->mutex);
+        if(node == NULL)
+            return 0;
+
+        free(node);
+    }
+
+    free(res);
+    return -1;
+}
+
+int poller_del(int fd, poller_t* poller)
+{
+    struct __poller_node* node;
+
+    if((size_t)fd >= poller->max_open_files)
+    {
+        errno = fd < 0 ? EBADF : EMFILE;
+        return -1;
+    }
+
+    pthread_mutex_lock(&poller->mutex);
+    node = *__poller_node_slot(fd, poller);
+    if(node)
+    {
+        *__poller_node_slot(fd, poller) = NULL;
+        __poller_unlink_node(node, poller);
+        __poller_del_fd(fd, node->event, poller);
+
+        node->error = 0;
+        node->state = PR_ST_DELETED;
+        if(poller->stopped)
         {
-            errno = ret;
-            close(poller->pipe_rd);
-            close(poller->pipe_wr);
+            free(node->res);
+            poller->cb((struct poller_result*)node, poller->ctx);
+        }
+        else
+        {
+            // 交给poller线程回调, 防止poller线程还在使用该node
+            node->removed = 1;
+            __poller_queue_push(node, poller);
         }
     }
+    else
+        errno = ENOENT;
+
     pthread_mutex_unlock(&poller->mutex);
-    return -poller->stopped;
+    return -!node;
 }
 
+int poller_mod(const struct poller_data* data, int timeout, poller_t* poller)
+{
+    struct __poller_node* res = NULL;
+    struct __poller_node* node;
+    struct __poller_node* old;
+    int need_res;
+    int event;
+
+    if((size_t)data->fd >= poller->max_open_files)
+    {
+        errno = data->fd < 0 ? EBADF : EMFILE;
+        return -1;
+    }
+
+    need_res = __poller_data_get_event(&event, data);
+    if(need_res < 0)
+        return -1;
+
+    if(need_res)
+    {
+        res = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+        if(!res)
+            return -1;
+    }
+
+    node = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+    if(node)
+    {
+        node->data = *data;
+        node->event = event;
+        node->in_rbtree = 0;
+        node->removed = 0;
+        node->res = res;
+        if(timeout >= 0)
+            __poller_node_set_timeout(timeout, node);
+
+        pthread_mutex_lock(&poller->mutex);
+        old = *__poller_node_slot(data->fd, poller);
+        if(old)
+        {
+            if(__poller_mod_fd(data->fd, old->event, event, node, poller) >= 0)
+            {
+                __poller_unlink_node(old, poller);
+
+                old->error = 0;
+                old->state = PR_ST_MODIFIED;
+                if(poller->stopped)
+                {
+                    free(old->res);
+                    poller->cb((struct poller_result*)old, poller->ctx);
+                }
+                else
+                {
+                    old->removed = 1;
+                    __poller_queue_push(old, poller);
+                }
+
+                if(timeout >= 0)
+                    __poller_insert_node(node, poller);
+                else
+                    ListAddTail(&node->list, &poller->no_timeo_list);
+
+                *__poller_node_slot(data->fd, poller) = node;
+                node = NULL;
+            }
+        }
+        else
+            errno = ENOENT;
+
+        pthread_mutex_unlock(&poller->mutex);
+        if(node == NULL)
+            return 0;
+
+        free(node);
+    }
+
+    free(res);
+    return -1;
+}
+
+int poller_set_timeout(int fd, int timeout, poller_t* poller)
+{
+    struct __poller_node time_node;
+    struct __poller_node* node;
+
+    if((size_t)fd >= poller->max_open_files)
+    {
+        errno = fd < 0 ? EBADF : EMFILE;
+        return -1;
+    }
+
+    if(timeout >= 0)
+        __poller_node_set_timeout(timeout, &time_node);
+
+    pthread_mutex_lock(&poller->mutex);
+    node = *__poller_node_slot(fd, poller);
+    if(node)
+    {
+        __poller_unlink_node(node, poller);
+        if(timeout >= 0)
+        {
+            node->timeout = time_node.timeout;
+            __poller_insert_node(node, poller);
+        }
+        else
+            ListAddTail(&node->list, &poller->no_timeo_list);
+    }
+    else
+        errno = ENOENT;
+
+    pthread_mutex_unlock(&poller->mutex);
+    return -!node;
+}
+
+int poller_add_timer(const struct timespec* value, void* context, poller_t* poller)
+{
+    struct __poller_node* node;
+
+    node = (struct __poller_node*)malloc(sizeof(struct __poller_node));
+    if(node)
+    {
+        memset(&node->data, 0, sizeof(struct poller_data));
+        node->data.operation = PD_OP_TIMER;
+        node->data.fd = -1;
+        node->data.context = context;
+        node->in_rbtree = 0;
+        node->removed = 0;
+        node->res = NULL;
+
+        clock_gettime(CLOCK_MONOTONIC, &node->timeout);
+        node->timeout.tv_sec += value->tv_sec;
+        node->timeout.tv_nsec += value->tv_nsec;
+        if(node->timeout.tv_nsec >= 1000000000)
+        {
+            node->timeout.tv_nsec -= 1000000000;
+            node->timeout.tv_sec++;
+        }
+
+        pthread_mutex_lock(&poller->mutex);
+        __poller_insert_node(node, poller);
+        pthread_mutex_unlock(&poller->mutex);
+        return 0;
+    }
+
+    return -1;
+}
+
+void poller_stop(poller_t* poller)
+{
+    struct __poller_node* node;
+    struct list_head* pos;
+
+    // 通知poller线程退出
+    __atomic_store_n(&poller->stop_flag, 1, __ATOMIC_RELEASE);
+    __poller_wakeup(poller);
+    pthread_join(poller->tid, NULL);
+    poller->stopped = 1;
+
+    // poller线程已经退出, 由这里回调队列中剩余的node
+    pthread_mutex_lock(&poller->mutex);
+    __poller_handle_queue(poller);
+
+    // 剩余的node全部以PR_ST_STOPPED状态回调给用户
+    poller->tree_first = NULL;
+    poller->tree_last = NULL;
+    while(poller->timeo_tree.rb_node)
+    {
+        node = rb_entry(poller->timeo_tree.rb_node, struct __poller_node, rb);
+        rb_erase(&node->rb, &poller->timeo_tree);
+        node->in_rbtree = 0;
+        ListAdd(&node->list, &poller->timeo_list);
+    }
+
+    ListSpliceInit(&poller->no_timeo_list, &poller->timeo_list);
+    while(!ListEmpty(&poller->timeo_list))
+    {
+        pos = poller->timeo_list.next;
+        node = list_entry(pos, struct __poller_node, list);
+        ListDel(pos);
+        if(node->data.fd >= 0)
+        {
+            *__poller_node_slot(node->data.fd, poller) = NULL;
+            __poller_del_fd(node->data.fd, node->event, poller);
+        }
+
+        node->error = 0;
+        node->state = PR_ST_STOPPED;
+        free(node->res);
+        poller->cb((struct poller_result*)node, poller->ctx);
+    }
+
+    pthread_mutex_unlock(&poller->mutex);
+}
+
+void poller_destroy(poller_t* poller)
+{
+    pthread_mutex_destroy(&poller->mutex);
+    close(poller->eventfd);
+    close(poller->timerfd);
+    close(poller->pfd);
+    free(poller->nodes);
+    free(poller);
+}
@@ -45,8 +45,8 @@ void rb_insert_color(struct rb_node* node, struct rb_root* root)
      * 违反1的话：只能刚插入第一个节点，因为默认初始化为红色。
      * 大部分是违反3，新插入的节点node和节点node的父亲都是红色
      */
-    struct rb_node* parent = node->rb_parent;
-    while(parent && parent->rb_color == RB_RED)
+    struct rb_node* parent;
+    while((parent = node->rb_parent) && parent->rb_color == RB_RED)
     {
         struct rb_node* gparent = parent->rb_parent;
         /**
@@ -74,7 +74,7 @@ void rb_insert_color(struct rb_node* node, struct rb_root* root)
                 register struct rb_node* tmp;
                 __rb_rotate_left(parent, root);
                 //  旋转之后，parent就是node的孩子，node变成父亲。所以这里变量交换一下。
-                tmp = node;
+                tmp = parent;
                 parent = node;
                 node = tmp;
             }
@@ -94,7 +94,7 @@ void rb_insert_color(struct rb_node* node, struct rb_root* root)
                         uncle->rb_color = RB_BLACK;
                         parent->rb_color = RB_BLACK;
                         gparent->rb_color = RB_RED;
-                        node = parent;
+                        node = gparent;
                         continue;
                     }
                 }
@@ -311,11 +311,12 @@ struct rb_node* rb_next(struct rb_node* node)
             node = node->rb_left;
         return node;
     }
-    // 如果右孩子不存在，那就是node的祖先。
-    while(node->rb_parent && node == node->rb_parent->rb_right)
-        node = node->rb_parent;
-    return node;
-    // 若是没有后继，为什么不返回NULL？ 没有后续的节点只能是rb_last。没必要返回NULL
+    // 如果右孩子不存在，那就是node的祖先: 第一个 "node在其左子树中" 的祖先。
+    // 若node已经是rb_last, 会一直走到root, 此时返回root的父亲, 也就是NULL
+    struct rb_node* parent;
+    while((parent = node->rb_parent) && node == parent->rb_right)
+        node = parent;
+    return parent;
 }
 
 struct rb_node* rb_prev(struct rb_node* node)
@@ -327,9 +328,10 @@ struct rb_node* rb_prev(struct rb_node* node)
             node = node->rb_right;
         return node;
     }
-    while(node->rb_parent && node == node->rb_parent->rb_left)
-        node = node->rb_parent;
-    return node;
+    struct rb_node* parent;
+    while((parent = node->rb_parent) && node == parent->rb_left)
+        node = parent;
+    return parent;
 }
 
 struct rb_node* rb_first(struct rb_root* root)
@@ -1,55 +1,232 @@
 #include "thread/threadpool.h"
 
 #include <cstring>
+#include <climits>
 
-ThreadPool::ThreadPool(int thread_count)
-    : m_isStop(false), m_threadCount(thread_count)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// 当前线程所属的线程池和在其中的下标, 不是工作线程时为nullptr
+static thread_local ThreadPool*     t_pool = nullptr;
+static thread_local int             t_index = -1;
+// 挑选偷任务对象用的随机数(xorshift), 每个线程一个
+static thread_local uint32_t        t_seed = 0;
+
+static uint32_t next_random()
 {
-    // 每个线程执行的函数
-    std::function<void()> func = [this](){
-        while(true)
-        {
-            m_semaphore.wait();
-            std::function<void()> task;
-            {
-                WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
-                if(m_taskQueue.empty())
-                {
-                    // 1. 任务全部执行完再退出, 将信号量清0
-                    // 2. 如果线程池没有执行完任务,就析构了。 可能导致std::future不可用。 出现异常 std::future_error: Broken promise
-                    if(m_isStop)
-                        return ;
-                    continue;
-                }
-                task = std::move(m_taskQueue.front());
-                m_taskQueue.pop();
-            }
-            task();
-        }
+    uint32_t x = t_seed ? t_seed : (uint32_t)(uintptr_t)&t_seed | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    t_seed = x;
+    return x;
+}
 
-    };
+static void futex_wait(std::atomic<uint32_t>* addr, uint32_t expected)
+{
+    // 值已经不是expected时立刻返回EAGAIN, 被信号打断时返回EINTR; 调用方都会重新检查
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>* addr, int count)
+{
+    syscall(SYS_futex, (uint32_t*)addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
 
+ThreadPool::ThreadPool(int thread_count)
+    : m_isStop(false), m_threadCount(thread_count > 0 ? thread_count : 1),
+      m_workers(new Worker[m_threadCount]), m_next(0), m_sleepers(0)
+{
     // 创建指定数目线程
     std::string name = "worker_";
     for(int i = 0; i < m_threadCount; ++i)
     {
-        WebServer::Thread::ptr p = std::make_shared<WebServer::Thread>(func, name + std::to_string(i));
+        WebServer::Thread::ptr p = std::make_shared<WebServer::Thread>([this, i](){ _run(i); }, name + std::to_string(i));
         m_vctThreads.push_back(p);
     }
 }
 
 ThreadPool::~ThreadPool()
 {
+    m_isStop.store(true, std::memory_order_seq_cst);
+    // 唤醒所有睡眠的线程, 它们把剩下的任务执行完再退出
+    for(int i = 0; i < m_threadCount; ++i)
     {
-        WebServer::ScopedLock<WebServer::Mutex> lk(m_mtx);
-        m_isStop = true;
+        m_workers[i].futex.store(1, std::memory_order_release);
+        futex_wake(&m_workers[i].futex, 1);
     }
-    for(int i = 0; i < m_threadCount; ++i)
-        m_semaphore.notify();
     for(size_t i = 0; i < m_vctThreads.size(); ++i)
-    {
         m_vctThreads[i]->join();
-        --m_threadCount;
-    }
     m_vctThreads.clear();
-}
\ No newline at end of file
+
+    // 和析构同时调用的addTask可能在工作线程退出之后才放进任务, 在这里执行掉, 否则std::future会抛出broken promise
+    for(int i = 0; i < m_threadCount; ++i)
+    {
+        Task* task;
+        while(m_workers[i].deque.steal(task))
+        {
+            task->func();
+            delete task;
+        }
+        task = m_workers[i].inbox.exchange(nullptr, std::memory_order_acquire);
+        Task* fifo = nullptr;
+        while(task)
+        {
+            Task* next = task->next;
+            task->next = fifo;
+            fifo = task;
+            task = next;
+        }
+        while(fifo)
+        {
+            Task* next = fifo->next;
+            fifo->func();
+            delete fifo;
+            fifo = next;
+        }
+    }
+    delete[] m_workers;
+}
+
+void ThreadPool::_submit(Task* task)
+{
+    bool inWorker = t_pool == this;
+    if(!inWorker && m_isStop.load(std::memory_order_acquire))
+    {
+        delete task;
+        throw std::logic_error("thread pool stopping! push task failed!");
+    }
+    if(inWorker)
+    {
+        // 工作线程中提交的任务(任务中再添加任务), 放进自己的队列, 不需要任何竞争
+        m_workers[t_index].deque.push(task);
+    }
+    else
+    {
+        Worker& worker = m_workers[m_next.fetch_add(1, std::memory_order_relaxed) % m_threadCount];
+        Task* head = worker.inbox.load(std::memory_order_relaxed);
+        do
+        {
+            task->next = head;
+        } while(!worker.inbox.compare_exchange_weak(head, task, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // 和_park()中的先增加m_sleepers再检查任务配对: 要么这里看到有线程在睡眠, 要么睡眠的线程看到这个任务
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_sleepers.load(std::memory_order_seq_cst) > 0)
+        _wakeOne();
+}
+
+void ThreadPool::_run(int index)
+{
+    t_pool = this;
+    t_index = index;
+    t_seed = (uint32_t)index * 2654435761U + 1;
+
+    Worker& self = m_workers[index];
+    while(true)
+    {
+        Task* task = _findTask(index);
+        if(task)
+        {
+            task->func();
+            delete task;
+            continue;
+        }
+        if(m_isStop.load(std::memory_order_acquire))
+        {
+            // 任务全部执行完再退出; 偷任务时竞争失败也会返回nullptr, 所以要再确认一次
+            if(!_hasWork())
+                break;
+            continue;
+        }
+        _park(self);
+    }
+}
+
+ThreadPool::Task* ThreadPool::_findTask(int index)
+{
+    Worker& self = m_workers[index];
+    Task* task;
+    if(self.deque.pop(task))
+        return task;
+    if(self.inbox.load(std::memory_order_relaxed) && (task = _takeInbox(self, self)))
+        return task;
+
+    // 从随机的位置开始, 依次尝试从其它线程偷
+    int start = (int)(next_random() % (uint32_t)m_threadCount);
+    for(int i = 0; i < m_threadCount; ++i)
+    {
+        int victim = start + i < m_threadCount ? start + i : start + i - m_threadCount;
+        if(victim == index)
+            continue;
+        Worker& worker = m_workers[victim];
+        if(worker.deque.steal(task))
+            return task;
+        if(worker.inbox.load(std::memory_order_relaxed) && (task = _takeInbox(worker, self)))
+            return task;
+    }
+    return nullptr;
+}
+
+ThreadPool::Task* ThreadPool::_takeInbox(Worker& worker, Worker& self)
+{
+    // 整个取出, 多个线程同时取也没有ABA问题
+    Task* task = worker.inbox.exchange(nullptr, std::memory_order_acquire);
+    if(!task)
+        return nullptr;
+    // 栈是后进先出的, 反转成提交的顺序
+    Task* fifo = nullptr;
+    while(task)
+    {
+        Task* next = task->next;
+        task->next = fifo;
+        fifo = task;
+        task = next;
+    }
+    Task* first = fifo;
+    for(task = fifo->next; task; task = task->next)
+        self.deque.push(task);
+    return first;
+}
+
+bool ThreadPool::_hasWork() const
+{
+    for(int i = 0; i < m_threadCount; ++i)
+    {
+        if(!m_workers[i].deque.empty() || m_workers[i].inbox.load(std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::_park(Worker& self)
+{
+    self.futex.store(0, std::memory_order_relaxed);
+    m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // 增加m_sleepers之后提交的任务一定会唤醒某个线程, 之前提交的这里一定能看到
+    if(!_hasWork() && !m_isStop.load(std::memory_order_seq_cst))
+    {
+        while(self.futex.load(std::memory_order_acquire) == 0)
+            futex_wait(&self.futex, 0);
+    }
+    self.futex.store(1, std::memory_order_relaxed);
+    m_sleepers.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void ThreadPool::_wakeOne()
+{
+    int start = t_pool == this ? t_index : (int)(next_random() % (uint32_t)m_threadCount);
+    for(int i = 0; i < m_threadCount; ++i)
+    {
+        int index = start + i < m_threadCount ? start + i : start + i - m_threadCount;
+        std::atomic<uint32_t>& futex = m_workers[index].futex;
+        if(futex.load(std::memory_order_relaxed) == 0 && futex.exchange(1, std::memory_order_acq_rel) == 0)
+        {
+            futex_wake(&futex, 1);
+            return;
+        }
+    }
+}
@@ -3,7 +3,10 @@
 #include <cstddef>
 #include <cstring>
 #include <climits>
+#include <new>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 
 #include "util/util.h"
 
@@ -14,74 +17,124 @@
 }while(0)
 
 /**
- *@brief 获取当前纳秒绝对时间(系统时间), 并且设置到 ABSTIME 对象中去, 是一个 timespec 结构体
- * 注意: 这里使用的是系统时间, 也就是说修改系统时间, 可能影响定时器;
+ *@brief 获取当前纳秒绝对时间(单调时间), 并且设置到 ABSTIME 对象中去, 是一个 timespec 结构体
+ * 注意: mysql这里使用的是系统时间, 修改系统时间会让所有定时器一起提前或者推迟; 这里改成了CLOCK_MONOTONIC,
+ * 工作线程的条件变量也设置成CLOCK_MONOTONIC(见_init)
  */
-#define set_timespec_nsec(ABSTIME, NSEC) set_timespec_time_nsec(ABSTIME, util::get_real_time_nsec() + (NSEC))
+#define set_timespec_nsec(ABSTIME, NSEC) set_timespec_time_nsec(ABSTIME, util::get_monotonic_time_nsec() + (NSEC))
 
 #define set_timespec(ABSTIME,SEC) set_timespec_nsec((ABSTIME),(SEC)*1000000000ULL)
 
 #define set_max_time(abs_time) \
   { (abs_time)->tv_sec= INT_MAX; (abs_time)->tv_nsec= 0; }
 
-static int compare_timespec(void* not_used __attribute__((unused)),
-    unsigned char* left, unsigned char* right)
-{
-    return cmp_timespec((*(struct timespec*)left), (*(struct timespec*)right));
-}
+#define timespec_to_nsec(TS) ((TS).tv_sec * 1000000000ULL + (TS).tv_nsec)
 
-static thr_timer_t max_timer_data;
-
-TimerManager::TimerManager(unsigned int init_size_for_timer_queue)
+TimerManager::TimerManager(unsigned int init_size_for_timer_queue, Backend backend, bool own_thread)
+    : m_ownThread(own_thread), m_inited(false),
+      m_timerQueue(init_size_for_timer_queue + 2, init_size_for_timer_queue),
+      m_wheel(nullptr), m_cancelHead(nullptr), m_slack(0),
+      m_freeBuckets(nullptr), m_dueTail(&m_dueList.wheel_next), m_timerFd(-1), m_timerFdExpire(UINT64_MAX)
 {
-    init_queue(&m_timerQueue, init_size_for_timer_queue + 2, offsetof(thr_timer_t, expire_time),
-        0, compare_timespec, NULL, offsetof(thr_timer_t, index_in_queue) + 1, 1);
-    
+    bzero(m_bucketCache, sizeof(m_bucketCache));
+    bzero(&m_dueList, sizeof(m_dueList));
+    if(backend == WHEEL)
+        m_wheel = new TimerWheel(util::get_monotonic_time_nsec());
+
     // Set dummy element with max time into the queue to simplify usage
-    bzero(&max_timer_data, sizeof(max_timer_data));
-    set_max_time(&max_timer_data.expire_time);
-    queue_insert(&m_timerQueue, (unsigned char*) &max_timer_data);
-    m_nextTimerExpireTime = max_timer_data.expire_time;
+    bzero(&m_maxTimer, sizeof(m_maxTimer));
+    set_max_time(&m_maxTimer.expire_time);
+    m_timerQueue.insert(&m_maxTimer, UINT64_MAX);
+    m_nextTimerExpireTime = m_maxTimer.expire_time;
 
-    _init();
+    if(m_ownThread)
+        _init();
 }
 
 TimerManager::~TimerManager()
 {
-    if(m_inited)
+    if(m_ownThread)
     {
-        pthread_mutex_lock(&m_timerMtx);
-        m_inited = false;
-        pthread_cond_signal(&m_timerCond); // 唤醒工作线程准备退出
-        pthread_mutex_unlock(&m_timerMtx); // 别忘记解锁, 不然下面的pthread_mutex_destroy能成功吗?
-
-        pthread_join(m_thread, NULL);
+        if(m_inited)
+        {
+            pthread_mutex_lock(&m_timerMtx);
+            m_inited = false;
+            pthread_cond_signal(&m_timerCond); // 唤醒工作线程准备退出
+            pthread_mutex_unlock(&m_timerMtx); // 别忘记解锁, 不然下面的pthread_mutex_destroy能成功吗?
 
+            pthread_join(m_thread, NULL);
+        }
         pthread_mutex_destroy(&m_timerMtx);
         pthread_cond_destroy(&m_timerCond);
-        delete_queue(&m_timerQueue);
     }
+    if(m_timerFd != -1)
+        close(m_timerFd);
+    // 还有定时器没到期时, 堆中可能还有桶
+    for(size_t i = 0; i < m_timerQueue.size(); ++i)
+    {
+        thr_timer_t* bucket = m_timerQueue.element(i);
+        if(bucket->bucket == bucket)
+            delete bucket;
+    }
+    while(m_freeBuckets)
+    {
+        thr_timer_t* next = m_freeBuckets->wheel_next;
+        delete m_freeBuckets;
+        m_freeBuckets = next;
+    }
+    delete m_wheel;
+}
+
+void TimerManager::setSlack(unsigned long long micro_seconds)
+{
+    _lock();
+    m_slack = micro_seconds * 1000;
+    // 已经有的桶不再放新的定时器, 它们会正常到期
+    bzero(m_bucketCache, sizeof(m_bucketCache));
+    _unlock();
 }
 
 bool TimerManager::addTimer(thr_timer_t* timer_data, unsigned long long micro_seconds)
 {
-    set_timespec_nsec(timer_data->expire_time, micro_seconds * 1000);
+    unsigned long long expire = util::get_monotonic_time_nsec() + micro_seconds * 1000;
     timer_data->expired = 0;
 
-    pthread_mutex_lock(&m_timerMtx);
-    if(queue_insert_safe(&m_timerQueue, (unsigned char*)timer_data))
+    _lock();
+    // 向上取整, 同一个窗口内到期的定时器到期时间都相同
+    if(m_slack)
+        expire = (expire + m_slack - 1) / m_slack * m_slack;
+    set_timespec_time_nsec(timer_data->expire_time, expire);
+    if(m_wheel)
+        m_wheel->add(timer_data);
+    else if(!_heapInsert(timer_data))
     {
         /**
          * @todo: 加错误日志
          */
         timer_data->expired = 1;
-        pthread_mutex_unlock(&m_timerMtx);
+        _unlock();
         return false;
     }
+    if(!m_ownThread)
+    {
+        if(m_timerFd != -1)
+        {
+            uint64_t expire = timer_data->expire_time.tv_sec * 1000000000ULL + timer_data->expire_time.tv_nsec;
+            if(m_wheel)
+            {
+                // 时间轮在tick的边界才会到期, 早醒来也没有用
+                uint64_t tick = m_wheel->tickNsec();
+                expire = (expire + tick - 1) / tick * tick;
+            }
+            if(expire < m_timerFdExpire)
+                _armTimerFd(expire);
+        }
+        return true;
+    }
 
     // 是否需要重新设置条件变量等待时间? 
     int reSchedule = cmp_timespec(m_nextTimerExpireTime, timer_data->expire_time);
-    pthread_mutex_unlock(&m_timerMtx);
+    _unlock();
     if(reSchedule > 0)
     {
         pthread_cond_signal(&m_timerCond);
@@ -92,18 +145,150 @@ bool TimerManager::addTimer(thr_timer_t* timer_data, unsigned long long micro_se
 
 void TimerManager::removeTimer(thr_timer_t *timer_data)
 {
-    pthread_mutex_lock(&m_timerMtx);
+    _lock();
     // 已经过期的定时器就不用管了, 否则就去移除它;
     if(!timer_data->expired)
     {
         /**
          * @todo: mysql源码这里有断言, 先忽略吧, 我没有实现动态断言函数
-         * assert( queue_element(&m_timerQueue, timer_data->index_in_queue) == (unsigned char*)timer_data);
+         * assert(m_timerQueue.element(timer_data->index_in_queue) == timer_data);
          */
-        queue_remove(&m_timerQueue, timer_data->index_in_queue);
+        if(m_wheel)
+            m_wheel->remove(timer_data);
+        else
+            _heapRemove(timer_data);
         timer_data->expired = true;
     }
-    pthread_mutex_unlock(&m_timerMtx);
+    _unlock();
+}
+
+void TimerManager::cancelTimer(thr_timer_t *timer_data)
+{
+    if(m_ownThread)
+    {
+        removeTimer(timer_data);
+        return;
+    }
+    // 已经在取消队列中了, 不能再放一次(会把链表连成环)
+    if(__atomic_exchange_n(&timer_data->cancel_pending, 1, __ATOMIC_ACQ_REL))
+        return;
+    thr_timer_t* head = m_cancelHead.load(std::memory_order_relaxed);
+    do
+    {
+        timer_data->cancel_next = head;
+    } while(!m_cancelHead.compare_exchange_weak(head, timer_data,
+                std::memory_order_release, std::memory_order_relaxed));
+}
+
+void TimerManager::_drainCancels()
+{
+    thr_timer_t* timer_data = m_cancelHead.exchange(nullptr, std::memory_order_acquire);
+    while(timer_data)
+    {
+        // 清掉标记之后其它线程可能马上再把它放进队列, 先取出next
+        thr_timer_t* next = timer_data->cancel_next;
+        __atomic_store_n(&timer_data->cancel_pending, 0, __ATOMIC_RELEASE);
+        removeTimer(timer_data);
+        timer_data = next;
+    }
+}
+
+int TimerManager::processTimers()
+{
+    if(m_timerFd != -1)
+    {
+        // 读掉计数, 否则一直可读; 回调中添加的定时器要重新设置timerfd
+        // 非阻塞的timerfd只会返回EAGAIN(还没有到期就被唤醒), 这时也照常检查, 不需要处理
+        uint64_t expirations;
+        ssize_t n = read(m_timerFd, &expirations, sizeof(expirations));
+        (void)n;
+        m_timerFdExpire = UINT64_MAX;
+    }
+    if(m_cancelHead.load(std::memory_order_relaxed))
+        _drainCancels();
+
+    int count = 0;
+    uint64_t now = util::get_monotonic_time_nsec();
+    if(m_wheel)
+    {
+        m_wheel->advance(now);
+        // 每次只取出一个, 回调中删除同一批到期的其它定时器也没问题
+        while(thr_timer_t* timer_data = m_wheel->popDue())
+        {
+            timer_data->expired = true;
+            (*timer_data->func)(timer_data->func_args);
+            ++count;
+        }
+    }
+    else
+    {
+        struct timespec now_time;
+        set_timespec_time_nsec(now_time, now);
+        _heapHarvest(now_time);
+        while(thr_timer_t* timer_data = m_dueList.wheel_next)
+        {
+            _heapRemove(timer_data);
+            timer_data->expired = true;
+            (*timer_data->func)(timer_data->func_args);
+            ++count;
+        }
+    }
+
+    if(m_timerFd != -1)
+    {
+        uint64_t next = _nextExpireNsec();
+        if(next < m_timerFdExpire)
+            _armTimerFd(next);
+    }
+    return count;
+}
+
+uint64_t TimerManager::_nextExpireNsec()
+{
+    if(m_wheel)
+        return m_wheel->nextExpire();
+    if(m_dueList.wheel_next)
+        return 0;
+    // 哨兵的键值就是UINT64_MAX
+    return m_timerQueue.topKey();
+}
+
+int TimerManager::timerFd()
+{
+    if(m_ownThread || m_timerFd != -1)
+        return m_timerFd;
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timerFd == -1)
+        return -1;
+    uint64_t next = _nextExpireNsec();
+    if(next != UINT64_MAX)
+        _armTimerFd(next);
+    return m_timerFd;
+}
+
+void TimerManager::_armTimerFd(uint64_t expire_nsec)
+{
+    // it_value全为0表示停止timerfd, 时间已经过去的话会立刻可读
+    if(expire_nsec == 0)
+        expire_nsec = 1;
+    struct itimerspec spec;
+    bzero(&spec, sizeof(spec));
+    set_timespec_time_nsec(spec.it_value, expire_nsec);
+    if(timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, NULL) == 0)
+        m_timerFdExpire = expire_nsec;
+}
+
+int TimerManager::nextTimeoutMs()
+{
+    uint64_t next = _nextExpireNsec();
+    if(next == UINT64_MAX)
+        return -1;
+
+    uint64_t now = util::get_monotonic_time_nsec();
+    if(next <= now)
+        return 0;
+    uint64_t ms = (next - now + 999999) / 1000000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
 }
 
 
@@ -116,7 +301,12 @@ bool TimerManager::_init()
     pthread_mutex_init(&m_timerMtx, &fast_mutex);
     pthread_mutexattr_destroy(&fast_mutex);
 
-    pthread_cond_init(&m_timerCond, NULL);
+    // pthread_cond_timedwait默认用CLOCK_REALTIME, 要和expire_time一致
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m_timerCond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
 
     pthread_attr_t thr_attr;
     pthread_attr_init(&thr_attr);
@@ -130,31 +320,159 @@ bool TimerManager::_init()
     if(0 != pthread_create(&m_thread, &thr_attr, &_timerHandler, this))
     {
         m_inited = false;
-        pthread_mutex_destroy(&m_timerMtx);
-        pthread_cond_destroy(&m_timerCond);
-        delete_queue(&m_timerQueue);
     }
     pthread_attr_destroy(&thr_attr);
     return m_inited;
 }
 
+bool TimerManager::_heapInsert(thr_timer_t* timer_data)
+{
+    if(!m_slack)
+    {
+        timer_data->bucket = NULL;
+        return m_timerQueue.insert(timer_data, timespec_to_nsec(timer_data->expire_time));
+    }
+
+    uint64_t expire = timer_data->expire_time.tv_sec * 1000000000ULL + timer_data->expire_time.tv_nsec;
+    thr_timer_t** cached = &m_bucketCache[(expire / m_slack) % BUCKET_CACHE_SIZE];
+    thr_timer_t* bucket = *cached;
+    if(!bucket || cmp_timespec(bucket->expire_time, timer_data->expire_time) != 0)
+    {
+        // 没有这个到期时间的桶(或者被其它桶挤出了缓存), 新建一个放进堆中
+        bucket = _newBucket();
+        if(!bucket)
+            return false;
+        bucket->expire_time = timer_data->expire_time;
+        if(!m_timerQueue.insert(bucket, expire))
+        {
+            _freeBucket(bucket);
+            return false;
+        }
+        *cached = bucket;
+    }
+
+    timer_data->wheel_next = bucket->wheel_next;
+    if(timer_data->wheel_next)
+        timer_data->wheel_next->wheel_pprev = &timer_data->wheel_next;
+    timer_data->wheel_pprev = &bucket->wheel_next;
+    bucket->wheel_next = timer_data;
+    timer_data->bucket = bucket;
+    return true;
+}
+
+void TimerManager::_heapRemove(thr_timer_t* timer_data)
+{
+    thr_timer_t* bucket = timer_data->bucket;
+    if(!bucket)
+    {
+        m_timerQueue.remove(timer_data->index_in_queue);
+        return;
+    }
+
+    if(m_dueTail == &timer_data->wheel_next)
+        m_dueTail = timer_data->wheel_pprev;
+    *timer_data->wheel_pprev = timer_data->wheel_next;
+    if(timer_data->wheel_next)
+        timer_data->wheel_next->wheel_pprev = timer_data->wheel_pprev;
+    timer_data->wheel_next = NULL;
+    timer_data->wheel_pprev = NULL;
+    timer_data->bucket = NULL;
+    // 桶空了就从堆中删掉
+    if(bucket != &m_dueList && !bucket->wheel_next)
+    {
+        m_timerQueue.remove(bucket->index_in_queue);
+        _freeBucket(bucket);
+    }
+}
+
+void TimerManager::_heapHarvest(const struct timespec& now)
+{
+    uint64_t now_nsec = timespec_to_nsec(now);
+    // 哨兵永远不会到期, 所以这里一定会退出
+    while(m_timerQueue.topKey() <= now_nsec)
+    {
+        thr_timer_t* top = m_timerQueue.removeTop();
+
+        // 整个桶一次性取出, 只调整一次堆
+        thr_timer_t* timer_data = top->bucket == top ? top->wheel_next : top;
+        while(timer_data)
+        {
+            thr_timer_t* next = top->bucket == top ? timer_data->wheel_next : NULL;
+            timer_data->wheel_next = NULL;
+            timer_data->wheel_pprev = m_dueTail;
+            timer_data->bucket = &m_dueList;
+            *m_dueTail = timer_data;
+            m_dueTail = &timer_data->wheel_next;
+            timer_data = next;
+        }
+        if(top->bucket == top)
+        {
+            top->wheel_next = NULL;
+            _freeBucket(top);
+        }
+    }
+}
+
+thr_timer_t* TimerManager::_newBucket()
+{
+    thr_timer_t* bucket = m_freeBuckets;
+    if(bucket)
+        m_freeBuckets = bucket->wheel_next;
+    else
+    {
+        bucket = new (std::nothrow) thr_timer_t;
+        if(!bucket)
+            return NULL;
+    }
+    bzero(bucket, sizeof(*bucket));
+    bucket->bucket = bucket;
+    return bucket;
+}
+
+void TimerManager::_freeBucket(thr_timer_t* bucket)
+{
+    uint64_t expire = bucket->expire_time.tv_sec * 1000000000ULL + bucket->expire_time.tv_nsec;
+    // setSlack()会清空缓存, 所以缓存中的桶一定是按当前的m_slack放进去的
+    if(m_slack)
+    {
+        thr_timer_t** cached = &m_bucketCache[(expire / m_slack) % BUCKET_CACHE_SIZE];
+        if(*cached == bucket)
+            *cached = NULL;
+    }
+    bucket->wheel_next = m_freeBuckets;
+    m_freeBuckets = bucket;
+}
+
 void TimerManager::_processTimers(struct timespec* now)
 {
-    while(true)
+    // 先取出所有到期的定时器, 再逐个执行; 回调中删除的定时器会从到期链表中移除, 不会再执行
+    _heapHarvest(*now);
+    while(thr_timer_t* timer_data = m_dueList.wheel_next)
     {
-        thr_timer_t* timer_data = (thr_timer_t*)queue_top(&m_timerQueue);
-        void (*func)(void*) = timer_data->func;
-        void *func_arg = timer_data->func_args;
+        _heapRemove(timer_data);
         timer_data->expired = true;
+        (*timer_data->func)(timer_data->func_args);
+    }
+}
 
-        queue_remove_top(&m_timerQueue);
-        (*func)(func_arg);
+struct timespec TimerManager::_processWheel(struct timespec* now)
+{
+    m_wheel->advance(now->tv_sec * 1000000000ULL + now->tv_nsec);
+    while(thr_timer_t* timer_data = m_wheel->popDue())
+    {
+        timer_data->expired = true;
+        (*timer_data->func)(timer_data->func_args);
+    }
 
-        timer_data = (thr_timer_t*) queue_top(&m_timerQueue);
-        // cmp_timespec是个宏, 所以 *now 必须加上括号, * 的优先级低
-        if(cmp_timespec(timer_data->expire_time, (*now)) > 0)
-            break;
+    struct timespec next_time;
+    uint64_t next_nsec = m_wheel->nextExpire();
+    if(next_nsec == UINT64_MAX)
+    {
+        set_max_time(&next_time);
     }
+    else
+        set_timespec_time_nsec(next_time, next_nsec);
+    return next_time;
 }
 
 void* TimerManager::_timerHandler(void* arg)
@@ -164,20 +482,28 @@ void* TimerManager::_timerHandler(void* arg)
     while(manager->m_inited)
     {
         struct timespec now;
-        clock_gettime(CLOCK_REALTIME, &now);
-        struct timespec *topTime = &(((thr_timer_t*)queue_top(&manager->m_timerQueue))->expire_time);
-        if(cmp_timespec((*topTime), now) <= 0)
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(manager->m_wheel)
+        {
+            // 时间轮: 转到当前时间, 执行到期的定时器
+            manager->m_nextTimerExpireTime = manager->_processWheel(&now);
+        }
+        else
         {
-            // 堆顶定时器到期时间点 <= 当前时间点; 说明任务已到期, 需要去执行任务
-            manager->_processTimers(&now);
-            topTime = &(((thr_timer_t*)queue_top(&manager->m_timerQueue))->expire_time);
+            struct timespec *topTime = &(manager->m_timerQueue.top()->expire_time);
+            if(cmp_timespec((*topTime), now) <= 0)
+            {
+                // 堆顶定时器到期时间点 <= 当前时间点; 说明任务已到期, 需要去执行任务
+                manager->_processTimers(&now);
+                topTime = &(manager->m_timerQueue.top()->expire_time);
+            }
+            manager->m_nextTimerExpireTime = *topTime;
         }
-        manager->m_nextTimerExpireTime = *topTime;
         /**
          * @brief 不确定pthread_cond_timedwait会不会修改第三个参数内容, 所以创建临时变量传进入; 而不是直接传 m_nextTimerExpireTime
          * 反过来说, cond已经阻塞, 结果 m_nextTimerExpireTime 在其它地方被修改了, 此时会发生什么?? 也很危险; 所以不要干这种事
          */
-        struct timespec abstime = *topTime;
+        struct timespec abstime = manager->m_nextTimerExpireTime;
         int error = pthread_cond_timedwait(&manager->m_timerCond, &manager->m_timerMtx, &abstime);
         //  不清楚mariadb为什么要判断 ETIME, pthread_cond_timedwait文档中没说会返回 ETIME
         if(error && /*error != ETIME &&*/ error != ETIMEDOUT)
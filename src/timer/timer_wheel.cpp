@@ -0,0 +1,170 @@
+#include "timer/timer_wheel.h"
+
+#include <cstring>
+
+#include "timer/thr_timer.h"
+
+TimerWheel::TimerWheel(uint64_t now_nsec, uint64_t tick_nsec)
+    : m_tick(tick_nsec ? tick_nsec : 1), m_count(0), m_due(nullptr), m_dueTail(&m_due)
+{
+    m_current = now_nsec / m_tick;
+    memset(m_levelCount, 0, sizeof(m_levelCount));
+    memset(m_level0, 0, sizeof(m_level0));
+    memset(m_levels, 0, sizeof(m_levels));
+}
+
+uint64_t TimerWheel::_tickOf(const thr_timer* timer) const
+{
+    uint64_t nsec = timer->expire_time.tv_sec * 1000000000ULL + timer->expire_time.tv_nsec;
+    // 向上取整, 保证不会提前到期
+    return (nsec + m_tick - 1) / m_tick;
+}
+
+void TimerWheel::_link(thr_timer* timer, int level, uint64_t slot)
+{
+    thr_timer** head = level == 0 ? &m_level0[slot] : &m_levels[level - 1][slot];
+    timer->wheel_next = *head;
+    if(*head)
+        (*head)->wheel_pprev = &timer->wheel_next;
+    timer->wheel_pprev = head;
+    timer->wheel_level = level;
+    *head = timer;
+    ++m_levelCount[level];
+}
+
+void TimerWheel::add(thr_timer* timer)
+{
+    uint64_t tick = _tickOf(timer);
+    if(tick < m_current)
+        tick = m_current;
+    uint64_t delta = tick - m_current;
+    if(delta >= MAX_TICKS)
+    {
+        // 超出范围, 先放在最高层最远的槽, 转到时再重新放置
+        delta = MAX_TICKS - 1;
+        tick = m_current + delta;
+    }
+
+    if(delta < LEVEL0_SIZE)
+        _link(timer, 0, tick & LEVEL0_MASK);
+    else
+    {
+        int level = 1;
+        int shift = LEVEL0_BITS;
+        while(level < LEVELS - 1 && delta >= ((uint64_t)1 << (shift + LEVEL_BITS)))
+        {
+            ++level;
+            shift += LEVEL_BITS;
+        }
+        _link(timer, level, (tick >> shift) & LEVEL_MASK);
+    }
+    ++m_count;
+}
+
+void TimerWheel::remove(thr_timer* timer)
+{
+    if(m_dueTail == &timer->wheel_next)
+        m_dueTail = timer->wheel_pprev;
+    *timer->wheel_pprev = timer->wheel_next;
+    if(timer->wheel_next)
+        timer->wheel_next->wheel_pprev = timer->wheel_pprev;
+    timer->wheel_next = nullptr;
+    timer->wheel_pprev = nullptr;
+    --m_levelCount[timer->wheel_level];
+    --m_count;
+}
+
+void TimerWheel::_cascade()
+{
+    // 第1层的槽转完一圈(下标回到0)时, 第2层也要转一格, 依此类推
+    int shift = LEVEL0_BITS;
+    for(int level = 1; level < LEVELS; ++level, shift += LEVEL_BITS)
+    {
+        uint64_t slot = (m_current >> shift) & LEVEL_MASK;
+        thr_timer* timer = m_levels[level - 1][slot];
+        m_levels[level - 1][slot] = nullptr;
+        while(timer)
+        {
+            thr_timer* next = timer->wheel_next;
+            --m_levelCount[level];
+            --m_count;
+            add(timer);
+            timer = next;
+        }
+        if(slot != 0)
+            break;
+    }
+}
+
+void TimerWheel::advance(uint64_t now_nsec)
+{
+    uint64_t target = now_nsec / m_tick;
+    while(m_current <= target)
+    {
+        if((m_current & LEVEL0_MASK) == 0)
+            _cascade();
+        if(m_count == m_levelCount[DUE_LEVEL])
+        {
+            // 轮上已经没有定时器了, 直接转到目标位置
+            m_current = target + 1;
+            break;
+        }
+        if(m_levelCount[0] == 0)
+        {
+            // 第0层没有定时器, 直接跳到下一次cascade(或者目标位置)
+            uint64_t next = (m_current | LEVEL0_MASK) + 1;
+            m_current = next < target + 1 ? next : target + 1;
+            continue;
+        }
+
+        // 整个槽接到到期链表的尾部
+        uint64_t slot = m_current & LEVEL0_MASK;
+        thr_timer* timer = m_level0[slot];
+        if(timer)
+        {
+            m_level0[slot] = nullptr;
+            *m_dueTail = timer;
+            timer->wheel_pprev = m_dueTail;
+            for(; timer; timer = timer->wheel_next)
+            {
+                timer->wheel_level = DUE_LEVEL;
+                --m_levelCount[0];
+                ++m_levelCount[DUE_LEVEL];
+                m_dueTail = &timer->wheel_next;
+            }
+        }
+        ++m_current;
+    }
+}
+
+thr_timer* TimerWheel::popDue()
+{
+    thr_timer* timer = m_due;
+    if(timer)
+        remove(timer);
+    return timer;
+}
+
+uint64_t TimerWheel::nextExpire() const
+{
+    if(m_count == 0)
+        return UINT64_MAX;
+    if(m_due)
+        return 0;
+    // 上层有定时器时, 最晚在第0层转完这一圈(下一次cascade, m_current本身可能就是)的时候醒来
+    uint64_t next = UINT64_MAX;
+    if(m_count > m_levelCount[0])
+        next = (m_current + LEVEL0_MASK) & ~LEVEL0_MASK;
+    if(m_levelCount[0] > 0)
+    {
+        for(uint64_t tick = m_current; tick < m_current + LEVEL0_SIZE && tick < next; ++tick)
+        {
+            if(m_level0[tick & LEVEL0_MASK])
+            {
+                next = tick;
+                break;
+            }
+        }
+    }
+    return next * m_tick;
+}
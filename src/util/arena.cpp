@@ -0,0 +1,113 @@
+#include "util/arena.h"
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace WebServer
+{
+    Arena::Arena(BufferPool* pool, size_t blockSize)
+        : m_pool(pool), m_blockSize(blockSize), m_blocks(nullptr), m_ptr(nullptr), m_end(nullptr), m_used(0)
+    {}
+
+    Arena::~Arena()
+    {
+        reset();
+    }
+
+    void Arena::setPool(BufferPool* pool)
+    {
+        reset();
+        m_pool = pool;
+    }
+
+    void* Arena::allocate(size_t n, size_t align)
+    {
+        uintptr_t mask = align - 1;
+        if(!m_ptr || (((uintptr_t)m_ptr + mask) & ~mask) + n > (uintptr_t)m_end)
+            _newBlock(n, align);
+        char* p = (char*)(((uintptr_t)m_ptr + mask) & ~mask);
+        m_ptr = p + n;
+        m_used += n;
+        return p;
+    }
+
+    char* Arena::dup(const char* data, size_t len)
+    {
+        char* p = (char*)allocate(len + 1, 1);
+        memcpy(p, data, len);
+        p[len] = '\0';
+        return p;
+    }
+
+    char* Arena::format(size_t& len, const char* fmt, ...)
+    {
+        // 先直接格式化到当前块剩下的空间中, 放不下时按实际长度重新分配
+        size_t room = m_ptr ? m_end - m_ptr : 0;
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(m_ptr, room, fmt, ap);
+        va_end(ap);
+        if(n < 0)
+            throw std::bad_alloc();
+        len = n;
+        if((size_t)n < room)
+        {
+            char* p = m_ptr;
+            m_ptr += n + 1;
+            m_used += n + 1;
+            return p;
+        }
+        char* p = (char*)allocate(n + 1, 1);
+        va_start(ap, fmt);
+        vsnprintf(p, n + 1, fmt, ap);
+        va_end(ap);
+        return p;
+    }
+
+    void Arena::reset()
+    {
+        while(m_blocks)
+        {
+            Block* next = m_blocks->next;
+            if(m_blocks->pooled)
+                m_pool->release((char*)m_blocks);
+            else
+                free(m_blocks);
+            m_blocks = next;
+        }
+        m_ptr = m_end = nullptr;
+        m_used = 0;
+    }
+
+    void Arena::_newBlock(size_t n, size_t align)
+    {
+        size_t need = sizeof(Block) + align - 1 + n;
+        size_t size = m_pool ? m_pool->blockSize() : m_blockSize;
+        Block* block;
+        if(need <= size && m_pool)
+        {
+            block = (Block*)m_pool->acquire();
+            if(!block)
+                throw std::bad_alloc();
+            block->pooled = true;
+        }
+        else
+        {
+            // 放不下的大分配单独占一块
+            if(need > size)
+                size = need;
+            block = (Block*)malloc(size);
+            if(!block)
+                throw std::bad_alloc();
+            block->pooled = false;
+        }
+        block->next = m_blocks;
+        m_blocks = block;
+        m_ptr = (char*)(block + 1);
+        m_end = (char*)block + size;
+    }
+}
@@ -0,0 +1,134 @@
+#include "util/buffer_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace WebServer
+{
+    BufferPool::BufferPool(size_t blockSize, size_t blocksPerSlab)
+        : m_blockSize(blockSize), m_blocksPerSlab(blocksPerSlab ? blocksPerSlab : 1)
+    {
+        // 块的起始地址保持16字节对齐
+        m_blockSize = (m_blockSize + 15) & ~(size_t)15;
+    }
+
+    BufferPool::~BufferPool()
+    {
+        for(char* slab : m_slabs)
+            free(slab);
+    }
+
+    char* BufferPool::acquire()
+    {
+        if(m_free.empty())
+        {
+            char* slab = (char*)malloc(m_blockSize * m_blocksPerSlab);
+            if(!slab)
+                return nullptr;
+            m_slabs.push_back(slab);
+            m_free.reserve(totalBlocks());
+            // 倒序入栈, 先用低地址的块
+            for(size_t i = m_blocksPerSlab; i > 0; --i)
+                m_free.push_back(slab + (i - 1) * m_blockSize);
+        }
+        char* block = m_free.back();
+        m_free.pop_back();
+        return block;
+    }
+
+    void BufferPool::release(char* block)
+    {
+        // 容量在acquire()时已经预留好了, 这里不会重新分配
+        m_free.push_back(block);
+    }
+
+
+    PooledBuffer::PooledBuffer(BufferPool* pool)
+        : m_pool(pool), m_data(nullptr), m_size(0), m_capacity(0), m_pooled(false)
+    {}
+
+    PooledBuffer::~PooledBuffer()
+    {
+        release();
+    }
+
+    void PooledBuffer::setPool(BufferPool* pool)
+    {
+        release();
+        m_pool = pool;
+    }
+
+    char* PooledBuffer::prepare(size_t n)
+    {
+        if(m_capacity - m_size < n)
+            _grow(m_size + n);
+        return m_data + m_size;
+    }
+
+    void PooledBuffer::append(const char* data, size_t len)
+    {
+        memcpy(prepare(len), data, len);
+        m_size += len;
+    }
+
+    void PooledBuffer::erase(size_t pos, size_t n)
+    {
+        if(pos >= m_size)
+            return;
+        if(n > m_size - pos)
+            n = m_size - pos;
+        memmove(m_data + pos, m_data + pos + n, m_size - pos - n);
+        m_size -= n;
+    }
+
+    void PooledBuffer::release()
+    {
+        if(m_data)
+        {
+            if(m_pooled)
+                m_pool->release(m_data);
+            else
+                free(m_data);
+        }
+        m_data = nullptr;
+        m_size = m_capacity = 0;
+        m_pooled = false;
+    }
+
+    void PooledBuffer::_grow(size_t need)
+    {
+        // 放得下时优先用池中的块
+        if(!m_data && m_pool && need <= m_pool->blockSize())
+        {
+            m_data = m_pool->acquire();
+            if(!m_data)
+                throw std::bad_alloc();
+            m_capacity = m_pool->blockSize();
+            m_pooled = true;
+            return;
+        }
+
+        size_t cap = m_capacity ? m_capacity * 2 : 1024;
+        while(cap < need)
+            cap *= 2;
+        char* data;
+        if(m_pooled)
+        {
+            data = (char*)malloc(cap);
+            if(!data)
+                throw std::bad_alloc();
+            memcpy(data, m_data, m_size);
+            m_pool->release(m_data);
+            m_pooled = false;
+        }
+        else
+        {
+            data = (char*)realloc(m_data, cap);
+            if(!data)
+                throw std::bad_alloc();
+        }
+        m_data = data;
+        m_capacity = cap;
+    }
+}
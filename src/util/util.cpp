@@ -1,7 +1,17 @@
 #include "util/util.h"
 
 #include <cstring>
+#include <ctime>
 #include <unordered_map>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <iterator>
+#include <cctype>
+#include <strings.h>
 
 #include <sys/time.h>
 #include <sys/stat.h>
@@ -14,7 +24,7 @@
 
 namespace util
 {
-    int socket_bind_listen(unsigned short port)
+    int socket_bind_listen(unsigned short port, int backlog, bool reuse_port)
     {
         // 检查端口号是否合法
         if (port <= 1024)
@@ -26,7 +36,15 @@ namespace util
         // 开启端口复用选项
         int optval = 1;
         if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) == -1)
+        {
+            close(listen_fd);
+            return -1;
+        }
+        if (reuse_port && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) == -1)
+        {
+            close(listen_fd);
             return -1;
+        }
 
         struct sockaddr_in server_addr;
         bzero(&server_addr, sizeof(server_addr));
@@ -34,11 +52,17 @@ namespace util
         server_addr.sin_addr.s_addr = INADDR_ANY;// IP地址
         server_addr.sin_port = htons(port);// 端口号
         if (bind(listen_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) == -1)
+        {
+            close(listen_fd);
             return -1;
+        }
 
-        /// 开始监听, nginx设置的backlog也是511
-        if (listen(listen_fd, 511) == -1)
+        /// 开始监听, nginx默认的backlog也是511
+        if (listen(listen_fd, backlog) == -1)
+        {
+            close(listen_fd);
             return -1;
+        }
         return listen_fd;
     }
 
@@ -54,31 +78,177 @@ namespace util
         return rc;
     }
 
-    std::string getMimeType(const std::string &suffix)
+    namespace
     {
-        static std::unordered_map<std::string, std::string> ma;
-        /// 初始化一下ma, 之后就只能读ma。
-        if (ma.empty())
+        struct MimeEntry
+        {
+            const char* suffix;
+            const char* type;
+        };
+
+        /// 内置的类型, 常量初始化, 不存在初始化顺序和多线程的问题
+        const MimeEntry BUILTIN_MIME_TYPES[] = {
+            {".html", "text/html"},
+            {".htm", "text/html"},
+            {".css", "text/css"},
+            {".js", "application/javascript"},
+            {".json", "application/json"},
+            {".xml", "application/xml"},
+            {".txt", "text/plain"},
+            {".c", "text/plain"},
+            {".avi", "video/x-msvideo"},
+            {".mp4", "video/mp4"},
+            {".mp3", "audio/mp3"},
+            {".bmp", "image/bmp"},
+            {".gif", "image/gif"},
+            {".png", "image/png"},
+            {".jpg", "image/jpeg"},
+            {".jpeg", "image/jpeg"},
+            {".svg", "image/svg+xml"},
+            {".webp", "image/webp"},
+            {".ico", "application/x-ico"},
+            {".doc", "application/msword"},
+            {".pdf", "application/pdf"},
+            {".gz", "application/x-gzip"},
+            {".wasm", "application/wasm"},
+            {".woff2", "font/woff2"},
+        };
+
+        /// 这个不在标准中, 默认当作文本文件, 可以直接展示
+        const char* const DEFAULT_MIME_TYPE = "text/plain";
+
+        /**
+         * @brief 开放寻址的哈希表, 建好之后只读; 后缀不区分大小写
+         * 扩展类型时建一张新表整体替换, 查找不需要加锁, 也不分配内存
+         */
+        class MimeTable
         {
-            /// 这个不在标准中, 默认当作文本文件, 可以直接展示
-            ma.insert(std::pair<std::string, std::string>("default", "text/plain"));
-            ma.insert(std::pair<std::string, std::string>(".html", "text/html"));
-            ma.insert(std::pair<std::string, std::string>(".htm", "text/html"));
-            ma.insert(std::pair<std::string, std::string>(".avi", "video/x-msvideo"));
-            ma.insert(std::pair<std::string, std::string>(".bmp", "timage/bmp"));
-            ma.insert(std::pair<std::string, std::string>(".c", "text/plain"));
-            ma.insert(std::pair<std::string, std::string>(".doc", "application/msword"));
-            ma.insert(std::pair<std::string, std::string>(".gif", "image/gif"));
-            ma.insert(std::pair<std::string, std::string>(".gz", "application/x-gzip"));
-            ma.insert(std::pair<std::string, std::string>(".ico", "application/x-ico"));
-            ma.insert(std::pair<std::string, std::string>(".png", "image/png"));
-            ma.insert(std::pair<std::string, std::string>(".txt", "text/plain"));
-            ma.insert(std::pair<std::string, std::string>(".mp3", "audio/mp3"));
+        public:
+            MimeTable(const MimeTable* base, const std::map<std::string, std::string>& extra)
+            {
+                std::vector<MimeEntry> entries;
+                if(base)
+                {
+                    for(const MimeEntry& e : base->m_slots)
+                    {
+                        if(e.suffix)
+                            entries.push_back(e);
+                    }
+                    m_strings = base->m_strings;
+                }
+                else
+                    entries.assign(std::begin(BUILTIN_MIME_TYPES), std::end(BUILTIN_MIME_TYPES));
+                for(const auto& item : extra)
+                {
+                    if(item.first.empty() || item.second.empty())
+                        continue;
+                    // 配置中的后缀可以不带'.'
+                    m_strings->push_back(item.first[0] == '.' ? item.first : "." + item.first);
+                    std::string& suffix = m_strings->back();
+                    for(char& c : suffix)
+                        c = tolower((unsigned char)c);
+                    m_strings->push_back(item.second);
+                    entries.push_back(MimeEntry{suffix.c_str(), m_strings->back().c_str()});
+                }
+
+                // 装载因子不超过1/4, 冲突很少, 基本上一次就能找到
+                size_t cap = 16;
+                while(cap < entries.size() * 4)
+                    cap <<= 1;
+                m_mask = cap - 1;
+                m_slots.assign(cap, MimeEntry{nullptr, nullptr});
+                for(const MimeEntry& e : entries)
+                {
+                    size_t len = strlen(e.suffix);
+                    size_t i = hash(e.suffix, len) & m_mask;
+                    // 同一个后缀后出现的覆盖前面的(配置覆盖内置)
+                    while(m_slots[i].suffix && !(strlen(m_slots[i].suffix) == len &&
+                                                 strncasecmp(m_slots[i].suffix, e.suffix, len) == 0))
+                        i = (i + 1) & m_mask;
+                    m_slots[i] = e;
+                }
+            }
+
+            const char* find(const char* suffix, size_t len) const
+            {
+                size_t i = hash(suffix, len) & m_mask;
+                while(m_slots[i].suffix)
+                {
+                    const char* s = m_slots[i].suffix;
+                    if(strncasecmp(s, suffix, len) == 0 && s[len] == '\0')
+                        return m_slots[i].type;
+                    i = (i + 1) & m_mask;
+                }
+                return nullptr;
+            }
+
+        private:
+            /// FNV-1a, 先转成小写
+            static size_t hash(const char* s, size_t len)
+            {
+                uint32_t h = 2166136261u;
+                for(size_t i = 0; i < len; ++i)
+                {
+                    h ^= (unsigned char)tolower((unsigned char)s[i]);
+                    h *= 16777619u;
+                }
+                return h;
+            }
+
+        private:
+            std::vector<MimeEntry>                      m_slots;
+            size_t                                      m_mask;
+            /// 配置中的字符串; 新表和旧表共用, 旧表中的指针一直有效
+            std::shared_ptr<std::deque<std::string> >   m_strings = std::make_shared<std::deque<std::string> >();
+        };
+
+        std::atomic<const MimeTable*> g_mime_table(nullptr);
+        std::mutex g_mime_mutex;    // 只用于串行化addMimeTypes
+
+        const MimeTable* mime_table()
+        {
+            const MimeTable* table = g_mime_table.load(std::memory_order_acquire);
+            if(table)
+                return table;
+            // 第一次使用, 用内置类型建表; 局部静态变量的初始化是线程安全的
+            static const MimeTable builtin(nullptr, std::map<std::string, std::string>());
+            const MimeTable* expected = nullptr;
+            g_mime_table.compare_exchange_strong(expected, &builtin, std::memory_order_acq_rel);
+            return g_mime_table.load(std::memory_order_acquire);
         }
-        auto it = ma.find(suffix);
-        if (it != ma.end())
-            return it->second;
-        return ma["default"];
+    }
+
+    const char* getMimeType(const char* suffix, size_t len)
+    {
+        if(len == 7 && memcmp(suffix, "default", 7) == 0)
+            return DEFAULT_MIME_TYPE;
+        const char* type = mime_table()->find(suffix, len);
+        return type ? type : DEFAULT_MIME_TYPE;
+    }
+
+    const char* getMimeType(const std::string &suffix)
+    {
+        return getMimeType(suffix.data(), suffix.size());
+    }
+
+    const char* getMimeTypeByPath(const std::string& path)
+    {
+        // 只看最后一个'/'之后的部分, 目录名中的'.'不算后缀
+        size_t slash = path.rfind('/');
+        size_t dot = path.rfind('.');
+        if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            return DEFAULT_MIME_TYPE;// 无后缀, 当作文本文件展示
+        return getMimeType(path.data() + dot, path.size() - dot);
+    }
+
+    void addMimeTypes(const std::map<std::string, std::string>& types)
+    {
+        if(types.empty())
+            return;
+        std::lock_guard<std::mutex> lk(g_mime_mutex);
+        // 旧表不释放: 其它线程可能还在读; 只在加载配置时调用, 泄漏的内存可以忽略
+        const MimeTable* table = new MimeTable(mime_table(), types);
+        g_mime_table.store(table, std::memory_order_release);
     }
 
     int readn(int fd, char *buf, size_t size)
@@ -119,7 +289,7 @@ namespace util
         int num = 0;
         while (size > 0)
         {
-            num = write(fd, buf, size);
+            num = write(fd, buf + total, size);
             if (num > 0)
             {
                 size -= num;
@@ -154,6 +324,13 @@ namespace util
         return tp.tv_sec*1000000000ULL + (unsigned long long)tp.tv_nsec;
     }
 
+    std::uint64_t get_monotonic_time_nsec()
+    {
+        struct timespec tp;
+        clock_gettime(CLOCK_MONOTONIC, &tp);
+        return tp.tv_sec*1000000000ULL + (unsigned long long)tp.tv_nsec;
+    }
+
     pid_t getThreadID()
     {
         return (pid_t)syscall(SYS_gettid);
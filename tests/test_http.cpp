@@ -0,0 +1,796 @@
+/**
+ * @brief   测试http模块
+ * 1. HttpRequestParser: 完整请求, 逐字节增量解析, 流水线请求, 格式错误
+ * 2. http_scan: SIMD实现和逐字节实现的结果一致, 以及两者的耗时
+ * 3. chunked编码: 一次解码, 逐字节流式解码, chunk扩展和trailer, 格式错误, 编码之后再解码
+ * 4. HttpResponseBuilder: 非阻塞socket上分多次发送内存数据和文件
+ * 5. StaticFileCache: 命中, CLOCK淘汰, 文件修改之后重新加载, 完整响应, 预加载
+ * 6. gzip: Accept-Encoding解析, 在线压缩和.gz文件
+ * 7. 条件请求和范围请求: HTTP-date, If-None-Match, Range解析
+ * 8. MIME类型表: 查找, 并发查找的同时扩展
+ * 9. 缓冲区内存池: 块的申请/归还, 超过块大小时换成堆内存
+ * 10. 按请求分配临时内存的arena
+ */
+
+#include <iostream>
+#include <string>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "http/http_parser.h"
+#include "http/http_scan.h"
+#include "http/http_chunked.h"
+#include "http/http_response.h"
+#include "http/file_cache.h"
+#include "http/http_compress.h"
+#include "http/http_conditional.h"
+#include "util/util.h"
+#include "util/buffer_pool.h"
+#include "util/arena.h"
+
+#ifdef WEBSERVER_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using WebServer::HttpRequestParser;
+using WebServer::HttpHeader;
+using WebServer::HttpSpan;
+using WebServer::HttpChunkedDecoder;
+namespace http_scan = WebServer::http_scan;
+
+static std::string span_str(const std::string& buf, const HttpSpan& span)
+{
+    return std::string(span.data(buf.data()), span.len);
+}
+
+static void check_request(const std::string& buf, const HttpRequestParser& parser)
+{
+    assert(span_str(buf, parser.method()) == "GET");
+    assert(span_str(buf, parser.target()) == "/index.html?a=1");
+    assert(parser.versionMajor() == 1 && parser.versionMinor() == 1);
+    assert(parser.headerCount() == 3);
+    assert(span_str(buf, parser.header(0).name) == "Host");
+    assert(span_str(buf, parser.header(0).value) == "localhost");
+    // 名字不区分大小写, 值去掉了首尾空白
+    const HttpHeader* h = parser.findHeader(buf.data(), "connection");
+    assert(h && span_str(buf, h->value) == "keep-alive");
+    h = parser.findHeader(buf.data(), "X-Empty");
+    assert(h && h->value.empty());
+    assert(parser.findHeader(buf.data(), "Content-Length") == nullptr);
+}
+
+static const char* request =
+    "GET /index.html?a=1 HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Connection:   keep-alive  \r\n"
+    "X-Empty:\r\n"
+    "\r\n";
+
+static void test_complete()
+{
+    std::string buf(request);
+    HttpRequestParser parser;
+    assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::SUCCESS);
+    assert(parser.headerEnd() == buf.size());
+    check_request(buf, parser);
+    std::cout << "test_complete success!" << std::endl;
+}
+
+// 每次只多给一个字节, 并且每次都换一个缓冲区地址
+static void test_incremental()
+{
+    std::string all(request);
+    HttpRequestParser parser;
+    for(size_t i = 1; i < all.size(); ++i)
+    {
+        std::string buf(all, 0, i);
+        assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::AGAIN);
+    }
+    assert(parser.parse(all.data(), all.size()) == HttpRequestParser::SUCCESS);
+    check_request(all, parser);
+    std::cout << "test_incremental success!" << std::endl;
+}
+
+static void test_pipeline()
+{
+    std::string buf = std::string(request) + "POST /post HTTP/1.0\nContent-Length: 2\n\nhi" + request;
+    HttpRequestParser parser;
+    assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::SUCCESS);
+    check_request(buf, parser);
+
+    parser.reset(parser.headerEnd());
+    assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::SUCCESS);
+    assert(span_str(buf, parser.method()) == "POST");
+    assert(parser.versionMajor() == 1 && parser.versionMinor() == 0);
+    const HttpHeader* h = parser.findHeader(buf.data(), "Content-Length");
+    assert(h && span_str(buf, h->value) == "2");
+    assert(buf.compare(parser.headerEnd(), 2, "hi") == 0);
+
+    parser.reset(parser.headerEnd() + 2);
+    assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::SUCCESS);
+    check_request(buf, parser);
+    assert(parser.headerEnd() == buf.size());
+    std::cout << "test_pipeline success!" << std::endl;
+}
+
+static void test_error()
+{
+    const char* bad[] = {
+        "GET  / HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1 \r\n\r\n",
+        "GET / HTTP/11\r\n\r\n",
+        "GET / FTP/1.1\r\n\r\n",
+        "G(T / HTTP/1.1\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost localhost\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost : localhost\r\n\r\n",
+        "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n",
+    };
+    for(const char* req : bad)
+    {
+        HttpRequestParser parser;
+        assert(parser.parse(req, strlen(req)) == HttpRequestParser::ERROR);
+    }
+
+    // 头部字段过多
+    std::string buf = "GET / HTTP/1.1\r\n";
+    for(int i = 0; i <= HttpRequestParser::MAX_HEADERS; ++i)
+        buf += "X-A: b\r\n";
+    buf += "\r\n";
+    HttpRequestParser parser;
+    assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::ERROR);
+
+    // 头部过长, 一直没有结束
+    parser.reset();
+    buf = "GET / HTTP/1.1\r\nX-Long: " + std::string(HttpRequestParser::MAX_HEADER_SIZE, 'a');
+    assert(parser.parse(buf.data(), buf.size()) == HttpRequestParser::ERROR);
+    std::cout << "test_error success!" << std::endl;
+}
+
+// 各种长度和起始位置下, 每一种实现都要和逐字节的实现结果一致
+static void test_scan()
+{
+    const http_scan::Level levels[] = {http_scan::SCALAR, http_scan::SSE42, http_scan::AVX2};
+    const http_scan::Level max = http_scan::level();
+    char buf[256];
+    srand(12345);
+    for(int round = 0; round < 20000; ++round)
+    {
+        size_t len = rand() % 200;
+        // 大部分是token字符, 偶尔出现分隔符/控制字符/高位字符
+        for(size_t i = 0; i < len; ++i)
+        {
+            int r = rand() % 64;
+            buf[i] = r == 0 ? '\n' : r == 1 ? (char)(rand() % 256) : r == 2 ? '|' : 'a' + r % 26;
+        }
+        const char* p = buf + rand() % 8;
+        const char* end = buf + len < p ? p : buf + len;
+
+        http_scan::setLevel(http_scan::SCALAR);
+        const char* nl = http_scan::findNewline(p, end);
+        const char* token = http_scan::skipToken(p, end);
+        const char* target = http_scan::skipTarget(p, end);
+        for(http_scan::Level level : levels)
+        {
+            http_scan::setLevel(level);
+            assert(http_scan::findNewline(p, end) == nl);
+            assert(http_scan::skipToken(p, end) == token);
+            assert(http_scan::skipTarget(p, end) == target);
+        }
+    }
+
+    // 大的Cookie头部字段, 比较逐字节扫描和SIMD扫描的耗时
+    std::string req = "GET / HTTP/1.1\r\nHost: localhost\r\nCookie: " + std::string(8000, 'c') +
+        "\r\nAuthorization: Bearer " + std::string(2000, 'a') + "\r\n\r\n";
+    for(http_scan::Level level : levels)
+    {
+        if(http_scan::setLevel(level) != level)
+            continue;
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < 10000; ++i)
+        {
+            HttpRequestParser parser;
+            assert(parser.parse(req.data(), req.size()) == HttpRequestParser::SUCCESS);
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "level " << level << ": 10000 requests in " << us.count() << "us" << std::endl;
+    }
+    http_scan::setLevel(max);
+    std::cout << "test_scan success!" << std::endl;
+}
+
+/**
+ * @brief 模拟httpData的用法: 每次收到step个字节, 解码出来的数据马上取走, 缓冲区中只留下未处理的数据
+ * @param [out] body 解码得到的body
+ * @param [out] rest chunked编码之后剩下的数据
+ */
+static HttpChunkedDecoder::Status decode_stream(const std::string& input, size_t step, std::string& body, std::string& rest)
+{
+    HttpChunkedDecoder decoder;
+    std::string buf;
+    size_t pos = 0;
+    body.clear();
+    while(pos < input.size())
+    {
+        size_t n = std::min(step, input.size() - pos);
+        buf.append(input, pos, n);
+        pos += n;
+
+        size_t size = buf.size();
+        size_t left = 0;
+        HttpChunkedDecoder::Status status = decoder.decode(&buf[0], &size, &left);
+        if(status == HttpChunkedDecoder::ERROR)
+            return status;
+        body.append(buf, 0, size);
+        if(status == HttpChunkedDecoder::SUCCESS)
+        {
+            rest = buf.substr(size, left) + input.substr(pos);
+            return status;
+        }
+        // AGAIN: 输入的数据全部处理完了
+        buf.clear();
+    }
+    return HttpChunkedDecoder::AGAIN;
+}
+
+static void test_chunked()
+{
+    const std::string input =
+        "5\r\nhello\r\n"
+        "7;name=value\r\n, world\r\n"
+        "A \r\n0123456789\r\n"
+        "0\r\n"
+        "Trailer: x\r\n"
+        "\r\n"
+        "GET / HTTP/1.1\r\n";
+    std::string body, rest;
+    for(size_t step : {input.size(), (size_t)1, (size_t)3, (size_t)7})
+    {
+        assert(decode_stream(input, step, body, rest) == HttpChunkedDecoder::SUCCESS);
+        assert(body == "hello, world0123456789");
+        assert(rest == "GET / HTTP/1.1\r\n");
+    }
+
+    // 没有结束
+    assert(decode_stream("5\r\nhello\r\n", 1, body, rest) == HttpChunkedDecoder::AGAIN);
+    assert(body == "hello");
+
+    const char* bad[] = {
+        "x\r\n",
+        "5x\r\nhello\r\n0\r\n\r\n",
+        "5\r\nhelloX\r\n0\r\n\r\n",
+        "11111111111111111\r\n",
+    };
+    for(const char* b : bad)
+        assert(decode_stream(b, 1, body, rest) == HttpChunkedDecoder::ERROR);
+
+    // 很多个chunk, 每次收到的数据和chunk的边界不对齐
+    std::string encoded;
+    std::string data(100000, 'd');
+    for(size_t i = 0; i < data.size(); i += 4099)
+    {
+        size_t len = std::min((size_t)4099, data.size() - i);
+        char header[32];
+        encoded.append(header, snprintf(header, sizeof(header), "%zx\r\n", len));
+        encoded.append(data, i, len);
+        encoded += "\r\n";
+    }
+    encoded += "0\r\n\r\n";
+    assert(decode_stream(encoded, 1000, body, rest) == HttpChunkedDecoder::SUCCESS);
+    assert(body == data && rest.empty());
+    std::cout << "test_chunked success!" << std::endl;
+}
+
+static void test_response()
+{
+    using WebServer::HttpResponseBuilder;
+
+    // 临时文件作为响应body
+    char path[] = "/tmp/http_response_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    std::string file(300000, 'f');
+    for(size_t i = 0; i < file.size(); ++i)
+        file[i] = 'a' + i % 26;
+    assert(write(fd, file.data(), file.size()) == (ssize_t)file.size());
+
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+    static const char body[] = "hello";
+    HttpResponseBuilder out;
+    out.appendStatus(200);
+    out.appendHeader("Content-Type", "text/plain");
+    out.appendHeader("Content-Length", (uint64_t)5);
+    out.appendEnd();
+    out.appendRef(body, 5);
+    out.appendStatus(206);
+    out.appendHeader("Content-Length", (uint64_t)(file.size() - 100));
+    out.appendEnd();
+    out.appendFile(fd, 100, file.size() - 100);
+    out.appendStatus(404);
+    out.appendHeader("Content-Length", (uint64_t)0);
+    out.appendEnd();
+
+    std::string expect =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 5\r\n\r\nhello"
+        "HTTP/1.1 206 Partial Content\r\nContent-Length: 299900\r\n\r\n" + file.substr(100) +
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    assert(out.size() == expect.size());
+
+    // 非阻塞发送, 发送缓冲区满了就读走一部分再继续
+    std::string received;
+    char buf[65536];
+    HttpResponseBuilder::Status status;
+    int again = 0;
+    while((status = out.flush(sv[0])) == HttpResponseBuilder::AGAIN)
+    {
+        ++again;
+        ssize_t n = read(sv[1], buf, sizeof(buf));
+        assert(n > 0);
+        received.append(buf, n);
+    }
+    assert(status == HttpResponseBuilder::SUCCESS);
+    assert(out.empty() && out.size() == 0);
+    shutdown(sv[0], SHUT_WR);
+    ssize_t n;
+    while((n = read(sv[1], buf, sizeof(buf))) > 0)
+        received.append(buf, n);
+    assert(received == expect);
+
+    // clear()丢弃没有发送的文件段, fd由调用者关闭
+    out.appendFile(fd, 0, 10);
+    out.clear();
+    assert(out.empty() && out.size() == 0 && fcntl(fd, F_GETFD) != -1);
+    close(fd);
+
+    close(sv[0]);
+    close(sv[1]);
+    std::cout << "test_response success! (AGAIN " << again << " times)" << std::endl;
+}
+
+static void write_file(const std::string& path, const std::string& data)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    assert(write(fd, data.data(), data.size()) == (ssize_t)data.size());
+    close(fd);
+}
+
+static void test_file_cache()
+{
+    using WebServer::StaticFileCache;
+
+    char dir[] = "/tmp/file_cache_XXXXXX";
+    assert(mkdtemp(dir));
+    std::string small = std::string(dir) + "/a.html";
+    std::string large = std::string(dir) + "/b.txt";
+    std::string other = std::string(dir) + "/c";
+    write_file(small, "<p>hello</p>");
+    write_file(large, std::string(100000, 'x'));
+    write_file(other, "c");
+
+    StaticFileCache cache(2, 100000, 1024);
+    StaticFileCache::Entry::ptr a = cache.get(small);
+    assert(a && a->inMemory && a->fd == -1 && a->data == "<p>hello</p>");
+    assert(a->mime == "text/html");
+    assert(a->headers == "Content-Type: text/html\r\nVary: Accept-Encoding\r\nETag: " + a->etag +
+                         "\r\nLast-Modified: " + a->lastModified + "\r\nAccept-Ranges: bytes\r\nContent-Length: 12\r\n");
+    assert(a->etag.front() == '"' && a->etag.back() == '"');
+    // 命中时返回同一个条目
+    assert(cache.get(small) == a);
+
+    StaticFileCache::Entry::ptr b = cache.get(large);
+    assert(b && !b->inMemory && b->fd >= 0 && b->size == 100000);
+    assert(b->mime == "text/plain");
+    assert(std::string(StaticFileCache::mimeOf("/x.d/index")) == "text/plain");
+    assert(std::string(StaticFileCache::mimeOf("/x.d/INDEX.HTML")) == "text/html");
+
+    // 目录和不存在的文件不缓存
+    errno = 0;
+    assert(!cache.get(dir) && errno == EISDIR);
+    assert(!cache.get(std::string(dir) + "/none") && errno == ENOENT);
+
+    // 超过上限时淘汰最近没有被访问的(small刚刚用过, 淘汰large)
+    cache.get(small);
+    int fd = b->fd;
+    cache.get(other);
+    assert(cache.size() == 2);
+    // 还有使用者的条目, fd不会关闭
+    assert(fcntl(fd, F_GETFD) != -1);
+    b.reset();
+    assert(fcntl(fd, F_GETFD) == -1);
+    assert(cache.get(small) == a);
+
+    // ttl为0: 每次都检查, 文件修改之后重新加载
+    cache.configure(2, 0, 1024);
+    assert(cache.get(small) == a);
+    write_file(small, "<p>changed!</p>");
+    StaticFileCache::Entry::ptr a2 = cache.get(small);
+    assert(a2 != a && a2->data == "<p>changed!</p>");
+    unlink(small.c_str());
+    assert(!cache.get(small));
+    assert(cache.size() == 1);
+
+    // 很多文件分布在不同的分片中, 总数也不超过上限
+    StaticFileCache smallCache(4, 100000, 1024);
+    for(int i = 0; i < 20; ++i)
+    {
+        std::string path = std::string(dir) + "/n" + std::to_string(i);
+        write_file(path, "n");
+        assert(smallCache.get(path) && smallCache.size() <= 4);
+        unlink(path.c_str());
+    }
+    assert(smallCache.size() == 4);
+    smallCache.clear();
+    assert(smallCache.size() == 0);
+
+    // 预先拼好的完整响应, 以及启动时预加载
+    StaticFileCache blobCache(16, 100000, 1024);
+    blobCache.setResponseHeaders("Connection: keep-alive\r\n");
+    std::string sub = std::string(dir) + "/sub";
+    assert(mkdir(sub.c_str(), 0755) == 0);
+    write_file(sub + "/d.html", "ddd");
+    assert(blobCache.preload(std::string(dir) + "/") == 2);    // large超过内存阈值, 不加载
+    assert(blobCache.size() == 2);
+    StaticFileCache::Entry::ptr d = blobCache.get(sub + "/d.html");
+    assert(d->response == "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\n" + d->headers + "\r\nddd");
+    assert(d->responseHeaderLen == d->response.size() - 3);
+    // 文件内容只在完整响应中保存一份
+    assert(d->data.empty() && std::string(d->body(), d->size) == "ddd");
+    assert(blobCache.get(large)->response.empty());
+    unlink((sub + "/d.html").c_str());
+    rmdir(sub.c_str());
+
+    unlink(large.c_str());
+    unlink(other.c_str());
+    rmdir(dir);
+    std::cout << "test_file_cache success!" << std::endl;
+}
+
+#ifdef WEBSERVER_HAVE_ZLIB
+static std::string gunzip(const std::string& in)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    assert(inflateInit2(&zs, 15 + 16) == Z_OK);
+    std::string out;
+    char buf[16384];
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+    int ret;
+    do
+    {
+        zs.next_out = (Bytef*)buf;
+        zs.avail_out = sizeof(buf);
+        ret = inflate(&zs, Z_NO_FLUSH);
+        assert(ret == Z_OK || ret == Z_STREAM_END);
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    } while(ret != Z_STREAM_END);
+    inflateEnd(&zs);
+    return out;
+}
+#endif
+
+static void test_compress()
+{
+    using WebServer::StaticFileCache;
+    namespace hc = WebServer::http_compress;
+
+    struct
+    {
+        const char* value;
+        bool accept;
+    } cases[] = {
+        {"gzip", true},
+        {"GZIP", true},
+        {"deflate, gzip;q=0.5, br", true},
+        {"gzip;q=0", false},
+        {"gzip ; q=0.000", false},
+        {"gzip;q=0.001", true},
+        {"deflate, br", false},
+        {"*", true},
+        {"*;q=0", false},
+        {"*, gzip;q=0", false},
+        {"gzipx, xgzip", false},
+        {"", false},
+    };
+    for(const auto& c : cases)
+        assert(hc::acceptsGzip(c.value, strlen(c.value)) == c.accept);
+
+    assert(hc::isCompressible("text/html") && hc::isCompressible("application/json"));
+    assert(!hc::isCompressible("image/png") && !hc::isCompressible("application/x-gzip"));
+
+    char dir[] = "/tmp/file_gzip_XXXXXX";
+    assert(mkdtemp(dir));
+    std::string html = std::string(dir) + "/a.html";
+    std::string text = std::string(dir) + "/b.txt";
+    std::string png = std::string(dir) + "/c.png";
+    std::string page;
+    for(int i = 0; i < 2000; ++i)
+        page += "<p>line " + std::to_string(i) + "</p>\n";
+    write_file(html, page);
+    write_file(text, page);
+    write_file(text + ".gz", "precompressed");
+    write_file(png, page);
+
+    // 大文件(不在内存中)不在线压缩
+    StaticFileCache cache(16, 100000, 1024);
+    cache.setResponseHeaders("Connection: keep-alive\r\n");
+    StaticFileCache::Entry::ptr raw = cache.get(html);
+    assert(!raw->inMemory && !cache.getGzip(html, raw));
+
+    StaticFileCache memCache(16, 100000, 1024 * 1024);
+    memCache.setResponseHeaders("Connection: keep-alive\r\n");
+    raw = memCache.get(html);
+    StaticFileCache::Entry::ptr gz = memCache.getGzip(html, raw);
+    if(hc::available())
+    {
+        assert(gz && gz->inMemory && (size_t)gz->size < page.size());
+        assert(gz->mime == "text/html");
+        std::string prefix = "Content-Type: text/html\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding\r\n";
+        assert(gz->headers.compare(0, prefix.size(), prefix) == 0);
+        assert(gz->etag != raw->etag && gz->etag.find("-gz\"") != std::string::npos);
+        assert(gz->data.empty() && gz->response.compare(gz->responseHeaderLen, std::string::npos, gz->body(), gz->size) == 0);
+#ifdef WEBSERVER_HAVE_ZLIB
+        assert(gunzip(std::string(gz->body(), gz->size)) == page);
+#endif
+        // 缓存在原文件旁边
+        assert(memCache.getGzip(html, raw) == gz);
+    }
+    else
+        assert(!gz);
+
+    // 有.gz文件时直接使用
+    raw = cache.get(text);
+    gz = cache.getGzip(text, raw);
+    assert(gz && std::string(gz->body(), gz->size) == "precompressed" && gz->mime == "text/plain");
+    // 图片不压缩
+    assert(!cache.getGzip(png, cache.get(png)));
+
+    // .gz文件更新之后, 原文件检查时一起检查
+    cache.configure(16, 0, 1024);
+    usleep(10000);
+    write_file(text + ".gz", "precompressed v2");
+    raw = cache.get(text);
+    gz = cache.getGzip(text, raw);
+    assert(gz && std::string(gz->body(), gz->size) == "precompressed v2");
+
+    unlink(html.c_str());
+    unlink(text.c_str());
+    unlink((text + ".gz").c_str());
+    unlink(png.c_str());
+    rmdir(dir);
+    std::cout << "test_compress success! (zlib " << (hc::available() ? "on" : "off") << ")" << std::endl;
+}
+
+static void test_conditional()
+{
+    namespace hc = WebServer::http_conditional;
+
+    // HTTP-date
+    assert(hc::formatDate(784111777) == "Sun, 06 Nov 1994 08:49:37 GMT");
+    const char* date = " Sun, 06 Nov 1994 08:49:37 GMT ";
+    assert(hc::parseDate(date, strlen(date)) == 784111777);
+    const char* bad_dates[] = {
+        "Sunday, 06-Nov-94 08:49:37 GMT",
+        "Sun, 06 Nox 1994 08:49:37 GMT",
+        "Sun, 06 Nov 1994 08:49:37 UTC",
+        "Sun, 32 Nov 1994 08:49:37 GMT",
+    };
+    for(const char* d : bad_dates)
+        assert(hc::parseDate(d, strlen(d)) == -1);
+
+    // If-None-Match
+    std::string etag = "\"5f-1a\"";
+    struct
+    {
+        const char* value;
+        bool match;
+    } tags[] = {
+        {"\"5f-1a\"", true},
+        {"W/\"5f-1a\"", true},
+        {"\"x\", \"5f-1a\"", true},
+        {"*", true},
+        {"\"5f-1b\"", false},
+        {"\"5f-1a", false},
+        {"", false},
+    };
+    for(const auto& t : tags)
+        assert(hc::etagMatches(t.value, strlen(t.value), etag) == t.match);
+
+    // Range
+    std::vector<hc::ByteRange> r;
+    auto parse = [&r](const char* value, off_t size)
+    {
+        return hc::parseRange(value, strlen(value), size, r);
+    };
+    assert(parse("bytes=0-99", 1000) == hc::RANGE_OK && r.size() == 1 && r[0].offset == 0 && r[0].length == 100);
+    assert(parse("bytes=900-", 1000) == hc::RANGE_OK && r[0].offset == 900 && r[0].length == 100);
+    assert(parse("bytes=-100", 1000) == hc::RANGE_OK && r[0].offset == 900 && r[0].length == 100);
+    assert(parse("bytes=-5000", 1000) == hc::RANGE_OK && r[0].offset == 0 && r[0].length == 1000);
+    assert(parse("bytes=500-5000", 1000) == hc::RANGE_OK && r[0].offset == 500 && r[0].length == 500);
+    assert(parse("bytes=0-0, 2-3 ,-1", 10) == hc::RANGE_OK && r.size() == 3 &&
+           r[1].offset == 2 && r[1].length == 2 && r[2].offset == 9 && r[2].length == 1);
+    // 超出文件大小的范围被去掉
+    assert(parse("bytes=0-1, 2000-3000", 1000) == hc::RANGE_OK && r.size() == 1);
+    assert(parse("bytes=1000-", 1000) == hc::RANGE_UNSATISFIABLE);
+    assert(parse("bytes=-0", 1000) == hc::RANGE_UNSATISFIABLE);
+    const char* bad_ranges[] = {"items=0-1", "bytes=", "bytes=5-1", "bytes=a-b", "bytes=1-2-3", "bytes=--1",
+                                "bytes=0-99999999999999999999999"};
+    for(const char* b : bad_ranges)
+        assert(parse(b, 1000) == hc::RANGE_NONE);
+    std::string many = "bytes=0-0";
+    for(size_t i = 1; i <= hc::MAX_RANGES; ++i)
+        many += "," + std::to_string(i * 2) + "-" + std::to_string(i * 2);
+    assert(parse(many.c_str(), 1000) == hc::RANGE_NONE);
+    std::cout << "test_conditional success!" << std::endl;
+}
+
+static void test_mime()
+{
+    auto mime = [](const char* suffix)
+    {
+        return std::string(util::getMimeType(suffix));
+    };
+    assert(mime(".html") == "text/html" && mime(".HTML") == "text/html");
+    assert(mime(".bmp") == "image/bmp");
+    assert(mime(".unknown") == "text/plain" && mime("default") == "text/plain" && mime("") == "text/plain");
+    assert(std::string(util::getMimeTypeByPath("/a.b/c.tar.gz")) == "application/x-gzip");
+    assert(std::string(util::getMimeTypeByPath("/a.b/c")) == "text/plain");
+
+    // 一边查找一边扩展: 查找不加锁, 旧的结果一直有效
+    const char* html = util::getMimeType(".html");
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> readers;
+    for(int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&stop]()
+        {
+            while(!stop.load())
+            {
+                assert(std::string(util::getMimeType(".png")) == "image/png");
+                const char* md = util::getMimeType(".md");
+                assert(std::string(md) == "text/plain" || std::string(md) == "text/markdown");
+            }
+        });
+    }
+    for(int i = 0; i < 100; ++i)
+    {
+        std::map<std::string, std::string> types;
+        types["md"] = "text/markdown";
+        types[".x" + std::to_string(i)] = "application/x-test";
+        util::addMimeTypes(types);
+    }
+    stop = true;
+    for(std::thread& t : readers)
+        t.join();
+    assert(mime(".MD") == "text/markdown" && mime(".x42") == "application/x-test");
+    assert(std::string(html) == "text/html" && mime(".html") == "text/html");
+    // 配置可以覆盖内置类型
+    std::map<std::string, std::string> types;
+    types[".ico"] = "image/x-icon";
+    util::addMimeTypes(types);
+    assert(mime(".ico") == "image/x-icon");
+    std::cout << "test_mime success!" << std::endl;
+}
+
+static void test_buffer_pool()
+{
+    using WebServer::BufferPool;
+    using WebServer::PooledBuffer;
+    BufferPool pool(1000, 4);
+    assert(pool.blockSize() == 1008 && pool.totalBlocks() == 0);
+    {
+        PooledBuffer a(&pool), b(&pool);
+        a.append("hello", 5);
+        assert(pool.totalBlocks() == 4 && pool.freeBlocks() == 3);
+        char* p = a.data();
+        a.append(" world", 6);
+        assert(a.data() == p && std::string(a.data(), a.size()) == "hello world");
+        a.erase(0, 6);
+        assert(std::string(a.data(), a.size()) == "world");
+        // 放不下时换成堆内存, 块马上还给池
+        std::string big(3000, 'x');
+        a.append(big.data(), big.size());
+        assert(a.size() == 3005 && a.capacity() >= 3005 && pool.freeBlocks() == 4);
+        assert(memcmp(a.data(), "world", 5) == 0 && a[3004] == 'x');
+        a.release();
+        assert(a.data() == nullptr && a.empty());
+
+        // 用完一个slab之后再申请一个
+        PooledBuffer c[4];
+        for(PooledBuffer& buf : c)
+        {
+            buf.setPool(&pool);
+            buf.prepare(1);
+        }
+        assert(pool.totalBlocks() == 4 && pool.freeBlocks() == 0);
+        b.prepare(1);
+        assert(pool.totalBlocks() == 8 && pool.freeBlocks() == 3);
+    }
+    assert(pool.freeBlocks() == pool.totalBlocks());
+
+    // 发送完成之后缓冲区还给池
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    {
+        WebServer::HttpResponseBuilder out(&pool);
+        out.appendStatus(200);
+        out.appendHeader("Content-Length", (uint64_t)2);
+        out.appendEnd();
+        out.append("ok", 2);
+        assert(pool.freeBlocks() == pool.totalBlocks() - 1);
+        assert(out.flush(sv[0]) == WebServer::HttpResponseBuilder::SUCCESS);
+        assert(pool.freeBlocks() == pool.totalBlocks());
+    }
+    char buf[64];
+    ssize_t n = read(sv[1], buf, sizeof(buf));
+    assert(std::string(buf, n) == "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    close(sv[0]);
+    close(sv[1]);
+    std::cout << "test_buffer_pool success!" << std::endl;
+}
+
+static void test_arena()
+{
+    WebServer::BufferPool pool(512, 4);
+    WebServer::Arena arena(&pool);
+    char* a = (char*)arena.allocate(3, 1);
+    uint64_t* b = arena.allocArray<uint64_t>(4);
+    assert(((uintptr_t)b & (alignof(uint64_t) - 1)) == 0 && (char*)b >= a + 3);
+    assert(pool.totalBlocks() == 4 && pool.freeBlocks() == 3);
+    size_t len;
+    const char* s = arena.format(len, "bytes %d-%d/%d", 0, 99, 1000);
+    assert(len == 15 && std::string(s) == "bytes 0-99/1000");
+    // 当前块放不下时格式化到新块中
+    std::string longer(480, 'y');
+    s = arena.format(len, "%s-%s", longer.c_str(), "z");
+    assert(len == 482 && std::string(s) == longer + "-z");
+    assert(pool.freeBlocks() == 2);
+    // 超过块大小的分配单独用堆内存
+    char* big = (char*)arena.allocate(4096);
+    memset(big, 0, 4096);
+    assert(pool.freeBlocks() == 2);
+    assert(std::string(arena.dup("abc", 2)) == "ab");
+    assert(arena.used() > 4096);
+    arena.reset();
+    assert(arena.used() == 0 && pool.freeBlocks() == pool.totalBlocks());
+
+    WebServer::Arena heap;
+    for(int i = 0; i < 1000; ++i)
+        assert(std::string(heap.format(len, "%d", i)) == std::to_string(i));
+    std::cout << "test_arena success!" << std::endl;
+}
+
+int main()
+{
+    test_complete();
+    test_incremental();
+    test_pipeline();
+    test_error();
+    test_scan();
+    test_chunked();
+    test_response();
+    test_file_cache();
+    test_compress();
+    test_conditional();
+    test_mime();
+    test_buffer_pool();
+    test_arena();
+    std::cout << "Test succeeded" << std::endl;
+    return 0;
+}
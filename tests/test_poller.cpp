@@ -0,0 +1,423 @@
+/**
+ * @brief   测试poller的接口
+ * 1. 读操作: create_message/append流式解析消息, 对端关闭
+ * 2. 写操作: iovec聚集写, 写缓冲区满时partial_written
+ * 3. 超时: fd超时, poller_add_timer定时器
+ * 4. poller_del, poller_stop; 多个线程同时poller_del
+ * 5. mpoller: 按fd分配到多个poller
+ */
+
+#include <iostream>
+#include <string>
+#include <deque>
+#include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "poller/poller.h"
+#include "poller/mpoller.h"
+
+// 以'\n'分隔的消息
+struct line_message
+{
+    struct poller_message_t base;   // 必须是第一个成员
+    std::string line;
+};
+
+static int line_append(const void* buf, size_t* size, struct poller_message_t* msg)
+{
+    line_message* m = (line_message*)msg;
+    const char* p = (const char*)buf;
+    const char* end = (const char*)memchr(p, '\n', *size);
+    if(end == NULL)
+    {
+        m->line.append(p, *size);
+        return 0;
+    }
+    m->line.append(p, end);
+    *size = end - p + 1;
+    return 1;
+}
+
+static struct poller_message_t* create_message(void*)
+{
+    line_message* m = new line_message;
+    m->base.append = line_append;
+    return &m->base;
+}
+
+static int partial_written_count = 0;
+
+static int partial_written(size_t, void*)
+{
+    partial_written_count++;
+    return 0;
+}
+
+// 回调在poller线程中执行, 把结果交给测试线程
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static std::deque<struct poller_result*> results;
+
+static void callback(struct poller_result* res, void*)
+{
+    pthread_mutex_lock(&mtx);
+    results.push_back(res);
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mtx);
+}
+
+static struct poller_result* wait_result()
+{
+    pthread_mutex_lock(&mtx);
+    while(results.empty())
+        pthread_cond_wait(&cond, &mtx);
+    struct poller_result* res = results.front();
+    results.pop_front();
+    pthread_mutex_unlock(&mtx);
+    return res;
+}
+
+static void make_socketpair(int sv[2])
+{
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+}
+
+static void add_read(int fd, int timeout, poller_t* poller)
+{
+    struct poller_data data;
+    memset(&data, 0, sizeof(data));
+    data.operation = PD_OP_READ;
+    data.fd = fd;
+    assert(poller_add(&data, timeout, poller) == 0);
+}
+
+static void test_read(poller_t* poller)
+{
+    int sv[2];
+    make_socketpair(sv);
+    add_read(sv[0], -1, poller);
+
+    // 一次写入包含两个完整消息和半个消息
+    const char* text = "hello\nworld\nhal";
+    assert(write(sv[1], text, strlen(text)) == (ssize_t)strlen(text));
+
+    const char* expect[] = {"hello", "world", "half"};
+    for(int i = 0; i < 3; ++i)
+    {
+        if(i == 2)
+            assert(write(sv[1], "f\n", 2) == 2);
+        struct poller_result* res = wait_result();
+        assert(res->state == PR_ST_SUCCESS);
+        line_message* m = (line_message*)res->data.message;
+        assert(m->line == expect[i]);
+        delete m;
+        free(res);
+    }
+
+    // 对端关闭
+    close(sv[1]);
+    struct poller_result* res = wait_result();
+    assert(res->state == PR_ST_FINISHED);
+    assert(res->data.fd == sv[0]);
+    free(res);
+    close(sv[0]);
+    std::cout << "test_read success!" << std::endl;
+}
+
+static void* drain_routine(void* arg)
+{
+    int fd = *(int*)arg;
+    char buf[64 * 1024];
+    size_t total = 0;
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        total += n;
+    return (void*)total;
+}
+
+static void test_write(poller_t* poller)
+{
+    int sv[2];
+    make_socketpair(sv);
+
+    // 总共4MB, 远大于socket缓冲区, 必然会出现部分写入
+    const size_t piece = 1024 * 1024;
+    char* buf = (char*)malloc(piece);
+    memset(buf, 'x', piece);
+    struct iovec iov[4];
+    for(int i = 0; i < 4; ++i)
+    {
+        iov[i].iov_base = buf;
+        iov[i].iov_len = piece;
+    }
+
+    struct poller_data data;
+    memset(&data, 0, sizeof(data));
+    data.operation = PD_OP_WRITE;
+    data.fd = sv[0];
+    data.write_iov = iov;
+    data.iovcnt = 4;
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, drain_routine, &sv[1]);
+    assert(poller_add(&data, -1, poller) == 0);
+
+    struct poller_result* res = wait_result();
+    assert(res->state == PR_ST_FINISHED);
+    assert(res->data.iovcnt == 0);
+    free(res);
+    assert(partial_written_count > 0);
+
+    close(sv[0]);
+    void* total;
+    pthread_join(tid, &total);
+    assert((size_t)total == 4 * piece);
+    close(sv[1]);
+    free(buf);
+    std::cout << "test_write success! partial_written: " << partial_written_count << std::endl;
+}
+
+static void test_timeout(poller_t* poller)
+{
+    int sv[2];
+    make_socketpair(sv);
+
+    // 超时时间乱序插入, 覆盖链表和红黑树两条路径
+    int sv2[2];
+    make_socketpair(sv2);
+    add_read(sv[0], 300, poller);
+    add_read(sv2[0], 100, poller);
+
+    struct timespec value = {0, 200 * 1000000};
+    int timer_ctx = 0;
+    assert(poller_add_timer(&value, &timer_ctx, poller) == 0);
+
+    struct poller_result* res = wait_result();
+    assert(res->state == PR_ST_ERROR && res->error == ETIMEDOUT && res->data.fd == sv2[0]);
+    free(res);
+
+    res = wait_result();
+    assert(res->state == PR_ST_FINISHED && res->data.operation == PD_OP_TIMER);
+    assert(res->data.context == &timer_ctx);
+    free(res);
+
+    // poller_set_timeout会把超时时间推后
+    assert(poller_set_timeout(sv[0], 100, poller) == 0);
+    res = wait_result();
+    assert(res->state == PR_ST_ERROR && res->error == ETIMEDOUT && res->data.fd == sv[0]);
+    free(res);
+
+    close(sv[0]);
+    close(sv[1]);
+    close(sv2[0]);
+    close(sv2[1]);
+    std::cout << "test_timeout success!" << std::endl;
+}
+
+// 大量乱序定时器, 检查红黑树的插入删除: 全部都要到期, 并且不能提前到期
+static void test_timer_order(poller_t* poller)
+{
+    const int count = 1000;
+    struct timespec* deadlines = new struct timespec[count];
+    srand(time(NULL));
+    for(int i = 0; i < count; ++i)
+    {
+        struct timespec value = {0, (rand() % 300 + 1) * 1000000L};
+        clock_gettime(CLOCK_MONOTONIC, &deadlines[i]);
+        deadlines[i].tv_sec += (deadlines[i].tv_nsec + value.tv_nsec) / 1000000000L;
+        deadlines[i].tv_nsec = (deadlines[i].tv_nsec + value.tv_nsec) % 1000000000L;
+        assert(poller_add_timer(&value, &deadlines[i], poller) == 0);
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        struct poller_result* res = wait_result();
+        assert(res->state == PR_ST_FINISHED && res->data.operation == PD_OP_TIMER);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec* deadline = (struct timespec*)res->data.context;
+        assert(now.tv_sec > deadline->tv_sec ||
+            (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec));
+        free(res);
+    }
+    delete[] deadlines;
+    std::cout << "test_timer_order success!" << std::endl;
+}
+
+static void test_del(poller_t* poller)
+{
+    int sv[2];
+    make_socketpair(sv);
+    add_read(sv[0], -1, poller);
+    assert(poller_del(sv[0], poller) == 0);
+    assert(poller_del(sv[0], poller) == -1 && errno == ENOENT);
+
+    struct poller_result* res = wait_result();
+    assert(res->state == PR_ST_DELETED && res->data.fd == sv[0]);
+    free(res);
+    close(sv[0]);
+    close(sv[1]);
+    std::cout << "test_del success!" << std::endl;
+}
+
+// 多个fd分散在不同的poller上, 每个poller都能独立处理读事件和超时
+static void test_mpoller(const struct poller_params* params)
+{
+    const int nthreads = 4;
+    const int count = 16;
+    mpoller_t* mpoller = mpoller_create(params, nthreads);
+    assert(mpoller != NULL);
+    assert(mpoller_start(mpoller) == 0);
+
+    int sv[count][2];
+    for(int i = 0; i < count; ++i)
+    {
+        make_socketpair(sv[i]);
+        struct poller_data data;
+        memset(&data, 0, sizeof(data));
+        data.operation = PD_OP_READ;
+        data.fd = sv[i][0];
+        assert(mpoller_add(&data, -1, mpoller) == 0);
+        assert(mpoller_add(&data, -1, mpoller) == -1 && errno == EEXIST);
+    }
+
+    for(int i = 0; i < count; ++i)
+        assert(write(sv[i][1], "ping\n", 5) == 5);
+    for(int i = 0; i < count; ++i)
+    {
+        struct poller_result* res = wait_result();
+        assert(res->state == PR_ST_SUCCESS);
+        line_message* m = (line_message*)res->data.message;
+        assert(m->line == "ping");
+        delete m;
+        free(res);
+    }
+
+    // 超时和定时器分布在不同的poller上
+    assert(mpoller_set_timeout(sv[0][0], 50, mpoller) == 0);
+    struct timespec value = {0, 10 * 1000000};
+    for(int i = 0; i < nthreads; ++i)
+        assert(mpoller_add_timer(&value, NULL, mpoller) == 0);
+    for(int i = 0; i < nthreads + 1; ++i)
+    {
+        struct poller_result* res = wait_result();
+        if(res->data.operation == PD_OP_TIMER)
+            assert(res->state == PR_ST_FINISHED);
+        else
+            assert(res->state == PR_ST_ERROR && res->error == ETIMEDOUT && res->data.fd == sv[0][0]);
+        free(res);
+    }
+
+    assert(mpoller_del(sv[1][0], mpoller) == 0);
+    struct poller_result* res = wait_result();
+    assert(res->state == PR_ST_DELETED && res->data.fd == sv[1][0]);
+    free(res);
+
+    // 剩下的fd在mpoller_stop时回调
+    mpoller_stop(mpoller);
+    for(int i = 2; i < count; ++i)
+    {
+        res = wait_result();
+        assert(res->state == PR_ST_STOPPED);
+        free(res);
+    }
+    mpoller_destroy(mpoller);
+
+    for(int i = 0; i < count; ++i)
+    {
+        close(sv[i][0]);
+        close(sv[i][1]);
+    }
+    std::cout << "test_mpoller success!" << std::endl;
+}
+
+struct del_routine_arg
+{
+    poller_t* poller;
+    int count;
+};
+
+static void* del_routine(void* arg)
+{
+    del_routine_arg* a = (del_routine_arg*)arg;
+    for(int i = 0; i < a->count; ++i)
+    {
+        int sv[2];
+        make_socketpair(sv);
+        add_read(sv[0], i % 2 ? 1000 : -1, a->poller);
+        assert(poller_del(sv[0], a->poller) == 0);
+        close(sv[1]);
+    }
+    return NULL;
+}
+
+// 多个线程同时poller_del, 被移除的node通过无锁队列交给poller线程, 每个都要回调且只回调一次
+static void test_concurrent_del(poller_t* poller)
+{
+    const int nthreads = 4;
+    const int count = 200;
+    pthread_t tids[nthreads];
+    del_routine_arg arg = {poller, count};
+    for(int i = 0; i < nthreads; ++i)
+        pthread_create(&tids[i], NULL, del_routine, &arg);
+    for(int i = 0; i < nthreads; ++i)
+        pthread_join(tids[i], NULL);
+
+    for(int i = 0; i < nthreads * count; ++i)
+    {
+        struct poller_result* res = wait_result();
+        assert(res->state == PR_ST_DELETED);
+        close(res->data.fd);
+        free(res);
+    }
+    pthread_mutex_lock(&mtx);
+    assert(results.empty());
+    pthread_mutex_unlock(&mtx);
+    std::cout << "test_concurrent_del success!" << std::endl;
+}
+
+int main()
+{
+    struct poller_params params;
+    params.max_open_files = 65536;
+    params.create_message = create_message;
+    params.partial_written = partial_written;
+    params.callback = callback;
+    params.context = NULL;
+
+    poller_t* poller = poller_create(&params);
+    assert(poller != NULL);
+    assert(poller_start(poller) == 0);
+
+    test_read(poller);
+    test_write(poller);
+    test_timeout(poller);
+    test_timer_order(poller);
+    test_del(poller);
+    test_concurrent_del(poller);
+
+    // poller_stop时还在poller中的fd以PR_ST_STOPPED回调
+    int sv[2];
+    make_socketpair(sv);
+    add_read(sv[0], 10000, poller);
+    poller_stop(poller);
+    struct poller_result* res = wait_result();
+    assert(res->state == PR_ST_STOPPED && res->data.fd == sv[0]);
+    free(res);
+    close(sv[0]);
+    close(sv[1]);
+
+    poller_destroy(poller);
+
+    test_mpoller(&params);
+    std::cout << "Test succeeded" << std::endl;
+    return 0;
+}
@@ -2,13 +2,20 @@
  * @brief   测试thread的接口
  * 1. thread创建的线程是否正常
  * 2. 线程池接口是否正常,返回future是否可用.
+ * 3. work-stealing线程池压力测试: 多个外部线程同时提交, 任务中再提交子任务(放进工作线程自己的队列, 由其它线程偷走),
+ *    所有任务都要执行并且只执行一次; 线程池空闲一段时间(工作线程睡眠)之后提交的任务也要能被唤醒执行
  */
 
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include "thread/thread.h"
 #include "thread/threadpool.h"
 #include "thread/mutex.h"
 
+#include <thread>
+#include <unistd.h>
+
 using WebServer::Thread;
 
 WebServer::Mutex mtx;
@@ -21,8 +28,61 @@ int print(int id)
     return id;
 }
 
+static void test_work_stealing()
+{
+    const int submitters = 4, roots = 20000, children = 16;
+    std::atomic<long> executed(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(8);
+        std::vector<std::thread> threads;
+        for(int t = 0; t < submitters; ++t)
+        {
+            threads.emplace_back([&pool, &executed](){
+                for(int i = 0; i < roots; ++i)
+                {
+                    pool.addTask([&pool, &executed](){
+                        for(int c = 0; c < children; ++c)
+                            pool.addTask([&executed](){ executed.fetch_add(1, std::memory_order_relaxed); });
+                        executed.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+            });
+        }
+        for(std::thread& t : threads)
+            t.join();
+        long expect = (long)submitters * roots * (children + 1);
+        for(int i = 0; i < 1000 && executed.load() < expect; ++i)
+            usleep(10000);
+        // 析构时等所有任务(包括子任务)执行完
+    }
+    long expect = (long)submitters * roots * (children + 1);
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    if(executed.load() != expect)
+    {
+        std::cout << "work stealing: executed " << executed.load() << " tasks, expected " << expect << std::endl;
+        exit(1);
+    }
+    std::cout << "work stealing: " << expect << " tasks in " << ms << " ms" << std::endl;
+
+    // 所有工作线程都睡眠之后再提交, 必须被唤醒
+    ThreadPool pool(4);
+    for(int round = 0; round < 100; ++round)
+    {
+        usleep(round % 10 == 0 ? 20000 : 100);
+        if(pool.addTask([round](){ return round; }).get() != round)
+        {
+            std::cout << "work stealing: wrong result" << std::endl;
+            exit(1);
+        }
+    }
+    std::cout << "work stealing test succeeded" << std::endl;
+}
+
 int main()
 {
+    test_work_stealing();
+
     ThreadPool *pool = new ThreadPool(4);
 
     std::vector<std::future<int>> result;
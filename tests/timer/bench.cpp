@@ -0,0 +1,126 @@
+/**
+ * @author  2mu
+ * @date    2024/5/12
+ * @brief   时间堆和时间轮的对比测试
+ * 模拟每个连接一个空闲超时定时器的场景: 先添加n个1~60秒后到期的定时器, 然后随机挑选定时器重新设置(removeTimer + addTimer),
+ * 最后全部删除(分别测试独立线程模式和不加锁的分片模式, 以及时间堆合并定时器(slack)的效果); 再测试大量定时器在同一秒内到期时的延迟.
+ * 用法: timer_bench [定时器数量, 默认100000]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "timer/thr_timer.h"
+#include "util/util.h"
+
+static void nothing(void*) {}
+
+static double elapsed_ns(uint64_t start, size_t ops)
+{
+    return (double)(util::get_monotonic_time_nsec() - start) / ops;
+}
+
+static void bench_ops(TimerManager::Backend backend, size_t n, bool own_thread, unsigned long long slack_us = 0)
+{
+    TimerManager manager(n + 2, backend, own_thread);
+    manager.setSlack(slack_us);
+    std::vector<thr_timer_t> timers(n);
+    for(thr_timer_t& t : timers)
+        thr_timer_init(&t, nothing, nullptr);
+    srand(1);
+
+    uint64_t start = util::get_monotonic_time_nsec();
+    for(thr_timer_t& t : timers)
+        manager.addTimer(&t, (1 + rand() % 60) * 1000000ULL);
+    double add = elapsed_ns(start, n);
+
+    // 连接上每来一个请求就重新设置一次它的定时器
+    size_t rearms = std::max(n, (size_t)1000000);
+    start = util::get_monotonic_time_nsec();
+    for(size_t i = 0; i < rearms; ++i)
+    {
+        thr_timer_t& t = timers[rand() % n];
+        manager.removeTimer(&t);
+        manager.addTimer(&t, 30 * 1000000ULL);
+    }
+    double rearm = elapsed_ns(start, rearms);
+
+    start = util::get_monotonic_time_nsec();
+    for(thr_timer_t& t : timers)
+        manager.removeTimer(&t);
+    double remove = elapsed_ns(start, n);
+
+    printf("%-5s %-6s slack %-5llu n=%-8zu add %7.1f ns/op   rearm %7.1f ns/op   remove %7.1f ns/op\n",
+           backend == TimerManager::WHEEL ? "wheel" : "heap", own_thread ? "thread" : "shard", slack_us / 1000, n, add, rearm, remove);
+}
+
+
+struct FireRecord
+{
+    thr_timer_t timer;
+    uint64_t    expect;     // 期望的到期时间(纳秒)
+    uint64_t    late;       // 实际晚了多久
+    std::atomic<int>* fired;
+};
+
+static void on_fire(void* arg)
+{
+    FireRecord* r = (FireRecord*)arg;
+    uint64_t now = util::get_monotonic_time_nsec();
+    r->late = now >= r->expect ? now - r->expect : 0;
+    if(now + 1000 < r->expect)
+        printf("timer fired %llu ns early!\n", (unsigned long long)(r->expect - now));
+    r->fired->fetch_add(1);
+}
+
+static void bench_fire(TimerManager::Backend backend, size_t n, unsigned long long slack_us = 0)
+{
+    TimerManager manager(n + 2, backend);
+    manager.setSlack(slack_us);
+    std::vector<FireRecord> records(n);
+    std::atomic<int> fired(0);
+    srand(2);
+    for(FireRecord& r : records)
+    {
+        thr_timer_init(&r.timer, on_fire, &r);
+        r.fired = &fired;
+        r.late = 0;
+        unsigned long long us = 500000 + rand() % 1000000;
+        r.expect = util::get_monotonic_time_nsec() + us * 1000;
+        manager.addTimer(&r.timer, us);
+    }
+    while(fired.load() < (int)n)
+        usleep(10000);
+
+    uint64_t total = 0, worst = 0;
+    for(const FireRecord& r : records)
+    {
+        total += r.late;
+        worst = std::max(worst, r.late);
+    }
+    printf("%-5s slack %-5llu n=%-8zu fire: avg late %.3f ms, max late %.3f ms\n",
+           backend == TimerManager::WHEEL ? "wheel" : "heap", slack_us / 1000, n, total / 1e6 / n, worst / 1e6);
+}
+
+
+int main(int argc, char* argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    if(n == 0)
+        n = 100000;
+    for(size_t count : {n / 100 ? n / 100 : 1, n, n * 10})
+    {
+        bench_ops(TimerManager::HEAP, count, true);
+        bench_ops(TimerManager::WHEEL, count, true);
+        bench_ops(TimerManager::WHEEL, count, false);
+        bench_ops(TimerManager::HEAP, count, true, 100000);
+    }
+    bench_fire(TimerManager::HEAP, n);
+    bench_fire(TimerManager::WHEEL, n);
+    bench_fire(TimerManager::HEAP, n, 10000);
+    return 0;
+}
@@ -11,6 +11,8 @@
 
 #include <pthread.h>
 #include <signal.h>
+#include <unistd.h>
+#include <poll.h>
 #include <time.h>
 
 #include "timer/thr_timer.h"
@@ -26,8 +28,8 @@ static unsigned int thread_count, benchmark_runs;
 // 测试需要调用的具体函数...
 static unsigned int test_to_run= 1;
 
-// mysql用的全局static对象, 我这里用全局对象
-TimerManager gTimerManager;
+// mysql用的全局static对象, 我这里在main中按参数选择时间堆或者时间轮(-w)创建
+static TimerManager* gTimerManager;
 
 
 // 定时任务是发送信号...
@@ -58,10 +60,10 @@ static void run_thread_test(int param)
         int wait_time = param ? 11-i : i;
         
         struct timespec start_time;
-        clock_gettime(CLOCK_REALTIME, &start_time);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
         
         pthread_mutex_lock(&current_my_thread_var->mutex);
-        if (!gTimerManager.addTimer(&timer_data, wait_time * 1e6))
+        if (!gTimerManager->addTimer(&timer_data, wait_time * 1e6))
         {
             printf("Thread %s: add timers failed!\n", my_thread_name());
             break;
@@ -90,14 +92,14 @@ static void run_thread_test(int param)
         }
         pthread_mutex_unlock(&current_my_thread_var->mutex);
         struct timespec now;
-        clock_gettime(CLOCK_REALTIME, &now);
+        clock_gettime(CLOCK_MONOTONIC, &now);
         int micro_second = (now.tv_sec * 1000000ULL + now.tv_nsec / 1000ULL) 
             - (start_time.tv_sec * 1000000ULL + start_time.tv_nsec / 1000ULL);
         // 计算实际等待时间, 和预设时间; wait_time=3时, 没有等待是正常的;
         printf("Thread %s: Slept for %f (%d) sec\n", 
             my_thread_name(), (int) (micro_second)/1000000.0, wait_time);
         fflush(stdout);
-        gTimerManager.removeTimer(&timer_data);
+        gTimerManager->removeTimer(&timer_data);
         fflush(stdout);
     }
     return;
@@ -114,12 +116,12 @@ static void run_thread_benchmark(int param)
     // param是1000000, (多线程)添加1百万个1秒的定时器, 且立马删除...
     for (int i = 1 ; i <= param ; i++)
     {
-        if (!gTimerManager.addTimer(&timer_data, 1000000))
+        if (!gTimerManager->addTimer(&timer_data, 1000000))
         {
             printf("Thread %s: add timers failed!\n",my_thread_name());
             break;
         }
-        gTimerManager.removeTimer(&timer_data);
+        gTimerManager->removeTimer(&timer_data);
     }
 }
 
@@ -155,6 +157,244 @@ static void *start_thread(void *arg)
 }
 
 
+/**
+ * @brief 直接检查时间轮: 用假的时间转动, 各种距离的定时器(包括需要多次cascade和超出范围的)都不能提前或者推迟到期
+ */
+static void check_timer_wheel()
+{
+    const uint64_t tick = 1000000;  // 1毫秒
+    const uint64_t start = 123456789ULL * tick + 54321;
+    TimerWheel wheel(start, tick);
+    const uint64_t delays_ms[] = {0, 1, 2, 255, 256, 257, 1000, 16383, 16384, 16385, 65536 + 7,
+                                  1048575, 1048576, 3000000, 67108863, 67108864, 100000000};
+    const int count = sizeof(delays_ms) / sizeof(delays_ms[0]);
+    thr_timer_t timers[count];
+    thr_timer_t removed;
+    for(int i = 0; i < count; ++i)
+    {
+        thr_timer_init(&timers[i], NULL, NULL);
+        uint64_t expire = start + delays_ms[i] * tick + 1;
+        timers[i].expire_time.tv_sec = expire / 1000000000ULL;
+        timers[i].expire_time.tv_nsec = expire % 1000000000ULL;
+        wheel.add(&timers[i]);
+    }
+    // 删除的定时器不会到期
+    thr_timer_init(&removed, NULL, NULL);
+    removed.expire_time = timers[6].expire_time;
+    wheel.add(&removed);
+    wheel.remove(&removed);
+
+    int fired = 0;
+    uint64_t now = start;
+    while(fired < count)
+    {
+        // 按nextExpire()跳着转动, 和TimerManager的工作线程一样
+        uint64_t next = wheel.nextExpire();
+        if(next == UINT64_MAX)
+        {
+            printf("timer wheel: %d timers lost!\n", count - fired);
+            exit(1);
+        }
+        now = next > now ? next : now;
+        wheel.advance(now);
+        while(thr_timer_t* t = wheel.popDue())
+        {
+            uint64_t expire = t->expire_time.tv_sec * 1000000000ULL + t->expire_time.tv_nsec;
+            if(now < expire || now - expire >= tick || t == &removed)
+            {
+                printf("timer wheel: timer %ld fired at %llu, expected %llu\n", (long)(t - timers),
+                       (unsigned long long)now, (unsigned long long)expire);
+                exit(1);
+            }
+            ++fired;
+        }
+    }
+    if(wheel.size() != 0)
+    {
+        printf("timer wheel: %zu timers left!\n", wheel.size());
+        exit(1);
+    }
+    printf("timer wheel check succeeded\n");
+}
+
+
+/**
+ * @brief 直接检查4叉堆: 随机插入/删除任意元素/删除堆顶, 每个元素保存的下标都要正确, 堆顶必须是最小的
+ */
+struct HeapItem
+{
+    int      pos;
+    uint64_t key;
+    bool     in_heap;
+};
+
+static void check_dary_heap()
+{
+    const int count = 5000;
+    DaryHeap<HeapItem, uint64_t, &HeapItem::pos> heap(4, 4);   // 从很小开始, 顺便测试扩容
+    HeapItem* items = new HeapItem[count];
+    srand(3);
+    for(int i = 0; i < count; ++i)
+        items[i].in_heap = false;
+    for(int round = 0; round < 200000; ++round)
+    {
+        HeapItem* item = &items[rand() % count];
+        int op = rand() % 3;
+        if(!item->in_heap)
+        {
+            // 有很多相同的键值
+            item->key = rand() % 1000;
+            if(!heap.insert(item, item->key))
+            {
+                printf("dary heap: insert failed\n");
+                exit(1);
+            }
+            item->in_heap = true;
+        }
+        else if(op == 0)
+        {
+            heap.remove(item->pos)->in_heap = false;
+        }
+        else if(op == 1)
+        {
+            uint64_t min = UINT64_MAX;
+            for(int i = 0; i < count; ++i)
+                if(items[i].in_heap && items[i].key < min)
+                    min = items[i].key;
+            HeapItem* top = heap.removeTop();
+            if(top->key != min)
+            {
+                printf("dary heap: top key %llu, min key %llu\n", (unsigned long long)top->key, (unsigned long long)min);
+                exit(1);
+            }
+            top->in_heap = false;
+        }
+        if(round % 1000 == 0)
+        {
+            size_t size = 0;
+            for(int i = 0; i < count; ++i)
+            {
+                if(!items[i].in_heap)
+                    continue;
+                ++size;
+                if(heap.element(items[i].pos) != &items[i])
+                {
+                    printf("dary heap: wrong position of item %d\n", i);
+                    exit(1);
+                }
+            }
+            if(size != heap.size())
+            {
+                printf("dary heap: size %zu, expected %zu\n", heap.size(), size);
+                exit(1);
+            }
+        }
+    }
+    delete[] items;
+    printf("dary heap check succeeded\n");
+}
+
+
+/**
+ * @brief 分片模式: 所属线程用nextTimeoutMs()(或者等timerfd可读)等待并调用processTimers(), 回调中删除同一批到期的其它定时器,
+ * 其它线程通过cancelTimer()取消的定时器都不能到期; 设置了slack时定时器合并到桶中, 同样不能提前到期, 最多晚slack
+ */
+struct ShardRecord
+{
+    thr_timer_t  timer;
+    int          fired;
+    uint64_t     expect;    // 不合并时的到期时间(纳秒)
+    ShardRecord* victim;    // 回调中要删除的定时器
+    TimerManager* manager;
+};
+
+static void shard_fire(void* arg)
+{
+    ShardRecord* r = (ShardRecord*)arg;
+    uint64_t now = util::get_monotonic_time_nsec();
+    if(now < r->expect)
+    {
+        printf("timer shard: timer fired %llu ns early!\n", (unsigned long long)(r->expect - now));
+        exit(1);
+    }
+    r->fired++;
+    if(r->victim)
+        r->manager->removeTimer(&r->victim->timer);
+}
+
+static void* shard_cancel_thread(void* arg)
+{
+    ShardRecord* records = (ShardRecord*)arg;
+    for(int i = 1; i < 1000; i += 2)
+        records[0].manager->cancelTimer(&records[i].timer);
+    return NULL;
+}
+
+static void check_timer_shard(TimerManager::Backend backend, bool use_timerfd, unsigned long long slack_us = 0)
+{
+    const int count = 1000;
+    TimerManager manager(16, backend, false);
+    manager.setSlack(slack_us);
+    int timer_fd = use_timerfd ? manager.timerFd() : -1;
+    if(use_timerfd && timer_fd == -1)
+    {
+        printf("timer shard: create timerfd failed!\n");
+        exit(1);
+    }
+    ShardRecord* records = new ShardRecord[count];
+    for(int i = 0; i < count; ++i)
+    {
+        thr_timer_init(&records[i].timer, shard_fire, &records[i]);
+        records[i].fired = 0;
+        records[i].manager = &manager;
+        records[i].victim = NULL;
+        // 奇数的被其它线程取消; 200~299在同一毫秒到期, 偶数的删除下一个偶数
+        unsigned long long us = (i >= 200 && i < 300) ? 20000 : 10000 + (i % 50) * 1000;
+        records[i].expect = util::get_monotonic_time_nsec() + us * 1000;
+        manager.addTimer(&records[i].timer, us);
+    }
+    for(int i = 200; i < 296; i += 4)
+        records[i].victim = &records[i + 2];
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, shard_cancel_thread, records);
+    pthread_join(tid, NULL);
+
+    int timeout;
+    while((timeout = manager.nextTimeoutMs()) >= 0)
+    {
+        if(use_timerfd)
+        {
+            // timerfd必须在最早的定时器到期时可读, 最多等1秒
+            struct pollfd pfd = {timer_fd, POLLIN, 0};
+            if(poll(&pfd, 1, 1000) != 1)
+            {
+                printf("timer shard: timerfd not readable, %d ms left\n", manager.nextTimeoutMs());
+                exit(1);
+            }
+        }
+        else if(timeout > 0)
+            usleep(timeout * 1000);
+        manager.processTimers();
+    }
+    for(int i = 0; i < count; ++i)
+    {
+        // 同一毫秒到期的执行顺序不确定, 被删除的那个可能先执行了
+        bool victim = i >= 202 && i < 298 && i % 4 == 2;
+        int expect = i % 2 == 1 ? 0 : 1;
+        if(records[i].fired != expect && !(victim && records[i].fired == 0))
+        {
+            printf("timer shard(%s%s, slack %llu us): timer %d fired %d times\n", backend == TimerManager::WHEEL ? "wheel" : "heap",
+                   use_timerfd ? ", timerfd" : "", slack_us, i, records[i].fired);
+            exit(1);
+        }
+    }
+    delete[] records;
+    printf("timer shard(%s%s, slack %llu us) check succeeded\n", backend == TimerManager::WHEEL ? "wheel" : "heap",
+           use_timerfd ? ", timerfd" : "", slack_us);
+}
+
+
 /* Start a lot of threads that will run with timers */
 
 static void run_test()
@@ -210,20 +450,26 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
 
     my_thread_init(); // 每个线程都要初始化线程特有变量
     my_mutex_init();// 初始化全局mutex attr对象
-    if(argc > 1 && argv[1][0] == '-')
+    TimerManager::Backend backend = TimerManager::HEAP;
+    for(int i = 1; i < argc; ++i)
     {
-        switch(argv[1][1])
+        if(argv[i][0] != '-')
+            continue;
+        switch(argv[i][1])
         {
             case '#':
                 test_to_run = 1;
                 break;
             case 'b':
                 test_to_run = 2;
-                benchmark_runs = atoi(argv[1] + 2);
+                benchmark_runs = atoi(argv[i] + 2);
                 break;
             case 't':
                 test_to_run = 3;
-                benchmark_runs = atoi(argv[1] + 2);
+                benchmark_runs = atoi(argv[i] + 2);
+                break;
+            case 'w':
+                backend = TimerManager::WHEEL;
                 break;
             default:
                 printf("param error!\n");
@@ -233,7 +479,19 @@ int main(int argc __attribute__((unused)), char **argv __attribute__((unused)))
     if(!benchmark_runs)
         benchmark_runs = 1000000;
 
+    check_dary_heap();
+    check_timer_wheel();
+    check_timer_shard(TimerManager::HEAP, false);
+    check_timer_shard(TimerManager::WHEEL, false);
+    check_timer_shard(TimerManager::HEAP, true);
+    check_timer_shard(TimerManager::WHEEL, true);
+    check_timer_shard(TimerManager::HEAP, false, 5000);
+    check_timer_shard(TimerManager::HEAP, true, 5000);
+    check_timer_shard(TimerManager::WHEEL, true, 5000);
+    gTimerManager = new TimerManager(128, backend);
+    printf("timer backend: %s\n", backend == TimerManager::WHEEL ? "wheel" : "heap");
     run_test();
+    delete gTimerManager;
     my_mutex_end();// 析构全局mutex attr对象
     my_thread_end();
     return 0;